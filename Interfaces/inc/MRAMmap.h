@@ -48,7 +48,7 @@ enum _StateTypes {
     ,StateTimeBroadcastEnabled
     ,StateWodEnabled
     ,StateErrWodEnabled
-    ,StateSpare2
+    ,StateFTL0Preallocate     // True if uploads reserve their full length on disk at UL_GO
     ,MaxStates
 };
 
@@ -105,8 +105,12 @@ typedef struct {
     uint8_t EXPMaxFileSize4kBlocks[2];
     uint8_t  SpacecraftMode[2];
     uint8_t  LastSpacecraftMode[2];
-    uint16_t SpareData2[4];
-    uint32_t SpareData3[7];
+    uint16_t PBStatusMaxFrequency[2];
+    uint16_t FTL0StatusMaxFrequency[2];
+    uint16_t DigiAirtimePercent[2];
+    uint16_t TxMaxDutyPercent[2];
+    uint16_t TxMaxPATemp[2];
+    uint32_t SpareData3[4];
     uint8_t  NonVolatileStates[MaxStates][2];
 } StateSavingMRAM_t;
 
@@ -114,6 +118,7 @@ typedef struct {
 /* This stores the details of an in process file upload */
 typedef struct _inProcessFileUpload {
     char callsign[MAX_CALLSIGN_LEN]; /* The callsign of the stations that initiated the upload */
+    uint8_t preallocated; /* Non zero if the tmp file may be longer than offset.  Uses padding, so the layout is unchanged */
     uint32_t file_id; /* The file id that was allocated by the dir.  A standard function calculates the tmp file name on disk */
     uint32_t length;  /* The promised length of the file given by the station when it requested the upload */
     uint32_t offset;  /* The offset at the end of the latest block uploaded */
@@ -88,6 +88,16 @@ void WriteMRAMPBClientTimeout(uint16_t freq);
 uint16_t ReadMRAMPBClientTimeout(void);
 void WriteMRAMFTL0StatusFreq(uint16_t freq);
 uint16_t ReadMRAMFTL0StatusFreq(void);
+void WriteMRAMPBStatusMaxFreq(uint16_t freq);
+uint16_t ReadMRAMPBStatusMaxFreq(void);
+void WriteMRAMFTL0StatusMaxFreq(uint16_t freq);
+uint16_t ReadMRAMFTL0StatusMaxFreq(void);
+void WriteMRAMDigiAirtimePercent(uint16_t percent);
+uint16_t ReadMRAMDigiAirtimePercent(void);
+void WriteMRAMTxMaxDutyPercent(uint16_t percent);
+uint16_t ReadMRAMTxMaxDutyPercent(void);
+void WriteMRAMTxMaxPATemp(uint16_t temp);
+uint16_t ReadMRAMTxMaxPATemp(void);
 void WriteMRAMFTL0MaxFileAgeInDays(uint8_t freq);
 uint16_t ReadMRAMFTL0MaxFileAgeInDays(void);
 void WriteMRAMTelemFreq(uint16_t freq);
@@ -416,6 +416,46 @@ void WriteMRAMFTL0StatusFreq(uint16_t freq){
 uint16_t ReadMRAMFTL0StatusFreq(void){
     READ_UINT16(FTL0StatusFrequency,UPLINK_DEFAULT_TIMER_SEND_STATUS_PERIOD_SECONDS);
 }
+
+void WriteMRAMPBStatusMaxFreq(uint16_t freq){
+    WRITE_UINT16(PBStatusMaxFrequency,freq);
+}
+
+uint16_t ReadMRAMPBStatusMaxFreq(void){
+    READ_UINT16(PBStatusMaxFrequency,PB_DEFAULT_STATUS_MAX_PERIOD_SECONDS);
+}
+
+void WriteMRAMFTL0StatusMaxFreq(uint16_t freq){
+    WRITE_UINT16(FTL0StatusMaxFrequency,freq);
+}
+
+uint16_t ReadMRAMFTL0StatusMaxFreq(void){
+    READ_UINT16(FTL0StatusMaxFrequency,UPLINK_DEFAULT_STATUS_MAX_PERIOD_SECONDS);
+}
+
+void WriteMRAMDigiAirtimePercent(uint16_t percent){
+    WRITE_UINT16(DigiAirtimePercent,percent);
+}
+
+uint16_t ReadMRAMDigiAirtimePercent(void){
+    READ_UINT16(DigiAirtimePercent,DIGI_DEFAULT_AIRTIME_PERCENT);
+}
+
+void WriteMRAMTxMaxDutyPercent(uint16_t percent){
+    WRITE_UINT16(TxMaxDutyPercent,percent);
+}
+
+uint16_t ReadMRAMTxMaxDutyPercent(void){
+    READ_UINT16(TxMaxDutyPercent,TX_DEFAULT_MAX_DUTY_PERCENT);
+}
+
+void WriteMRAMTxMaxPATemp(uint16_t temp){
+    WRITE_UINT16(TxMaxPATemp,temp);
+}
+
+uint16_t ReadMRAMTxMaxPATemp(void){
+    READ_UINT16(TxMaxPATemp,TX_DEFAULT_MAX_PA_TEMP);
+}
 void WriteMRAMFTL0MaxFileAgeInDays(uint8_t freq){
     WRITE_UINT8(FTL0UploadFileMaxAgeInDays,freq);
 }
@@ -520,6 +560,7 @@ void SetupMRAMStates() {
 #endif
 
     WriteMRAMBoolState(StateUplinkEnabled,false);
+    WriteMRAMBoolState(StateFTL0Preallocate,false);
     WriteMRAMBoolState(StateDigiEnabled,false);
     WriteMRAMBoolState(StateTelemBroadcastEnabled,true);
     WriteMRAMBoolState(StateTimeBroadcastEnabled,true);
@@ -538,6 +579,11 @@ void SetupMRAMStates() {
     WriteMRAMPBStatusFreq(PB_DEFAULT_TIMER_SEND_STATUS_PERIOD_SECONDS);
     WriteMRAMPBClientTimeout(PB_CLIENT_TIMEOUT_SECONDS);
     WriteMRAMFTL0StatusFreq(UPLINK_DEFAULT_TIMER_SEND_STATUS_PERIOD_SECONDS);
+    WriteMRAMPBStatusMaxFreq(PB_DEFAULT_STATUS_MAX_PERIOD_SECONDS);
+    WriteMRAMFTL0StatusMaxFreq(UPLINK_DEFAULT_STATUS_MAX_PERIOD_SECONDS);
+    WriteMRAMDigiAirtimePercent(DIGI_DEFAULT_AIRTIME_PERCENT);
+    WriteMRAMTxMaxDutyPercent(TX_DEFAULT_MAX_DUTY_PERCENT);
+    WriteMRAMTxMaxPATemp(TX_DEFAULT_MAX_PA_TEMP);
     WriteMRAMFTL0MaxFileAgeInDays(FTL0_DEFAULT_MAX_UPLOAD_RECORD_AGE_IN_DAYS);
     WriteMRAMTelemFreq(TAC_TIMER_SEND_TELEMETRY_PERIOD_SECONDS);
     WriteMRAMTimeFreq(TAC_TIMER_SEND_TIME_PERIOD_SECONDS);
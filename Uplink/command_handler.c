@@ -12,6 +12,7 @@
 #include "command_handler.h"
 #include "TxTask.h"
 #include "PbTask.h"
+#include "Ax25Task.h"
 #include "gpioDriver.h"
 #include "serialDriver.h"
 #include "het.h"
@@ -253,12 +254,16 @@ bool OpsSWCommands(CommandAndArgs *comarg){
         turnOn = (comarg->arguments[0] != 0);
         uint16_t period = comarg->arguments[1];
         uint16_t timeout = comarg->arguments[2];
+        uint16_t max_period = comarg->arguments[3];
         if (period == 0)
             period = PB_DEFAULT_TIMER_SEND_STATUS_PERIOD_SECONDS;
         if (timeout == 0)
             timeout = PB_CLIENT_TIMEOUT_SECONDS;
+        if (max_period < period)
+            max_period = PB_DEFAULT_STATUS_MAX_PERIOD_SECONDS < period ? period : PB_DEFAULT_STATUS_MAX_PERIOD_SECONDS;
         WriteMRAMBoolState(StatePbEnabled,turnOn);
         WriteMRAMPBStatusFreq(period);
+        WriteMRAMPBStatusMaxFreq(max_period);
         WriteMRAMPBClientTimeout(timeout);
         statusMsg.MsgType = TacUpdatePbTimer;
         NotifyInterTaskFromISR(ToTelemetryAndControl, &statusMsg);
@@ -298,13 +303,43 @@ bool OpsSWCommands(CommandAndArgs *comarg){
     case SWCmdOpsEnableDigi: {
         bool turnOn;
         turnOn = (comarg->arguments[0] != 0);
+        uint16_t airtime_percent = comarg->arguments[1];
+        if (airtime_percent == 0 || airtime_percent > 100)
+            airtime_percent = DIGI_DEFAULT_AIRTIME_PERCENT;
         if(turnOn){
-            command_print("Enable Digi\n\r");
+            command_print("Enable Digi, airtime %d%%\n\r", airtime_percent);
 
         } else {
             command_print("Disable Digi\n\r");
         }
         WriteMRAMBoolState(StateDigiEnabled,turnOn);
+        WriteMRAMDigiAirtimePercent(airtime_percent);
+        ax25_set_digi_airtime_percent(airtime_percent);
+        break;
+    }
+    case SWCmdOpsSetTxLimits: {
+        uint16_t duty_percent = comarg->arguments[0];
+        uint16_t pa_temp = comarg->arguments[1];
+        if (duty_percent == 0 || duty_percent > 100)
+            duty_percent = TX_DEFAULT_MAX_DUTY_PERCENT;
+        if (pa_temp == 0 || pa_temp > TX_PA_SHUTDOWN_TEMP)
+            pa_temp = TX_DEFAULT_MAX_PA_TEMP;
+        command_print("Set TX limits, duty cycle %d%%, PA temp %dC\n\r", duty_percent, pa_temp);
+        WriteMRAMTxMaxDutyPercent(duty_percent);
+        WriteMRAMTxMaxPATemp(pa_temp);
+        tx_set_governor_limits(duty_percent, pa_temp);
+        break;
+    }
+    case SWCmdOpsPreallocateUploads: {
+        bool turnOn;
+        turnOn = (comarg->arguments[0] != 0);
+        /* Checked by the Uplink Task for each new UL_GO, so uploads already in progress are not changed */
+        WriteMRAMBoolState(StateFTL0Preallocate,turnOn);
+        if(turnOn){
+            command_print("Preallocate uploads\n\r");
+        } else {
+            command_print("Do not preallocate uploads\n\r");
+        }
         break;
     }
     case SWCmdOpsEnableUplink: {
@@ -312,17 +347,21 @@ bool OpsSWCommands(CommandAndArgs *comarg){
         turnOn = (comarg->arguments[0] != 0);
         uint16_t period = comarg->arguments[1];
         uint16_t timeout = comarg->arguments[2];
+        uint16_t max_period = comarg->arguments[3];
         if (period == 0)
             period = UPLINK_DEFAULT_TIMER_SEND_STATUS_PERIOD_SECONDS;
         if (timeout == 0)
             timeout = FTL0_DEFAULT_MAX_UPLOAD_RECORD_AGE_IN_DAYS;
+        if (max_period < period)
+            max_period = UPLINK_DEFAULT_STATUS_MAX_PERIOD_SECONDS < period ? period : UPLINK_DEFAULT_STATUS_MAX_PERIOD_SECONDS;
         WriteMRAMBoolState(StateUplinkEnabled,turnOn);
         WriteMRAMFTL0StatusFreq(period);
+        WriteMRAMFTL0StatusMaxFreq(max_period);
         WriteMRAMFTL0MaxFileAgeInDays(timeout);
         /* The Uplink status packets are sent from Telemetry and control.  We notify that task of the
          * change with a message as it needs to modify the RTOS timer and handle error conditions.
          * The client timeout is checked in UplinkTask when it processes actions. */
-        statusMsg.MsgType = TacUpdatePbTimer;
+        statusMsg.MsgType = TacUpdateUplinkTimer;
         NotifyInterTaskFromISR(ToTelemetryAndControl, &statusMsg);
         if(turnOn){
             command_print("Enable Uplink\n\r");
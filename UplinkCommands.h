@@ -122,16 +122,18 @@ typedef enum {
 	,SWCmdOpsEnableAutosafe
 	,SWCmdOpsClearMinMax
 	,SWCmdOpsNoop
-	,SWCmdOpsEnablePb = 8
+	,SWCmdOpsEnablePb = 8 // Args = (on, status period, client timeout, max status period)
     ,SWCmdOpsFormatFs
-    ,SWCmdOpsEnableDigi
-	,SWCmdOpsEnableUplink=12
+    ,SWCmdOpsEnableDigi // Args = (on, airtime percent)
+	,SWCmdOpsEnableUplink=12 // Args = (on, status period, max upload age in days, max status period)
 	,SWCmdOpsDeployAntennas   // Args = (bus, antennaNumber,time, override)
 	,SWCmdOpsSetTime // Args = (unix time)
 	,SWCmdOpsEnableCommandTimeCheck //16
 	,SWCmdOpsResetIHU = 21 //Args = (LIHU, RTPrimary, RTSecondary), each one 1 or 0
 	,SWCmdOpsDCTTxInhibit // 22
 	,SWCmdOpsSelectDCTRFPower
+    ,SWCmdOpsPreallocateUploads // Args = (on)
+    ,SWCmdOpsSetTxLimits // Args = (max duty cycle percent, max PA temp C)
     ,SWCmdOpsSpare
     ,SWCmdOpsNumberOfCommands
 }SWOpsCommands;
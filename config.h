@@ -208,6 +208,12 @@
 #define LAST_TX_CHANNEL (FIRST_TX_CHANNEL + NUM_TX_CHANNELS - 1)
 #define NUM_CHANNELS (NUM_TX_CHANNELS + NUM_RX_CHANNELS)
 
+/* Connected sessions with the BBS, shared by all the receivers.  A session is found from the
+ * callsign and the channel the station was heard on, so more than one station can upload on
+ * a channel.  Each session has a data link and an FTL0 state machine, including its write buffer */
+#define AX25_MAX_SESSIONS (NUM_RX_CHANNELS + 2)
+#define AX25_NO_SESSION 0xFF
+
 typedef uint8_t rfchan;
 
 #define is_tx_chan(c) ((c) >= FIRST_TX_CHANNEL && (c) <= LAST_TX_CHANNEL)
@@ -265,16 +271,37 @@ typedef uint8_t rfchan;
 
 #define PB_DEFAULT_TIMER_SEND_STATUS_PERIOD_SECONDS 30 //SECONDS(30)
 #define UPLINK_DEFAULT_TIMER_SEND_STATUS_PERIOD_SECONDS 60 //SECONDS(30)
+/* The status periods above are the fastest rate, used just after the PB or Uplink changes state.  When
+ * nothing changes the period doubles after each status packet until it reaches these keepalive periods */
+#define PB_DEFAULT_STATUS_MAX_PERIOD_SECONDS 240
+#define UPLINK_DEFAULT_STATUS_MAX_PERIOD_SECONDS 240
 
 #define PB_CLIENT_TIMEOUT_SECONDS 600  // the maximum time a station can be on the PB
 #define MAX_PKTS_IN_TX_PKT_QUEUE_FOR_TNC_TO_BE_BUSY 2 // TODO - Should be in MRAM and commandable. 2
 
-/* T1 is the timeout for outstanding I frame or P bit.  Traditionally set to the Smoothed Rountrip Time (SRT), which is
- * calculated for the channel.  For a full duplex sat this is perhaps not appropriate.
+/* T1 is the timeout for outstanding I frame or P bit.  It starts at AX25_TIMER_T1_PERIOD and then follows twice the
+ * Smoothed Rountrip Time (SRT) measured for the connection, within the MIN and MAX periods.
  */
 #define AX25_TIMER_T1_PERIOD SECONDS(3)
+#define AX25_TIMER_T1_MIN_PERIOD SECONDS(1) /* Shortest T1 selected from the measured round trip time */
+#define AX25_TIMER_T1_MAX_PERIOD SECONDS(15) /* Longest T1 a station can ask for with XID.  Less than T3 */
+#define AX25_TIMER_T2_PERIOD CENTISECONDS(100) /* Delay before we send an RR, so one acks several I frames.  Less than T1 */
 #define AX25_TIMER_T3_PERIOD SECONDS(30) /* Idle timeout if nothing heard */
 #define AX25_RETRIES_N2 10 /* Number of retries permitted by the Data Link State Machine */
+/* The SRT of recently connected stations is kept, so a station that connects again starts with the T1 it had
+ * rather than the default.  Entries older than AX25_RTT_CACHE_MAX_AGE are from an earlier pass and are not used */
+#define AX25_RTT_CACHE_LEN 8
+#define AX25_RTT_CACHE_MAX_AGE MINUTES(15)
+
+/* A frame the digipeater repeated is not repeated again if it is heard within DIGI_DUPLICATE_WINDOW, from
+ * any receiver.  The digipeater may use DIGI_DEFAULT_AIRTIME_PERCENT of the transmitter time averaged over
+ * DIGI_AIRTIME_WINDOW_SECONDS, which is also the longest burst it can save up.  The percent is in MRAM and
+ * is set with the Enable Digi command. */
+#define DIGI_DUPLICATE_CACHE_LEN 16
+#define DIGI_DUPLICATE_WINDOW SECONDS(30)
+#define DIGI_DEFAULT_AIRTIME_PERCENT 25
+#define DIGI_AIRTIME_WINDOW_SECONDS 60
+#define DIGI_FRAME_OVERHEAD_BYTES 8 /* Flags and CRC added to each frame when estimating airtime */
 
 // Default is to send telemetry every 2 mins, time every 5 mins and save WOD every 5 mins
 #define TAC_TIMER_SEND_TELEMETRY_PERIOD_SECONDS 120 //SECONDS(120)
@@ -338,7 +365,24 @@ typedef uint8_t rfchan;
 
 #define TX_STACK_SIZE configMINIMAL_STACK_SIZE*11
 #define TX_PRIORITY (tskIDLE_PRIORITY + 3)
-#define TX_PACKET_QUEUE_LEN 5
+/* One TX queue for each class in enum tx_class, see TxTask.h.  Each entry holds a whole frame */
+#define TX_CONTROL_QUEUE_LEN 2
+#define TX_CONNECTED_QUEUE_LEN 3
+#define TX_PB_QUEUE_LEN 3
+#define TX_TELEMETRY_QUEUE_LEN 2
+#define TX_CLASS_MAX_PASSED_OVER 2 /* Frames sent from higher classes before a waiting lower class gets a turn */
+
+/* The TX governor holds PB frames once the duty cycle over the last TX_DUTY_SLOTS * TX_DUTY_SLOT_TICKS reaches
+ * TX_THROTTLE_PB_PERCENT of the max duty cycle, or the PA gets within TX_PA_TEMP_MARGIN of the max PA temperature.
+ * At the max of either only control frames go.  The max duty cycle and PA temperature (C) are in MRAM and set
+ * with the Set TX Limits command.  The IOTask turns the PA off above TX_PA_SHUTDOWN_TEMP whatever the governor does */
+#define TX_DUTY_SLOT_TICKS SECONDS(10)
+#define TX_DUTY_SLOTS 6
+#define TX_THROTTLE_PB_PERCENT 80
+#define TX_PA_TEMP_MARGIN 5
+#define TX_DEFAULT_MAX_DUTY_PERCENT 75
+#define TX_DEFAULT_MAX_PA_TEMP 45
+#define TX_PA_SHUTDOWN_TEMP 50
 
 #define AX25_STACK_SIZE configMINIMAL_STACK_SIZE*11
 #define AX25_PRIORITY (tskIDLE_PRIORITY + 2)
@@ -350,6 +394,9 @@ typedef uint8_t rfchan;
 #define UPLINK_STACK_SIZE configMINIMAL_STACK_SIZE*11
 #define UPLINK_PRIORITY (tskIDLE_PRIORITY + 2)
 #define UPLINK_PACKET_QUEUE_LEN 5
+#define UPLINK_FLOW_OFF_HIGH_WATERMARK 3 /* Events waiting for the Uplink when we send RNR to stop more I frames */
+#define UPLINK_FLOW_ON_LOW_WATERMARK 1 /* Events waiting for the Uplink when we send RR to allow I frames again */
+#define UPLINK_FINALIZE_QUEUE_LEN 6 /* Uploaded files that can wait for validation and commit after DATA_END */
 
 
 // Telemetry constants
@@ -433,8 +480,16 @@ enum radio_modulation {
     MODULATION_MSK_50K_FEC = FEC_CONV << 4 | MODULATION_MSK_50K,
     MODULATION_MSK_100K = 7,
     MODULATION_MSK_100K_FEC = FEC_CONV << 4 | MODULATION_MSK_100K,
+
+    /*
+     * FX.25 is done by the TxTask, the radio sends ordinary AX.25.
+     * Receivers without FX.25 can still decode these.
+     */
+    MODULATION_AFSK_1200_FX25 = FEC_RS << 4 | MODULATION_AFSK_1200,
+    MODULATION_GMSK_9600_FX25 = FEC_RS << 4 | MODULATION_GMSK_9600,
 };
 char *modulation_to_str(enum radio_modulation mod);
+uint32_t modulation_to_bit_rate(enum radio_modulation mod);
 
 #define MODULATION_TO_BASE_MODULATION(mod) ((enum radio_modulation) ((mod) & 0xf))
 #define MODULATION_TO_FEC(mod) ((enum fec) (((mod) >> 4) & 0xf))
@@ -424,7 +424,13 @@ struct axradio_address {
  */
 #define AX5043_RECV_FLAG_ERR_MASK 0x7c
 
+/* Read bits of FIFOSTAT */
+#define AX5043_FIFOSTAT_EMPTY   0x01
+#define AX5043_FIFOSTAT_FREETHR 0x20 /* Free space is above FIFOTHRESH */
+
 uint16_t fifo_free(rfchan chan);
+uint8_t fifo_status(rfchan chan);
+void fifo_set_free_threshold(rfchan chan, uint16_t threshold);
 void fifo_clear(rfchan chan);
 void fifo_repeat_byte(rfchan chan, uint8_t b, uint8_t count, uint8_t flags);
 void fifo_commit(rfchan chan);
@@ -439,4 +445,5 @@ void ax5043Test(rfchan chan);
 void ax5043Dump(rfchan chan);
 
 unsigned int ax5043ReadReg(rfchan chan, unsigned int reg);
+void ax5043ReadFifo(rfchan chan, uint8_t *buf, uint16_t len);
 void ax5043WriteReg(rfchan chan, unsigned int reg, unsigned int val);
@@ -36,4 +36,10 @@ bool readNV(void *data, uint32_t dataLength, NVType memoryType,  uint32_t addres
  */
 int getSizeNV(NVType type);
 
+/*
+ * Return the total number of bytes written to the non-volatile region
+ * since boot.
+ */
+uint32_t getBytesWrittenNV(NVType type);
+
 #endif /* NONVOL_H_ */
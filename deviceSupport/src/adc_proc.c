@@ -156,7 +156,7 @@ handle_adc_temp(unsigned int pin, int millivolts)
     switch (pin) {
     case ADC_PIN_PA_TEMP:
         board_temps[TEMPERATURE_VAL_PA] = temp;
-        if (temp > 50) {
+        if (temp > TX_PA_SHUTDOWN_TEMP) {
             debug_print("PA over temp, shutting down the PA\n");
             GPIOSetOff(SSPAPower);
         }
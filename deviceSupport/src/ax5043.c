@@ -60,6 +60,7 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "config.h"
 #include "os_task.h"
@@ -68,6 +69,15 @@
 
 /* Forward declarations */
 static uint8_t ax5043_reset(rfchan device);
+static void ax5043WriteFifo(rfchan device, uint8_t *burst, uint16_t len);
+
+/*
+ * FIFO commands are built here after the two address bytes and written
+ * to the AX5043 with one SPI transfer.  Room for the DATA command, its
+ * length and flags, and the largest buffer fifo_queue_buffer() takes.
+ */
+#define AX5043_FIFO_ADDR_LEN 2
+static uint8_t fifo_burst_buf[AX5043_FIFO_ADDR_LEN + 3 + 255];
 
 static const uint8_t axradio_phy_chanpllrnginit = 0x09;
 
@@ -155,6 +165,8 @@ static void ax5043_set_modulation_base(rfchan device,
         /* We use only FEC at 25K and above, so that code will set this. */
         ax5043WriteReg(device, AX5043_ENCODING, 0x07);
         break;
+    default:
+        break;
     }
 
     /**
@@ -209,6 +221,8 @@ static void ax5043_set_modulation_base(rfchan device,
         ax5043WriteReg(device, AX5043_IFFREQ1, 0x10);
         ax5043WriteReg(device, AX5043_IFFREQ0, 0x8d);
         break;
+    default:
+        break;
     }
 
     /**
@@ -272,6 +286,8 @@ static void ax5043_set_modulation_base(rfchan device,
         /* Per radiolab. */
         ax5043WriteReg(device, AX5043_DECIMATION, 0x01);
         break;
+    default:
+        break;
     }
 
     /**
@@ -327,6 +343,8 @@ static void ax5043_set_modulation_base(rfchan device,
         ax5043WriteReg(device, AX5043_RXDATARATE1, 0x50);
         ax5043WriteReg(device, AX5043_RXDATARATE0, 0x00);
         break;
+    default:
+        break;
     }
 
     /**
@@ -364,6 +382,8 @@ static void ax5043_set_modulation_base(rfchan device,
         ax5043WriteReg(device, AX5043_MAXRFOFFSET1, 0x00);
         ax5043WriteReg(device, AX5043_MAXRFOFFSET0, 0x00);
         break;
+    default:
+        break;
     }
 
   /*
@@ -385,6 +405,8 @@ static void ax5043_set_modulation_base(rfchan device,
     case MODULATION_MSK_100K:
         // not needed for 9600, only 1200bps AFSK
         break;
+    default:
+        break;
     }
 
     /**
@@ -449,6 +471,8 @@ static void ax5043_set_modulation_base(rfchan device,
         /* Per radiolab */
         ax5043WriteReg(device, AX5043_AGCGAIN0, 0x83);
         break;
+    default:
+        break;
     }
 
     /**
@@ -512,6 +536,8 @@ static void ax5043_set_modulation_base(rfchan device,
         ax5043WriteReg(device, AX5043_DRGAIN0, 0xa3); // RX Only
         ax5043WriteReg(device, AX5043_PHASEGAIN0, 0x83);
         break;
+    default:
+        break;
     }
 
     /*
@@ -580,6 +606,8 @@ static void ax5043_set_modulation_base(rfchan device,
         ax5043WriteReg(device, AX5043_FREQUENCYGAINC0, 0x05);
         ax5043WriteReg(device, AX5043_FREQUENCYGAIND0, 0x05);
         break;
+    default:
+        break;
     }
 
     /* RX Only? */
@@ -621,6 +649,8 @@ static void ax5043_set_modulation_base(rfchan device,
         /* Per radiolab. */
         ax5043WriteReg(device, AX5043_AGCGAIN1, 0x83);
         break;
+    default:
+        break;
     }
 
     switch (mod) {
@@ -665,6 +695,8 @@ static void ax5043_set_modulation_base(rfchan device,
         ax5043WriteReg(device, AX5043_DRGAIN1, 0xa2);
         ax5043WriteReg(device, AX5043_PHASEGAIN1, 0x83);
         break;
+    default:
+        break;
     }
 
     switch (mod) {
@@ -737,6 +769,8 @@ static void ax5043_set_modulation_base(rfchan device,
         ax5043WriteReg(device, AX5043_FREQUENCYGAINC1, 0x05);
         ax5043WriteReg(device, AX5043_FREQUENCYGAIND1, 0x05);
         break;
+    default:
+        break;
     }
 
     switch (mod) {
@@ -753,6 +787,8 @@ static void ax5043_set_modulation_base(rfchan device,
     case MODULATION_MSK_100K:
         ax5043WriteReg(device, AX5043_FREQDEV01, 0x2D); // per radio lab
         break;
+    default:
+        break;
     }
 
     switch (mod) {
@@ -791,6 +827,8 @@ static void ax5043_set_modulation_base(rfchan device,
         ax5043WriteReg(device, AX5043_DRGAIN3, 0xa1);
         ax5043WriteReg(device, AX5043_PHASEGAIN3, 0x83);
         break;
+    default:
+        break;
     }
 
     switch (mod) {
@@ -856,6 +894,8 @@ static void ax5043_set_modulation_base(rfchan device,
         ax5043WriteReg(device, AX5043_FREQUENCYGAINC3, 0x09);
         ax5043WriteReg(device, AX5043_FREQUENCYGAIND3, 0x09);
         break;
+    default:
+        break;
     }
 
     switch (mod) {
@@ -872,6 +912,8 @@ static void ax5043_set_modulation_base(rfchan device,
     case MODULATION_MSK_100K:
         ax5043WriteReg(device, AX5043_FREQDEV03, 0x2D); // per radio lab
         break;
+    default:
+        break;
     }
 
   /*
@@ -904,6 +946,8 @@ static void ax5043_set_modulation_base(rfchan device,
          */
         ax5043WriteReg(device, AX5043_MODCFGF, 0x00);
         break;
+    default:
+        break;
     }
 
     /* Set the Frequency Deviation  TODO -- THIS IS JUST THE TX VALUE?? */
@@ -970,6 +1014,8 @@ static void ax5043_set_modulation_base(rfchan device,
         ax5043WriteReg(device, AX5043_FSKDEV1, 0x66);
         ax5043WriteReg(device, AX5043_FSKDEV0, 0x66);
         break;
+    default:
+        break;
     }
 
     /* TXRATE = BITRATE/Fxtal * 2^24 + 1/2
@@ -1034,6 +1080,8 @@ static void ax5043_set_modulation_base(rfchan device,
         ax5043WriteReg(device, AX5043_TXRATE1, 0x99);
         ax5043WriteReg(device, AX5043_TXRATE0, 0x9a);
         break;
+    default:
+        break;
     }
 
     /* baseband tuning value - per radio lab */
@@ -1069,6 +1117,8 @@ static void ax5043_set_modulation_base(rfchan device,
         // Bit 7 - 1 = raw, 0 = scrambled
         ax5043WriteReg(device, AX5043_MATCH1LEN, 0x0A);
         break;
+    default:
+        break;
     }
 
     ax5043_set_fec(device, fec);
@@ -1100,6 +1150,8 @@ static void ax5043_set_modulation_tx(rfchan device, enum radio_modulation mod)
     case MODULATION_MSK_50K:
     case MODULATION_MSK_100K:
         break;
+    default:
+        break;
     }
 }
 
@@ -1128,6 +1180,8 @@ static void ax5043_set_modulation_rx(rfchan device, enum radio_modulation mod)
     case MODULATION_MSK_50K:
     case MODULATION_MSK_100K:
         break;
+    default:
+        break;
     }
 }
 
@@ -2010,21 +2064,32 @@ void fifo_clear(rfchan device)
 void fifo_repeat_byte(rfchan device, uint8_t b, uint8_t count,
                       uint8_t flags)
 {
-    ax5043WriteReg(device, AX5043_FIFODATA, AX5043_FIFOCMD_REPEATDATA | (3 << 5));
-    ax5043WriteReg(device, AX5043_FIFODATA, flags);
-    ax5043WriteReg(device, AX5043_FIFODATA, count);
-    ax5043WriteReg(device, AX5043_FIFODATA, b);
+    uint8_t burst[AX5043_FIFO_ADDR_LEN + 4];
+
+    burst[AX5043_FIFO_ADDR_LEN] = AX5043_FIFOCMD_REPEATDATA | (3 << 5);
+    burst[AX5043_FIFO_ADDR_LEN + 1] = flags;
+    burst[AX5043_FIFO_ADDR_LEN + 2] = count;
+    burst[AX5043_FIFO_ADDR_LEN + 3] = b;
+    ax5043WriteFifo(device, burst, 4);
 }
 
+/*
+ * Queue a DATA command with up to 254 bytes, as the length byte also
+ * counts the flags.  This is one SPI transfer rather than one for each
+ * byte.  Only the TxTask loads the FIFO, so the buffer is shared.
+ */
 void fifo_queue_buffer(rfchan device, uint8_t *buf, uint8_t len,
                        uint8_t flags)
 {
-    ax5043WriteReg(device, AX5043_FIFODATA, AX5043_FIFOCMD_DATA | (7 << 5));
-    ax5043WriteReg(device, AX5043_FIFODATA, len+1); //len includes the flag byte
-    ax5043WriteReg(device, AX5043_FIFODATA, flags);
-    while(len--) {
-        ax5043WriteReg(device, AX5043_FIFODATA, *buf++);
-    }
+    uint8_t *cmd = &fifo_burst_buf[AX5043_FIFO_ADDR_LEN];
+
+    if (len > 254)
+        len = 254;
+    cmd[0] = AX5043_FIFOCMD_DATA | (7 << 5);
+    cmd[1] = len+1; //len includes the flag byte
+    cmd[2] = flags;
+    memcpy(&cmd[3], buf, len);
+    ax5043WriteFifo(device, fifo_burst_buf, len + 3);
 }
 
 uint16_t fifo_free(rfchan device)
@@ -2033,6 +2098,22 @@ uint16_t fifo_free(rfchan device)
             + ax5043ReadReg(device, AX5043_FIFOFREE0));
 }
 
+/*
+ * One register read that says whether the FIFO is empty and whether the
+ * free space is above the threshold that raises the TX interrupt.
+ */
+uint8_t fifo_status(rfchan device)
+{
+    return ax5043ReadReg(device, AX5043_FIFOSTAT);
+}
+
+/* Raise the FIFO free interrupt when more than threshold bytes are free */
+void fifo_set_free_threshold(rfchan device, uint16_t threshold)
+{
+    ax5043WriteReg(device, AX5043_FIFOTHRESH1, threshold >> 8);
+    ax5043WriteReg(device, AX5043_FIFOTHRESH0, threshold & 0xff);
+}
+
 static int32_t axradio_conv_freq_fromhz(int32_t f)
 {
     return (int32_t) (f * 1.048576);
@@ -2089,6 +2170,25 @@ void ax5043WriteReg(rfchan device, unsigned int reg, unsigned int val)
 #endif
 }
 
+/*
+ * Write len bytes to FIFODATA in one SPI transfer.  The FIFO address is
+ * not incremented in a burst, so each byte after the address goes into
+ * the FIFO.  The burst buffer starts with AX5043_FIFO_ADDR_LEN bytes
+ * for the address, which are filled in here, and then the len bytes.
+ */
+static void ax5043WriteFifo(rfchan device, uint8_t *burst, uint16_t len)
+{
+    struct AX5043Info *info = ax5043_get_info(device);
+
+    if (!info)
+        return;
+
+    burst[0] = 0x00f0 | ((AX5043_FIFODATA & 0xf00) >> 8);
+    burst[1] = (AX5043_FIFODATA & 0xff);
+
+    SPISendCommand(info->spidev, 0, 0, burst, AX5043_FIFO_ADDR_LEN + len, 0, 0);
+}
+
 static unsigned int ax5043ReadLongreg(rfchan device,
                                       unsigned int reg, int bytes)
 {
@@ -2119,6 +2219,26 @@ unsigned int ax5043ReadReg(rfchan device, unsigned int reg)
     return ax5043ReadLongreg(device, reg, 1);
 }
 
+/*
+ * Read len bytes from FIFODATA in one SPI transfer.  As with
+ * ax5043WriteFifo() the address does not increment, so these are the
+ * next len bytes in the FIFO.  The caller must know they are there,
+ * from the length of the FIFO command.
+ */
+void ax5043ReadFifo(rfchan device, uint8_t *buf, uint16_t len)
+{
+    uint8_t srcbuf[2];
+    struct AX5043Info *info = ax5043_get_info(device);
+
+    if (!info || len == 0)
+        return;
+
+    srcbuf[0] = 0x0070 | ((AX5043_FIFODATA & 0xf00) >> 8);
+    srcbuf[1] = (AX5043_FIFODATA & 0xff);
+
+    SPISendCommand(info->spidev, 0, 0, srcbuf, 2, buf, len);
+}
+
 void ax5043Test(rfchan device)
 {
     ax5043WriteReg(device, AX5043_SCRATCH, device);
@@ -16,9 +16,24 @@
 #include "spiDriver.h"
 #include "errors.h"
 
+/*
+ * Running count of the bytes written to each area.  This lets us see how
+ * many MRAM bytes the file system writes for the data it is given.
+ */
+static uint32_t bytesWrittenNV[NVEntireMRAM+1];
+
+uint32_t getBytesWrittenNV(NVType type)
+{
+    if (type > NVEntireMRAM)
+        return 0;
+    return bytesWrittenNV[type];
+}
+
 bool writeNV(void const * const data, uint32_t dataLength, NVType type,
 	     uint32_t nvAddress)
 {
+    if (type <= NVEntireMRAM)
+        bytesWrittenNV[type] += dataLength;
     switch (type) {
     case NVConfigData:
 	return writeMRAM(0, data, dataLength, nvAddress);
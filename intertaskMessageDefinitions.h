@@ -80,6 +80,8 @@ typedef enum {
     TacSaveErrWodMsg,
     TacUpdateErrWodTimer,
     TacCheckFileQueuesMsg,
+    TacPbStatusChanged,
+    TacUplinkStatusChanged,
 
     /*
      * Messages to the CAN task
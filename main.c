@@ -82,8 +82,7 @@ QueueHandle_t xRxPacketQueue; /* RTOS Queue for packets received by the RX (AX25
 QueueHandle_t xRxEventQueue; /* RTOS Queue for events received by the AX25 Data Link */
 QueueHandle_t xPbPacketQueue; /* RTOS Queue for packets received and sent to the PB task */
 QueueHandle_t xUplinkEventQueue; /* RTOS Queue for events received and sent to the UPLINK task */
-QueueHandle_t xTxPacketQueue; /* RTOS Queue for packets sent to the TX */
-QueueHandle_t xIFrameQueue[NUM_RX_CHANNELS]; /* RTOS Queues for Data IFrames sent from Uplink to AX25 Data Link */
+QueueHandle_t xIFrameQueue[AX25_MAX_SESSIONS]; /* RTOS Queues for Data IFrames sent from Uplink to AX25 Data Link, one per session */
 //bool rate_9600; /* The rate for the AX25 link.  Loaded from MRAM.  */
 bool CANPrintTelemetry,CANPrintCoord,CANPrintCommands,CANPrintAny,CANPrintCount,CANPrintErrors,CANPrintEttus;
 bool monitorTxPackets, monitorRxPackets, monitorRSSI, monitor_raw;
@@ -379,6 +378,8 @@ void ConsoleTask(void *pvParameters)
         ReportError(REDFSIOerror, FALSE, CharString,
              (int)"ERROR: Could not load directory from MRAM");
     }
+    /* Load the file upload table before the tasks that use it start */
+    ftl0_init();
 
     xTaskCreate(IOTask, "IOTask", CAN_STACK_SIZE, NULL,
                 CAN_PRIORITY, NULL);
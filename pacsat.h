@@ -33,8 +33,7 @@ extern QueueHandle_t xRxPacketQueue; // This queue holds packets that have just
 extern QueueHandle_t xRxEventQueue; // This queue holds events that need to be processed by the Ax25Task / Data Link State Machine
 extern QueueHandle_t xPbPacketQueue; // This holds packets that need to be processed by the Pacsat Broadcast task
 extern QueueHandle_t xUplinkEventQueue; // This queue holds events/packets that need to be processed by the Uplink Task / State Machine
-extern QueueHandle_t xTxPacketQueue; // This queue holds packets that are going to be transmitted
-extern QueueHandle_t xIFrameQueue[NUM_RX_CHANNELS]; // Queue of frames to be transmitted
+extern QueueHandle_t xIFrameQueue[AX25_MAX_SESSIONS]; // Queue of handles to pooled frames to be transmitted
 
 extern uint8_t spacecraftMode;
 extern uint8_t lastSpacecraftMode;
@@ -13,7 +13,23 @@
 
 #define MODULO 8
 #define K 4 /* The maximum number of frames we can have outstanding.  4 for MOD 8, 32 for MOD 128 */
-#define IFRAME_QUEUE_LEN 10
+#define MODULO_EXTENDED 128 /* Used when the station connects with SABME (v2.2) */
+#define K_EXTENDED 16 /* The window for MOD 128.  Up to 32, but frames awaiting an ack hold buffers from the packet pool */
+#define I_FRAMES_SENT_LEN 16 /* Slots for frames awaiting an ack, indexed by NS.  Power of 2 and at least K_EXTENDED */
+#define SREJ_HELD_FRAMES 4 /* Out of sequence I frames held per channel while the missing one is requested with SREJ.  Power of 2 */
+#define IFRAME_QUEUE_BACKLOG 10 /* New I frames the uplink may queue for a session */
+#define IFRAME_QUEUE_LEN 26 /* The backlog plus a whole window put back on the queue to be sent again */
+#define AX25_PACKET_POOL_LEN 32 /* I frames, shared by all channels, that are queued to send or awaiting an ack */
+#define AX25_TIMER_WHEEL_TICK CENTISECONDS(10) /* The link timers are this accurate.  Also the longest the Ax25Task sleeps */
+#define AX25_TIMER_WHEEL_SLOTS 64 /* Power of 2.  Timers longer than the SLOTS * TICK go round the wheel more than once */
+#define AX25_MAX_RX_INFO_LEN (AX25_MAX_INFO_BYTES_LEN - 1) /* Largest I field we accept.  Sent to the other station in XID */
+
+#if (K_EXTENDED > 32) || (K_EXTENDED > I_FRAMES_SENT_LEN) || (K > I_FRAMES_SENT_LEN)
+#error "The AX25 window is larger than the I_frames_sent storage"
+#endif
+#if (IFRAME_QUEUE_LEN < K_EXTENDED + IFRAME_QUEUE_BACKLOG)
+#error "The I frame queue can not hold the backlog and a whole window being sent again"
+#endif
 
 typedef enum {
     DISCONNECTED,
@@ -85,11 +101,20 @@ typedef enum {
 } ax25_error_t;
 
 
+/*
+ * A reference to an I frame in the packet pool.  The xIFrameQueues and
+ * I_frames_sent hold these rather than copies of the packet.
+ */
+typedef uint8_t AX25_PACKET_HANDLE;
+#define AX25_NO_PACKET 0
+
 typedef struct {
+    uint8_t session; /* Index of the connection in the data link and FTL0 state machine tables */
     uint8_t rx_channel;
     AX25_primitive_t primitive;
     AX25_PACKET packet; // This needs to be a copy to avoid the data being changed before it is processed
     ax25_error_t error_num;
+    AX25_PACKET_HANDLE iframe; // For DL_POP_IFRAME_Request, the frame popped off the xIFrameQueue
 } AX25_event_t;
 
 typedef enum {
@@ -99,11 +124,16 @@ typedef enum {
 
 typedef struct {
     AX25_data_link_state_t dl_state;
-    uint8_t channel;
+    uint8_t session; /* Our index in the connection table */
+    uint8_t channel; /* The receiver the station was heard on */
     char callsign[MAX_CALLSIGN_LEN];
     AX25_PACKET decoded_packet;
     AX25_PACKET response_packet;
-    AX25_PACKET I_frames_sent[MODULO]; /* Circular buffer (queue) of information to be transmitted in I frames */
+    ax25_version_t version; /* v2.0 uses MOD 8 and v2.2 uses MOD 128, set by SABM or SABME */
+    uint8_t modulo; /* MODULO or MODULO_EXTENDED for this connection */
+    uint8_t k; /* The window, the maximum number of I frames outstanding for this connection */
+    uint16_t n1; /* The maximum bytes in the I field of frames we send, which the other station can lower with XID */
+    AX25_PACKET_HANDLE I_frames_sent[I_FRAMES_SENT_LEN]; /* I frames awaiting an ack, indexed by NS.  Each holds a pool reference */
     uint8_t que_read_pos; // This is the head of the queue and where the next frame is read from
     uint8_t que_length; // how many items in the queue
     uint8_t VS;   /* Send state variable.  The next sequential number to be assigned to the next I frame */
@@ -112,21 +142,52 @@ typedef struct {
                      Updated when an I frame received and their (NS) send sequence number equals VR */
     uint8_t RC;  /* Retry count.  When this equals AX25_RETRIES_N2 we disconnect. */
     int SRTInTicks; /* Smoothed round trip time for packets between the two stations */
-    int T1VInTicks; /* Calculated time for T1 timer */
-    int T1TimeWhenLastStoppedInTicks; /* Time on T1 when it was stopped */
+    int T1VInTicks; /* Time for the T1 timer.  Twice SRT, or longer if the other station asks with XID */
+    TickType_t T1StartedInTicks; /* Tick count when T1 was last started or restarted */
+    int T1ElapsedWhenStoppedInTicks; /* How long T1 ran before we stopped it, or -1 if that is not a valid round trip time */
     bool layer_3_initiated_the_request;  /* SABM was sent at request of Layer 3 (Uplink state machine) i.e. DL_CONNECT_Request */
     bool peer_receiver_busy; /* Remote station is busy and can not receive I frames */
     bool own_receiver_busy;  /* Layer 3 (the Uplink state machine) is busy and can not reveive I frames */
     bool reject_exception;   /* A REJ frame has been sent to the remote station */
     int srej_exception;     /* A selective reject has been sent to the remote station */
+    bool srej_enabled;      /* SREJ is used on v2.2 connections, otherwise REJ */
+    uint8_t held_mask;      /* Bit n is set when I_frames_held[n] holds a frame */
+    AX25_PACKET I_frames_held[SREJ_HELD_FRAMES]; /* I frames received after a missing frame, indexed by NS */
     bool achnowledge_pending; /* I frames received but not yet acknowledged to the remote station */
+    uint8_t iframes_pending; /* In sequence I frames received while achnowledge_pending was set */
 } AX25_data_link_state_machine_t;
 
+/* Frames for the digipeater callsign and what happened to them */
+typedef struct {
+    uint32_t forwarded;   /* Added to the TX queue */
+    uint32_t duplicates;  /* Dropped as already repeated within DIGI_DUPLICATE_WINDOW */
+    uint32_t over_budget; /* Dropped as the digi airtime budget was used up */
+    uint32_t queue_full;  /* Dropped as the TX queue was full */
+} AX25_digi_counters_t;
+
+/* The work done by the link timers, to compare with the frames handled */
+typedef struct {
+    uint32_t operations; /* Timers started or stopped */
+    uint32_t expired;    /* Timers that expired */
+    uint32_t frames;     /* Frames received and I frames sent by the state machines */
+} AX25_timer_counters_t;
+
 /*
  * Routine prototypes
  */
 void Ax25Task(void *pvParameters);
 void ax25_send_status();
+void ax25_wake();
+void ax25_set_digi_airtime_percent(uint16_t percent);
+void ax25_set_tx_modulation(enum radio_modulation mod);
+void ax25_digi_counters(AX25_digi_counters_t *counters);
+void ax25_timer_counters(AX25_timer_counters_t *counters);
+AX25_PACKET_HANDLE ax25_packet_alloc();
+AX25_PACKET *ax25_packet(AX25_PACKET_HANDLE handle);
+void ax25_packet_retain(AX25_PACKET_HANDLE handle);
+void ax25_packet_release(AX25_PACKET_HANDLE handle);
 bool test_ax25_retransmission();
+bool test_ax25_window_goodput();
+bool test_ax25_timer_wheel();
 
 #endif /* TASKS_INC_AX25TASK_H_ */
@@ -19,6 +19,8 @@ void TelemAndControlTask(void *pvParameters);
 void tac_clear_minmax();
 void tac_roll_file(char *file_name_with_path, char *folder, char *prefix);
 void tac_check_auto_safe(void);
+void tac_pb_status_changed();
+void tac_uplink_status_changed();
 
 /* Test routines */
 bool tac_test_wod_file();
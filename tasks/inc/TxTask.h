@@ -25,25 +25,93 @@ uint8_t get_tx_dac_val(void);
 void set_tx_pow(uint8_t val);
 uint8_t get_tx_pow(void);
 
+/*
+ * The TX queues, highest priority first.  The expedited responses and
+ * UA and DM go ahead of everything.  Connected mode I frames share a
+ * queue with the S frames, so the N(R) the other station sees never goes
+ * backwards.  The digipeater shares the PB queue.
+ */
+enum tx_class {
+    TX_CLASS_CONTROL,
+    TX_CLASS_CONNECTED,
+    TX_CLASS_PB,
+    TX_CLASS_TELEMETRY,
+    TX_NUM_CLASSES
+};
+
 typedef struct {
     uint8_t channel;
     uint8_t tx_modulation;
     uint8_t bytes[MAX_DATA_LEN];
     uint16_t len;
+    TickType_t queued; /* When it was put on the TX queue */
 } tx_radio_buffer_t;
 
+/*
+ * The time spent loading frames into the AX5043 FIFO.  A load takes much
+ * less than a tick, so the ticks counted across each load only give the
+ * time per frame when averaged over many frames.
+ */
+typedef struct {
+    uint32_t frames;
+    uint32_t load_ticks;
+    uint32_t burst_frames; /* Sent straight after the previous frame, without a preamble */
+    uint32_t refills; /* Loads on the FIFO threshold interrupt during long frames */
+    uint32_t underruns; /* The FIFO ran dry before the end of a frame */
+    uint32_t fx25_frames; /* Sent with FX.25 FEC */
+    uint32_t fx25_too_long; /* Sent as plain AX.25 with an FX.25 modulation, as they did not fit */
+} TX_fifo_counters_t;
+
+/*
+ * The frames sent from each TX queue and how long they waited in it.  The
+ * wait of the control and connected classes is the delay we add to the
+ * acks the ground station is timing.
+ */
+typedef struct {
+    uint32_t frames[TX_NUM_CLASSES];
+    uint32_t wait_ticks[TX_NUM_CLASSES];
+    uint32_t max_wait_ticks[TX_NUM_CLASSES];
+    uint32_t dropped[TX_NUM_CLASSES]; /* The queue was full */
+} TX_queue_counters_t;
+
+/*
+ * What the TX governor lets through.  Each level holds more of the TX
+ * queues, but control frames always go.
+ */
+enum tx_throttle {
+    TX_THROTTLE_NONE,
+    TX_THROTTLE_PB,           /* PB and digipeated frames are held */
+    TX_THROTTLE_CONTROL_ONLY, /* Only the control class goes */
+    TX_THROTTLE_LEVELS
+};
+
+typedef struct {
+    uint8_t duty_percent; /* Transmitter keyed over the last TX_DUTY_SLOTS * TX_DUTY_SLOT_TICKS */
+    int8_t pa_temp;
+    uint8_t throttle; /* enum tx_throttle */
+    uint32_t throttled_ticks[TX_THROTTLE_LEVELS]; /* Time spent at each level */
+} TX_governor_status_t;
+
 /*
  * Routine prototypes
  */
 
 void TxTask(void *pvParameters);
+void tx_fifo_counters(TX_fifo_counters_t *counters);
+void tx_queue_counters(TX_queue_counters_t *counters);
+void tx_governor_status(TX_governor_status_t *status);
+void tx_set_governor_limits(uint16_t max_duty_percent, uint16_t max_pa_temp);
+UBaseType_t tx_packets_waiting(enum tx_class tx_class);
+bool tx_queue_radio_buffer(tx_radio_buffer_t *buffer, enum tx_class tx_class,
+                           TickType_t xTicksToWait);
 bool tx_send_ui_packet(char *from_callsign, char *to_callsign, uint8_t pid,
-		       uint8_t *bytes, int len, bool block,
-		       enum radio_modulation modulation);
+		       uint8_t *bytes, int len, enum tx_class tx_class,
+		       bool block, enum radio_modulation modulation);
 bool tx_send_packet(AX25_PACKET *packet, bool expedited, bool block,
 		    enum radio_modulation modulation);
 
 bool tx_test_make_packet(uint32_t len);
+bool test_tx_priority();
 
 /* Setting this will inhibiting transmit. */
 extern bool inhibitTransmit;
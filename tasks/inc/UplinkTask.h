@@ -9,11 +9,20 @@
 #define TASKS_INC_UPLINKTASK_H_
 
 #include "config.h"
+#include "redconf.h"
 
 #define FTL0_PFH_BIT 2
 #define FTL0_VERSION_BIT1 0
 #define FTL0_VERSION_BIT2 1
 
+/* Uploaded DATA is held in a buffer for each channel and written to the file system in
+ * block aligned runs.  This must be a multiple of the file system block size. */
+#define FTL0_WRITE_BUFFER_LEN (4 * REDCONF_BLOCK_SIZE)
+
+/* FTL0 packets are a byte stream and can span I-frames.  DATA is passed on as it arrives, but
+ * the other packets are held until complete.  The longest a client sends is UPLOAD_CMD. */
+#define FTL0_MAX_RX_INFO_LEN 16
+
 typedef enum
 {
     UL_UNINIT,      /* 0 */
@@ -77,20 +86,47 @@ typedef struct {
 
 typedef struct {
     uplink_state_t ul_state;
+    uint8_t session;             /* Our index, the same as the AX25 session */
     uint8_t channel;             /* Radio A, B, C, D */
     char callsign[MAX_CALLSIGN_LEN];
     int file_id; /* File id of the file being uploaded */
     uint32_t request_time; /* The time the request was received for timeout purposes */
     uint32_t offset;
     uint32_t length;
+    int32_t fp; /* The tmp file is kept open while DATA is received.  Set to -1 when closed */
+    uint32_t buffer_offset; /* The file offset of the first byte in the write buffer */
+    uint16_t buffer_len; /* The number of bytes waiting in the write buffer */
+    bool preallocated; /* The tmp file is being extended to the full length and the rest must be released if the upload stops */
+    uint32_t prealloc_offset; /* The end of the zeros written so far, while preallocated */
+    uint8_t write_buffer[FTL0_WRITE_BUFFER_LEN];
+    uint8_t rx_header[2]; /* Header of the FTL0 packet being received, which may span I-frames */
+    uint8_t rx_header_len; /* Number of header bytes received, 2 when the header is complete */
+    uint16_t rx_remaining; /* Bytes of the current FTL0 packet still to be received */
+    uint8_t rx_info_len; /* Bytes held in rx_info for a packet that is not DATA */
+    uint8_t rx_info[FTL0_MAX_RX_INFO_LEN];
 } ftl0_state_machine_t;
 
+/* A file that has received DATA_END and is being validated and added to the directory in
+ * the background.  The ACK or NAK is sent when this is complete. */
+typedef struct {
+    uint8_t session;
+    uint8_t channel;
+    bool send_reply; /* Cleared if the station disconnects or the link resets before we finish */
+    char callsign[MAX_CALLSIGN_LEN];
+    uint32_t file_id;
+    int32_t fp; /* Open while the body is checked, -1 before the header is checked */
+    uint32_t offset; /* The next byte of the body to check */
+    uint32_t body_size;
+    uint16_t body_checksum;
+} ftl0_finalize_job_t;
+
 #endif /* TASKS_INC_UPLINKTASK_H_ */
 
 /*
  * Routine prototypes
  */
 void UplinkTask(void *pvParameters);
+void ftl0_init();
 bool ftl0_debug_list_upload_table();
 int test_ftl0_upload_table();
 int ftl0_get_space_reserved_by_upload_table();
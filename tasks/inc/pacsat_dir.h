@@ -44,6 +44,8 @@ void dir_free();
 int dir_load();
 int dir_load_header(char *file_name_with_path, uint8_t *byte_buffer, int buffer_len, HEADER *pfh);
 int dir_validate_file(HEADER *pfh, char *file_name_with_path, WdReporters_t reporter);
+void dir_validate_body_chunk(uint8_t *data, int32_t len, uint16_t *body_checksum, uint32_t *body_size);
+int dir_validate_body(HEADER *pfh, uint16_t body_checksum, uint32_t body_size, char *file_name_with_path);
 int32_t dir_fs_write_file_chunk(char *file_name_with_path, uint8_t *data, uint32_t length, uint32_t offset);
 int32_t dir_fs_read_file_chunk(char *file_name_with_path, uint8_t *read_buffer, uint32_t length, uint32_t offset);
 int32_t dir_fs_get_file_size(char *file_name_with_path);
@@ -20,8 +20,9 @@
  *
  *
  * This is an RTOS port of the AX25 Data Link state machine intended for use
- * in an AMSAT satellite.  It implements Version 2.0 of the specification and follows
- * the updated specification posted in these locations:
+ * in an AMSAT satellite.  It implements Version 2.0 of the specification, plus the
+ * MOD 128 sequence numbers and larger window of Version 2.2 when a station connects
+ * with SABME.  It follows the updated specification posted in these locations:
  *
  * AX.25 Link Access Protocol for Amateur Packet Radio Version 2.2 Revision: July 1998
  *
@@ -38,17 +39,25 @@
  *           https://github.com/ac2cz/Falcon/blob/master/src/ax25/DataLinkStateMachine.java
  *
  *
- * XID is not implemented as the bandwidth to the spacecraft is precious and the
- * characteristics should already be available to the ground station.
- * SREJ is not implemented
+ * Connections are held in a table of AX25_MAX_SESSIONS sessions that is shared by the
+ * receivers.  A session is found from the callsign and the channel, so several stations
+ * can be connected on one receiver, each with its own timers and I frame queue.
+ * XID is answered when connected.  The other station can lower the I field length
+ * and window we use, or ask for a longer T1, within the limits of our buffers.  We
+ * do not send XID as the bandwidth to the spacecraft is precious.
+ * SREJ is used on v2.2 connections, holding up to SREJ_HELD_FRAMES out of sequence frames
+ * T2 delays the RR for received I frames so that one RR acks several of them, or
+ * the ack goes in an I frame that Layer 3 sends in the meantime.
  * FRMR is handled but never sent, as recommended in the specification.
- * SABME requests receive an FRMR response rather than a DM, as discussed in the comments at the start of the
- * DireWolf Data Link state machine implementation:
+ * If we send SABME and receive FRMR then we fall back to v2.0 and send SABM, as
+ * discussed in the comments at the start of the DireWolf Data Link state machine
+ * implementation:
  *
  * https://github.com/wb2osz/direwolf/blob/master/src/ax25_link.c
  *
  */
 
+#include <string.h>
 #include <strings.h>
 
 #include "PbTask.h"
@@ -64,12 +73,13 @@
 
 /* Forward functions */
 void ax25_process_lm_frame(uint8_t channel);
-void ax25_t1_expired(TimerHandle_t xTimer);
-void ax25_t3_expired(TimerHandle_t xTimer);
-void start_timer(TimerHandle_t timer);
-void restart_timer(TimerHandle_t timer);
-void stop_timer(TimerHandle_t timer);
-void ax25_send_response(uint8_t channel, ax25_frame_type_t frame_type, char *to_callsign, AX25_PACKET *response_packet, bool expedited);
+uint8_t ax25_find_session(uint8_t channel, char *callsign);
+uint8_t ax25_find_free_session();
+bool digi_duplicate(uint8_t *bytes, uint16_t len, TickType_t now, uint32_t *hash);
+void digi_remember(uint32_t hash, uint16_t len, TickType_t now);
+bool digi_airtime_available(uint16_t len, TickType_t now);
+void ax25_timers_expire();
+void ax25_send_response(uint8_t session, ax25_frame_type_t frame_type, char *to_callsign, AX25_PACKET *response_packet, bool expedited);
 bool ax25_send_event(AX25_data_link_state_machine_t *state, AX25_primitive_t prim, AX25_PACKET *packet, ax25_error_t error_num);
 bool ax25_send_lm_event(AX25_data_link_state_machine_t *state, AX25_primitive_t prim);
 
@@ -98,30 +108,138 @@ void clear_exception_conditions(AX25_data_link_state_machine_t *state);
 void transmit_enquiry(AX25_data_link_state_machine_t *state);
 void enquiry_response(AX25_data_link_state_machine_t *state, AX25_PACKET *packet, int F);
 void invoke_retransmission(AX25_data_link_state_machine_t *state, int NR);
+void selective_retransmission(AX25_data_link_state_machine_t *state, AX25_PACKET *packet);
+bool hold_iframe(AX25_data_link_state_machine_t *state, AX25_PACKET *packet);
+void deliver_held_iframes(AX25_data_link_state_machine_t *state);
+void send_srej_frame(AX25_data_link_state_machine_t *state, int F);
+void process_xid(AX25_data_link_state_machine_t *state, AX25_PACKET *packet);
+void set_t1_period(AX25_data_link_state_machine_t *state);
 void check_iframes_acknowledged(AX25_data_link_state_machine_t *state, AX25_PACKET *packet);
 void establish_data_link(AX25_data_link_state_machine_t *state);
 void check_need_for_response(AX25_data_link_state_machine_t *state, AX25_PACKET *packet);
+void own_receiver_flow_off(AX25_data_link_state_machine_t *state);
+void own_receiver_flow_on(AX25_data_link_state_machine_t *state);
+void set_version_2_0(AX25_data_link_state_machine_t *state);
+void set_version_2_2(AX25_data_link_state_machine_t *state);
+void select_t1_value(AX25_data_link_state_machine_t *state);
+void seed_t1_value(AX25_data_link_state_machine_t *state);
+void ax25_rtt_cache_update(AX25_data_link_state_machine_t *state);
 
 /* Utility functions */
 void clear_layer_3_initiated(AX25_data_link_state_machine_t *state);
 void set_layer_3_initiated(AX25_data_link_state_machine_t *state);
 void discard_iframe_queue(AX25_data_link_state_machine_t *state);
 bool VA_lte_NR_lte_VS(AX25_data_link_state_machine_t *state, int nr);
-int shiftByV(int x, int VA);
-int AX25_MODULO(int vs);
+void acknowledge_iframes(AX25_data_link_state_machine_t *state, int nr);
+void release_iframes_sent(AX25_data_link_state_machine_t *state);
+bool push_back_iframe(AX25_data_link_state_machine_t *state, AX25_PACKET_HANDLE iframe, TickType_t wait);
+int shiftByV(int x, int VA, int modulo);
+int AX25_MODULO(int vs, int modulo);
+
+/* The slot in I_frames_sent for a frame with send sequence number NS */
+#define I_FRAME_SLOT(ns) ((ns) & (I_FRAMES_SENT_LEN - 1))
+/* The slot in I_frames_held for a received frame with send sequence number NS */
+#define HELD_SLOT(ns) ((ns) & (SREJ_HELD_FRAMES - 1))
+
+/* The link timers.  T1, T3 and T2 of every session are on one timer wheel that the
+ * Ax25Task turns itself, so starting or stopping one does not send a command to the
+ * RTOS timer task.  The id of T1 is the session and T3 and T2 follow in blocks of
+ * AX25_MAX_SESSIONS */
+typedef uint8_t ax25_timer_t;
+#define AX25_NUM_TIMERS (3 * AX25_MAX_SESSIONS)
+#define AX25_NO_TIMER 0xFF
+#define TIMER_SESSION(t) ((t) % AX25_MAX_SESSIONS)
+#define TIMER_KIND(t) ((t) / AX25_MAX_SESSIONS) /* 0 is T1, 1 is T3, 2 is T2 */
+
+#if (AX25_NUM_TIMERS > 32) || (AX25_TIMER_WHEEL_SLOTS & (AX25_TIMER_WHEEL_SLOTS - 1))
+#error "Too many AX25 timers for the expired mask or the wheel slots are not a power of 2"
+#endif
+
+typedef struct {
+    uint8_t next;    /* The next timer in the same slot, or AX25_NO_TIMER */
+    uint8_t prev;
+    uint8_t slot;
+    bool active;     /* On the wheel.  Cleared when it expires or is stopped */
+    uint16_t rounds; /* Turns of the wheel still to go before it expires */
+    TickType_t period;
+} ax25_wheel_timer_t;
+
+typedef struct {
+    uint8_t head[AX25_TIMER_WHEEL_SLOTS];
+    ax25_wheel_timer_t timers[AX25_NUM_TIMERS];
+    uint8_t cursor;   /* The slot for the wheel tick at time */
+    TickType_t time;  /* Tick count of the last turn of the wheel */
+    uint32_t expired; /* Bit n is set when timer n has expired and is waiting to be handled */
+} ax25_timer_wheel_t;
+
+void start_timer(ax25_timer_t timer);
+void stop_timer(ax25_timer_t timer);
+static void wheel_init(ax25_timer_wheel_t *wheel, TickType_t now);
+static void wheel_start(ax25_timer_wheel_t *wheel, ax25_timer_t timer, TickType_t now);
+static void wheel_stop(ax25_timer_wheel_t *wheel, ax25_timer_t timer);
+static void wheel_advance(ax25_timer_wheel_t *wheel, TickType_t now);
+static TickType_t wheel_wait(ax25_timer_wheel_t *wheel, TickType_t now);
 
 /* Local variables */
-static xTimerHandle timerT1[NUM_RX_CHANNELS];
-static xTimerHandle timerT3[NUM_RX_CHANNELS];
+static ax25_timer_wheel_t ax25_timers;
+static ax25_timer_t timerT1[AX25_MAX_SESSIONS];
+static ax25_timer_t timerT3[AX25_MAX_SESSIONS];
+static ax25_timer_t timerT2[AX25_MAX_SESSIONS];
+static AX25_timer_counters_t timer_counters;
+#ifdef TRACE_AX25_DL
+static const char * const timer_names[] = {"T1", "T3", "T2"};
+#endif
 
 static rx_radio_buffer_t ax25_radio_buffer; /* Static storage for packets from the radio */
-static AX25_data_link_state_machine_t data_link_state_machine[NUM_RX_CHANNELS];
+/* The connection table.  A session is in use while its state is not DISCONNECTED and is
+ * found from the callsign and the channel it was heard on */
+static AX25_data_link_state_machine_t data_link_state_machine[AX25_MAX_SESSIONS];
 static AX25_event_t ax25_received_event; /* Static storage for received event */
 static AX25_event_t send_event_buffer; /* Static storage for event we are sending */
 static AX25_event_t timer_event; /* Static storage for timer events */
 static AX25_event_t lm_event; /* Static storage for Link Multiplexer event */
+static AX25_PACKET busy_response_packet; /* DM sent when the connection table is full */
 bool in_test = false;
-static bool seize_requested[NUM_RX_CHANNELS];
+static bool seize_requested[AX25_MAX_SESSIONS];
+static TaskHandle_t ax25_task_handle = NULL;
+
+/* Our callsigns in the shifted form used in the address fields, so received
+ * frames can be classified before they are decoded */
+static uint8_t bbs_address[7];
+static uint8_t broadcast_address[7];
+static uint8_t digi_address[7];
+
+/* Frames the digipeater repeated recently, so copies heard again are dropped.  The
+ * length is part of the key and a length of 0 marks an empty entry */
+typedef struct {
+    uint32_t hash;
+    uint16_t len;
+    TickType_t heard;
+} digi_heard_t;
+static digi_heard_t digi_heard[DIGI_DUPLICATE_CACHE_LEN];
+static uint8_t digi_heard_next;
+/* Token bucket of transmitter time, in ms, that the digipeater may use */
+static uint16_t digi_airtime_percent;
+static uint32_t digi_airtime_ms;
+static TickType_t digi_airtime_updated;
+/* The TX bit rate and framing, kept here so we do not read the modulation from MRAM for every frame */
+static uint32_t digi_tx_bit_rate;
+static bool digi_tx_fx25;
+static AX25_digi_counters_t digi_counters;
+static tx_radio_buffer_t digi_tx_buffer; /* The repeated frame, as the TX queues take it */
+
+/* The smoothed round trip time of stations that were connected recently.  An empty
+ * entry has no callsign.  The least recently updated entry is replaced when full */
+typedef struct {
+    char callsign[MAX_CALLSIGN_LEN];
+    int SRTInTicks;
+    TickType_t updated;
+} ax25_rtt_entry_t;
+static ax25_rtt_entry_t ax25_rtt_cache[AX25_RTT_CACHE_LEN];
+
+/* The pool of I frames.  A handle is the index plus 1, so AX25_NO_PACKET is 0 */
+static AX25_PACKET ax25_packet_pool[AX25_PACKET_POOL_LEN];
+static uint8_t ax25_packet_refs[AX25_PACKET_POOL_LEN];
 
 static const char * const rx_channel_names[] = {"A", "B", "C", "D"};
 #ifdef TRACE_AX25_DL
@@ -136,7 +254,7 @@ static void clear_packet(AX25_PACKET *packet)
 portTASK_FUNCTION_PROTO(Ax25Task, pvParameters)
 {
     BaseType_t xStatus;
-    int chan;
+    int session;
     AX25_data_link_state_machine_t *state;
 
     vTaskSetApplicationTaskTag((xTaskHandle) 0, (pdTASK_HOOK_CODE)Ax25TaskWD);
@@ -147,124 +265,241 @@ portTASK_FUNCTION_PROTO(Ax25Task, pvParameters)
     //        of course, we should never get this situation unless the memory size changes somehow. But another solution
     //        might be to retry with less channels.  Or to accept that the uplink wont work and the rest of the sat can carry
     //        on.  So FATAL, in this case, would mean FATAL to that channel of the AX25 state machine and not the whole sat.
-    for (chan = 0; chan < NUM_RX_CHANNELS; chan++) {
-        /* create RTOS software timers for T1 and T3.  Both for each channel.*/
-
-        timerT1[chan] = xTimerCreate("T1", AX25_TIMER_T1_PERIOD, FALSE,
-                                     (void *)chan, ax25_t1_expired);
-        if (timerT1[chan] == NULL) {
-            /* The timer could not be created.  This is fatal and should only happen in test if we are short of memory at startup */
-            debug_print("FATAL ERROR: Could not create T1 Timer for channel %d\n",chan);
-            ReportError(RTOSfailure, TRUE, CharString,
-                        (int)"RTOS FATAL ERROR: Could not create T1 timer");
-
-        }
-        timerT3[chan] = xTimerCreate("T3", AX25_TIMER_T3_PERIOD, FALSE,
-                                     (void *)chan, ax25_t3_expired);
-        if (timerT3[chan] == NULL) {
-            /* The timer could not be created.  This is fatal and should only happen in test if we are short of memory at startup */
-            debug_print("FATAL ERROR: Could not create T3 Timer for channel %d\n",chan);
-            ReportError(RTOSfailure, TRUE, CharString,
-                         (int)"RTOS FATAL ERROR: Could not create T3 timer");
-       }
-        ReportToWatchdog(Ax25TaskWD);
+    wheel_init(&ax25_timers, xTaskGetTickCount());
+    for (session = 0; session < AX25_MAX_SESSIONS; session++) {
+        /* T1, T3 and T2 for each session.  T1 changes with the round trip time */
+        timerT1[session] = session;
+        timerT3[session] = AX25_MAX_SESSIONS + session;
+        timerT2[session] = 2 * AX25_MAX_SESSIONS + session;
+        ax25_timers.timers[timerT1[session]].period = AX25_TIMER_T1_PERIOD;
+        ax25_timers.timers[timerT3[session]].period = AX25_TIMER_T3_PERIOD;
+        ax25_timers.timers[timerT2[session]].period = AX25_TIMER_T2_PERIOD;
+
+        /* Every connection starts as v2.0 until a SABME is received */
+        data_link_state_machine[session].session = session;
+        data_link_state_machine[session].T1VInTicks = AX25_TIMER_T1_PERIOD;
+        set_version_2_0(&data_link_state_machine[session]);
 
         /* Create a queue for I frames that we are sending */
-        xIFrameQueue[chan] = xQueueCreate(IFRAME_QUEUE_LEN,
-                                          sizeof(AX25_event_t));
-        if (xIFrameQueue[chan] == NULL) {
+        xIFrameQueue[session] = xQueueCreate(IFRAME_QUEUE_LEN,
+                                             sizeof(AX25_PACKET_HANDLE));
+        if (xIFrameQueue[session] == NULL) {
             /* The queue could not be created.  This is fatal and should only happen in test if we are short of memory at startup */
-            debug_print("FATAL ERROR: Could not create IFRAME Queue for channel %d\n",chan);
+            debug_print("FATAL ERROR: Could not create IFRAME Queue for session %d\n",session);
             ReportError(RTOSfailure, TRUE, CharString,
                          (int)"RTOS FATAL ERROR: Could not create IFRAME Queue");
         }
         ReportToWatchdog(Ax25TaskWD);
     }
 
+    encode_call(BBS_CALLSIGN, bbs_address, false, 0);
+    encode_call(BROADCAST_CALLSIGN, broadcast_address, false, 0);
+    encode_call(DIGI_CALLSIGN, digi_address, false, 0);
+
     debug_print("AX.25 PB Call: %s",BROADCAST_CALLSIGN);
     debug_print(" BBS Call: %s",BBS_CALLSIGN);
     debug_print(" Digi Call: %s\n",DIGI_CALLSIGN);
 
+    /* The digipeater starts with a full airtime budget */
+    digi_airtime_percent = ReadMRAMDigiAirtimePercent();
+    digi_airtime_ms = (uint32_t)digi_airtime_percent * DIGI_AIRTIME_WINDOW_SECONDS * 10;
+    digi_airtime_updated = xTaskGetTickCount();
+    ax25_set_tx_modulation(ReadMRAMModulation(FIRST_TX_CHANNEL));
+
+    /* Producers wake us with ax25_wake() once this is set */
+    ax25_task_handle = xTaskGetCurrentTaskHandle();
+
     while (1) {
         ReportToWatchdog(Ax25TaskWD);
-        xStatus = xQueueReceive(xRxPacketQueue, &ax25_radio_buffer,
-                                CENTISECONDS(1) );
-        if (xStatus == pdPASS) {
-            /* Data was successfully received from the queue */
+        /*
+         * Sleep until RxTask or UplinkTask puts something on one of our
+         * queues, or the timer wheel next turns.  The timeout retries I
+         * frames that were pushed back because the TX queue was full, and
+         * feeds the watchdog.
+         */
+        ulTaskNotifyTake(pdTRUE, wheel_wait(&ax25_timers, xTaskGetTickCount()));
+        ReportToWatchdog(Ax25TaskWD);
+
+        /*
+         * Service the inputs in priority order.  Frames from the radios
+         * are first as they carry the acks that open the window for our
+         * I frames.
+         */
+        while (xQueueReceive(xRxPacketQueue, &ax25_radio_buffer, 0) == pdPASS) {
             /* LM_DATA_Indicate - Frames of any type passed from the
                Link Multiplexer to the Data Link State Machine */
             ax25_process_lm_frame(ax25_radio_buffer.channel);
+            timer_counters.frames++;
+            ReportToWatchdog(Ax25TaskWD);
         }
-        ReportToWatchdog(Ax25TaskWD);
-        /* Yield some time so any packets are sent, or so that others
-           may do some processing */
-//        vTaskDelay(CENTISECONDS(1));
-        taskYIELD();
 
-        ReportToWatchdog(Ax25TaskWD);
-        xStatus = xQueueReceive(xRxEventQueue, &ax25_received_event,
-                                CENTISECONDS(1) );
-        if (xStatus == pdPASS) {
-            chan = ax25_received_event.rx_channel;
+        while (xQueueReceive(xRxEventQueue, &ax25_received_event, 0) == pdPASS) {
+            session = ax25_received_event.session;
 
-            if (chan >= NUM_RX_CHANNELS) {
+            if (session >= AX25_MAX_SESSIONS) {
                 // something is seriously wrong.  Programming error.
                 // Unlikely to occur in flight
-                debug_print("ERR: AX25 channel %d is invalid\n",
-                            ax25_received_event.rx_channel);
+                debug_print("ERR: AX25 session %d is invalid\n",
+                            ax25_received_event.session);
             } else {
-                state = &data_link_state_machine[chan];
+                state = &data_link_state_machine[session];
                 if (ax25_received_event.primitive == LM_SEIZE_Request) {
                     trace_dl("LM[%d]: SEIZE Requested\n",
                              ax25_received_event.rx_channel);
-                    seize_requested[chan] = TRUE;
+                    seize_requested[session] = TRUE;
                 } else {
                     ax25_next_state_from_primitive(state, &ax25_received_event);
                 }
             }
+            ReportToWatchdog(Ax25TaskWD);
         }
-        ReportToWatchdog(Ax25TaskWD);
-        /*
-         * Yield some time so any packets are sent, or so that others
-         * may do some processing
-         */
-        //vTaskDelay(CENTISECONDS(1));
-        taskYIELD();
-        ReportToWatchdog(Ax25TaskWD);
+
+        /* Expired timers are handled after the frames, which may have stopped them */
+        ax25_timers_expire();
 
         if (!in_test) {
             /*
-             * See if any channels have I frames to send.  Send them
+             * See if any sessions have I frames to send.  Send them
              * now, which will also process any pending
-             * acknowledgement.  If SEIZE Request is set then send the
-             * DL State Machine a SEIZE Confirm message after any
+             * acknowledgement.  Keep sending while the state machine
+             * takes them, i.e. VS moves on.  A frame it pushes back,
+             * because the window is full or the peer is busy, waits
+             * for the next wake up.  The state machine takes its own
+             * reference to a frame it keeps, so we release the one
+             * from the queue.  If SEIZE Request is set then send
+             * the DL State Machine a SEIZE Confirm message after any
              * frames are sent.  This will cause an RR to be sent if
              * an ACK is still pending.
              */
-            for (chan = 0; chan < NUM_RX_CHANNELS; chan++) {
-                state = &data_link_state_machine[chan];
-                xStatus = xQueueReceive(xIFrameQueue[chan], &ax25_received_event,
-                                        CENTISECONDS(1));
-                if (xStatus == pdPASS) {
-//#ifdef DEBUG
-//            print_decoded_packet("POPS OFF QUEUE: ",&ax25_received_event.packet);
-//#endif
+            for (session = 0; session < AX25_MAX_SESSIONS; session++) {
+                uint8_t vs;
+                state = &data_link_state_machine[session];
+                do {
+                    xStatus = xQueueReceive(xIFrameQueue[session], &ax25_received_event.iframe, 0);
+                    if (xStatus != pdPASS)
+                        break;
+                    vs = state->VS;
+                    ax25_received_event.session = session;
+                    ax25_received_event.rx_channel = state->channel;
                     ax25_received_event.primitive = DL_POP_IFRAME_Request;
                     ax25_next_state_from_primitive(state, &ax25_received_event);
-                }
-                ReportToWatchdog(Ax25TaskWD);
-                taskYIELD();
-                ReportToWatchdog(Ax25TaskWD);
-                if (seize_requested[chan]) {
+                    ax25_packet_release(ax25_received_event.iframe);
+                    timer_counters.frames++;
+                    ReportToWatchdog(Ax25TaskWD);
+                } while (state->VS != vs);
+                if (seize_requested[session]) {
                     lm_event.primitive = LM_SEIZE_Confirm;
                     ax25_next_state_from_primitive(state, &lm_event);
-                    seize_requested[chan] = false;
+                    seize_requested[session] = false;
                 }
             }
         }
     }
 }
 
+/**
+ * ax25_find_session()
+ *
+ * Return the session connected to this callsign on this channel, or
+ * AX25_NO_SESSION if there is none.  A station can be connected on more
+ * than one channel, which are separate sessions.
+ */
+uint8_t ax25_find_session(uint8_t channel, char *callsign)
+{
+    uint8_t session;
+    for (session = 0; session < AX25_MAX_SESSIONS; session++) {
+        AX25_data_link_state_machine_t *state = &data_link_state_machine[session];
+        if (state->dl_state != DISCONNECTED && state->channel == channel &&
+                strcasecmp(state->callsign, callsign) == 0)
+            return session;
+    }
+    return AX25_NO_SESSION;
+}
+
+/**
+ * ax25_find_free_session()
+ *
+ * Return a session that is DISCONNECTED, or AX25_NO_SESSION if the
+ * connection table is full.
+ */
+uint8_t ax25_find_free_session()
+{
+    uint8_t session;
+    for (session = 0; session < AX25_MAX_SESSIONS; session++)
+        if (data_link_state_machine[session].dl_state == DISCONNECTED)
+            return session;
+    return AX25_NO_SESSION;
+}
+
+/**
+ * ax25_wake()
+ *
+ * Called after an item is added to xRxPacketQueue, xRxEventQueue or an
+ * xIFrameQueue so the Ax25Task runs now rather than when its wait times
+ * out.  Must not be called from an interrupt.
+ */
+void ax25_wake()
+{
+    if (ax25_task_handle != NULL)
+        xTaskNotifyGive(ax25_task_handle);
+}
+
+/**
+ * ax25_packet_alloc()
+ *
+ * Take an I frame from the pool with a reference count of 1.  The Uplink
+ * builds the frame in place and puts the handle on the xIFrameQueue.  The
+ * Ax25Task keeps the same buffer while the frame awaits an ack, so it is
+ * not copied again on the way through.  Returns AX25_NO_PACKET if the
+ * pool is empty, which the caller treats like a full queue.
+ */
+AX25_PACKET_HANDLE ax25_packet_alloc()
+{
+    AX25_PACKET_HANDLE handle = AX25_NO_PACKET;
+    int i;
+
+    taskENTER_CRITICAL();
+    for (i = 0; i < AX25_PACKET_POOL_LEN; i++) {
+        if (ax25_packet_refs[i] == 0) {
+            ax25_packet_refs[i] = 1;
+            handle = i + 1;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL();
+    return handle;
+}
+
+AX25_PACKET *ax25_packet(AX25_PACKET_HANDLE handle)
+{
+    return &ax25_packet_pool[handle - 1];
+}
+
+void ax25_packet_retain(AX25_PACKET_HANDLE handle)
+{
+    if (handle == AX25_NO_PACKET)
+        return;
+    taskENTER_CRITICAL();
+    ax25_packet_refs[handle - 1]++;
+    taskEXIT_CRITICAL();
+}
+
+/**
+ * ax25_packet_release()
+ *
+ * Drop a reference.  The buffer goes back to the pool when the last
+ * holder, a queue or an I_frames_sent slot, releases it.
+ */
+void ax25_packet_release(AX25_PACKET_HANDLE handle)
+{
+    if (handle == AX25_NO_PACKET)
+        return;
+    taskENTER_CRITICAL();
+    if (ax25_packet_refs[handle - 1] > 0)
+        ax25_packet_refs[handle - 1]--;
+    taskEXIT_CRITICAL();
+}
+
 
 
 /**
@@ -292,12 +527,14 @@ void ax25_send_status() {
         uint8_t len = 6 + NUM_RX_CHANNELS;
         int channels_available = NUM_RX_CHANNELS;
         int chan;
+        /* Sessions are shared by the channels, so every working channel is
+         * open until the connection table is full */
+        bool session_free = (ax25_find_free_session() < AX25_MAX_SESSIONS);
 
         strlcpy(buffer, "Open ", sizeof(buffer));
 
         for (chan = 0; chan < NUM_RX_CHANNELS; chan++) {
-            if (rx_working(chan) &&
-                      data_link_state_machine[chan].dl_state == DISCONNECTED) {
+            if (rx_working(chan) && session_free) {
                 strlcat(buffer, rx_channel_names[chan], sizeof(buffer));
             } else {
                 channels_available--;
@@ -310,7 +547,7 @@ void ax25_send_status() {
             trace_ftl0("SENDING: %s |%s|\n",BBSTAT, buffer);
 
             int rc = tx_send_ui_packet(BBS_CALLSIGN, BBSTAT, PID_NO_PROTOCOL,
-			      (uint8_t *)buffer, len, BLOCK,
+			      (uint8_t *)buffer, len, TX_CLASS_TELEMETRY, BLOCK,
 			      MODULATION_INVALID);
             if (!rc) {
                 /* The send operation could not complete because the queue was full */
@@ -324,159 +561,255 @@ void ax25_send_status() {
 }
 
 
-/*
- * Called when timer T1 expires.  The channel is stored in the timer id.
+/**
+ * ax25_timers_expire()
+ *
+ * Turn the timer wheel up to now and pass each timer that expired to
+ * its state machine.  T2 asks to transmit, so if Layer 3 has sent an I
+ * frame since it was started the ack went with it and nothing more is
+ * sent, otherwise we send one RR.  A timer that is stopped or started
+ * again by an earlier expiry is not passed on.
  */
-void ax25_t1_expired(TimerHandle_t xTimer)
+void ax25_timers_expire()
 {
-    // timer id is treated as an integer and not as a pointer
-    uint32_t chan = (uint32_t)pvTimerGetTimerID(xTimer);
-    BaseType_t xStatus;
+    ax25_timer_t timer;
+    uint8_t session;
+
+    wheel_advance(&ax25_timers, xTaskGetTickCount());
+    for (timer = 0; ax25_timers.expired != 0 && timer < AX25_NUM_TIMERS; timer++) {
+        if (!(ax25_timers.expired & (1UL << timer)))
+            continue;
+        ax25_timers.expired &= ~(1UL << timer);
+        timer_counters.expired++;
+        session = TIMER_SESSION(timer);
+        trace_dl("AX25[%d]: Timer %s Expired at %d\n", data_link_state_machine[session].channel,
+                 timer_names[TIMER_KIND(timer)], getSeconds());
+        if (timer == timerT2[session]) {
+            seize_requested[session] = TRUE;
+        } else {
+            timer_event.primitive = (timer == timerT1[session]) ? DL_TIMER_T1_Expire : DL_TIMER_T3_Expire;
+            timer_event.session = session;
+            timer_event.rx_channel = data_link_state_machine[session].channel;
+            ax25_next_state_from_primitive(&data_link_state_machine[session], &timer_event);
+        }
+        ReportToWatchdog(Ax25TaskWD);
+    }
+}
 
-    trace_dl("AX25[%d]: Timer T1 Expiry Int at %d\n", chan, getSeconds());
-    timer_event.primitive = DL_TIMER_T1_Expire;
-    timer_event.rx_channel = chan;
-    // Do not block as this is called from timer
-    xStatus = xQueueSendToBack(xRxEventQueue, &timer_event, 0);
-    if( xStatus != pdPASS ) {
-        debug_print("EVENT QUEUE FULL: Could not add T1 expire to Event Queue\n");
-        // we log this error and downlink in telemetry.  This is not fatal but it messes up the AX25 state machine logic
-        // However, given this is called from a timer, we do not want to wait around here and retry.
-        ReportError(RTOSfailure, FALSE, CharString,
-                            (int)"AX25: ERROR: Could not add RxEvent to Queue");
+void start_timer(ax25_timer_t timer)
+{
+    uint8_t session = TIMER_SESSION(timer);
+    TickType_t now = xTaskGetTickCount();
+
+    trace_dl("AX25[%d]: Start Timer %s at %d\n", data_link_state_machine[session].channel,
+             timer_names[TIMER_KIND(timer)], getSeconds());
+    if (timer == timerT1[session]) {
+        data_link_state_machine[session].T1StartedInTicks = now;
+        data_link_state_machine[session].T1ElapsedWhenStoppedInTicks = -1;
     }
-    taskYIELD();
+    // Starting a timer that is running restarts it
+    wheel_start(&ax25_timers, timer, now);
+    timer_counters.operations++;
 }
 
-void ax25_t3_expired(TimerHandle_t xTimer)
+void stop_timer(ax25_timer_t timer)
 {
-    BaseType_t xStatus;
-    // timer id is treated as an integer and not as a pointer
-    uint32_t chan = (uint32_t)pvTimerGetTimerID( xTimer );
-#ifdef DEBUG
-    trace_dl("AX25[%d]: Timeout... Timer T3 Expiry Int at %d\n", chan, getSeconds());
-#endif
+    uint8_t session = TIMER_SESSION(timer);
+
+    trace_dl("AX25[%d]: Stop Timer %s at %d\n", data_link_state_machine[session].channel,
+             timer_names[TIMER_KIND(timer)], getSeconds());
+    if (timer == timerT1[session] && ax25_timers.timers[timer].active) {
+        // The time from the frame that started T1 to the ack that stopped it
+        data_link_state_machine[session].T1ElapsedWhenStoppedInTicks =
+                (int)(xTaskGetTickCount() - data_link_state_machine[session].T1StartedInTicks);
+    }
+    wheel_stop(&ax25_timers, timer);
+    timer_counters.operations++;
+}
 
-    timer_event.primitive = DL_TIMER_T3_Expire;
-    timer_event.rx_channel = chan;
-    // Do not block as this is called from timer
-    xStatus = xQueueSendToBack(xRxEventQueue, &timer_event, 0);
-    if(xStatus != pdPASS) {
-        debug_print("EVENT QUEUE FULL: Could not add T3 expire to Event Queue\n");
-        ReportError(RTOSfailure, FALSE, CharString,
-                            (int)"AX25: ERROR: Could not add RxEvent to Queue");
+/**
+ * timer_active()
+ *
+ * True if the timer was started and has not expired or been stopped.
+ */
+static bool timer_active(ax25_timer_t timer)
+{
+    return ax25_timers.timers[timer].active;
+}
 
+/**
+ * ax25_timer_counters()
+ *
+ * Copy the counts of timer starts and stops, expiries and frames
+ * handled, so the timer work per frame can be reported.
+ */
+void ax25_timer_counters(AX25_timer_counters_t *counters) {
+    *counters = timer_counters;
+}
+
+/**
+ * wheel_init()
+ *
+ * The wheel has AX25_TIMER_WHEEL_SLOTS slots and turns one slot every
+ * AX25_TIMER_WHEEL_TICK.  A timer is linked into the slot where it
+ * expires, with the number of whole turns still to go, so starting and
+ * stopping a timer take the same time however many are running.  A
+ * timer expires up to one wheel tick late but never early.
+ */
+static void wheel_init(ax25_timer_wheel_t *wheel, TickType_t now)
+{
+    int i;
+    for (i = 0; i < AX25_TIMER_WHEEL_SLOTS; i++)
+        wheel->head[i] = AX25_NO_TIMER;
+    for (i = 0; i < AX25_NUM_TIMERS; i++) {
+        wheel->timers[i].active = false;
+        wheel->timers[i].period = 0;
     }
-    taskYIELD();
+    wheel->cursor = 0;
+    wheel->time = now;
+    wheel->expired = 0;
 }
 
-void start_timer(TimerHandle_t timer)
+static void wheel_unlink(ax25_timer_wheel_t *wheel, ax25_timer_t timer)
 {
-#ifdef DEBUG
-    // timer id is treated as an integer and not as a pointer
-    uint32_t chan = (uint32_t)pvTimerGetTimerID( timer );
-#endif
-    BaseType_t act = xTimerIsTimerActive(timer);
-    portBASE_TYPE timerStatus;
+    ax25_wheel_timer_t *t = &wheel->timers[timer];
+
+    if (t->prev == AX25_NO_TIMER)
+        wheel->head[t->slot] = t->next;
+    else
+        wheel->timers[t->prev].next = t->next;
+    if (t->next != AX25_NO_TIMER)
+        wheel->timers[t->next].prev = t->prev;
+    t->active = false;
+}
 
-    if (act == pdPASS) {
-        restart_timer(timer);
-    } else {
-#ifdef DEBUG
-        trace_dl("AX25[%d]: Start Timer %s at %d\n", chan,
-                 pcTimerGetTimerName(timer), getSeconds());
-#endif
-        // Block time of zero as this can not block
-        timerStatus = xTimerStart(timer, 0);
-        if (timerStatus != pdPASS) {
-            ReportError(RTOSfailure, FALSE, CharString,
-                        (int)"ERROR: Failed in init Timer");
-        }
-    }
+static void wheel_start(ax25_timer_wheel_t *wheel, ax25_timer_t timer, TickType_t now)
+{
+    ax25_wheel_timer_t *t = &wheel->timers[timer];
+    /* Wheel ticks from the last turn, rounded up so it does not expire early */
+    uint32_t ticks = (now - wheel->time + t->period + AX25_TIMER_WHEEL_TICK - 1) / AX25_TIMER_WHEEL_TICK;
+
+    if (t->active)
+        wheel_unlink(wheel, timer);
+    wheel->expired &= ~(1UL << timer);
+    if (ticks == 0)
+        ticks = 1;
+    t->slot = (wheel->cursor + ticks) & (AX25_TIMER_WHEEL_SLOTS - 1);
+    t->rounds = (ticks - 1) / AX25_TIMER_WHEEL_SLOTS;
+    t->prev = AX25_NO_TIMER;
+    t->next = wheel->head[t->slot];
+    if (t->next != AX25_NO_TIMER)
+        wheel->timers[t->next].prev = timer;
+    wheel->head[t->slot] = timer;
+    t->active = true;
 }
 
-void restart_timer(TimerHandle_t timer)
+static void wheel_stop(ax25_timer_wheel_t *wheel, ax25_timer_t timer)
 {
-    portBASE_TYPE timerT1Status;
-#ifdef DEBUG
-    uint32_t chan = (uint32_t)pvTimerGetTimerID( timer ); // timer id is treated as an integer and not as a pointer
-    trace_dl("AX25[%d]: Restarted Timer %s at %d\n", chan, pcTimerGetTimerName(timer), getSeconds());
-#endif
-    // Block time of zero as this can not block
-    timerT1Status = xTimerReset(timer, 0);
-    if (timerT1Status != pdPASS) {
-        ReportError(RTOSfailure, FALSE, CharString,
-                                (int)"ERROR: Failed to restart T1 Timer");
-//        debug_print("ERROR: Failed to restart T1 Timer\n");
-    }
+    if (wheel->timers[timer].active)
+        wheel_unlink(wheel, timer);
+    wheel->expired &= ~(1UL << timer);
 }
 
-void stop_timer(TimerHandle_t timer)
+/**
+ * wheel_advance()
+ *
+ * Turn the wheel one slot for each AX25_TIMER_WHEEL_TICK up to now and
+ * mark the timers that expire in the expired mask.  Only the timers in
+ * the slots passed are looked at.
+ */
+static void wheel_advance(ax25_timer_wheel_t *wheel, TickType_t now)
 {
-    portBASE_TYPE timerStatus;
-#ifdef DEBUG
-    uint32_t chan = (uint32_t)pvTimerGetTimerID( timer ); // timer id is treated as an integer and not as a pointer
-    trace_dl("AX25[%d]: Stop Timer %s at %d\n", chan, pcTimerGetTimerName(timer), getSeconds());
-#endif
-    // Block time of zero as this can not block
-    timerStatus = xTimerStop(timer, 0);
-    if (timerStatus != pdPASS) {
-        ReportError(RTOSfailure, FALSE, CharString,
-                                (int)"ERROR: Failed to stop T1 Timer");
+    ax25_timer_t timer, next;
+
+    while ((TickType_t)(now - wheel->time) >= AX25_TIMER_WHEEL_TICK) {
+        wheel->time += AX25_TIMER_WHEEL_TICK;
+        wheel->cursor = (wheel->cursor + 1) & (AX25_TIMER_WHEEL_SLOTS - 1);
+        for (timer = wheel->head[wheel->cursor]; timer != AX25_NO_TIMER; timer = next) {
+            next = wheel->timers[timer].next;
+            if (wheel->timers[timer].rounds == 0) {
+                wheel_unlink(wheel, timer);
+                wheel->expired |= 1UL << timer;
+            } else {
+                wheel->timers[timer].rounds--;
+            }
+        }
     }
 }
 
+/**
+ * wheel_wait()
+ *
+ * The ticks until the wheel next turns, which is how long the Ax25Task
+ * can sleep.
+ */
+static TickType_t wheel_wait(ax25_timer_wheel_t *wheel, TickType_t now)
+{
+    TickType_t elapsed = now - wheel->time;
+    if (elapsed >= AX25_TIMER_WHEEL_TICK)
+        return 0;
+    return AX25_TIMER_WHEEL_TICK - elapsed;
+}
+
 /**
  * ax25_process_lm_frame()
  *
  * Process an LM_DATA_indicate message, which is an AX25 frame
- * received from the radios.  If the state machine for the given
- * channel is inactive then we process the data.  If the frame
- * received is not for the callsign connected on this channel then we
- * ignore it.  This is called from the main processing loop whenever a
- * frame is received.  We decode the bytes, which stores a copy of the
- * received packet in the state machine structure.
+ * received from the radios.  Most frames on a busy pass are for other
+ * stations, or are noise, so we first compare the raw address fields
+ * with our encoded callsigns.  Only frames for the BBS callsign are
+ * decoded, which stores a copy of the received packet in the state
+ * machine structure of the session for that station and channel.  A
+ * station without a session is given a free one, or sent DM if the
+ * connection table is full.  Broadcast frames go to
+ * the PB and frames via the digi are repeated without a decode.  This
+ * is called from the main processing loop whenever a frame is received.
  */
 void ax25_process_lm_frame(uint8_t channel)
 {
-    char *from_callsign;
-    char *to_callsign;
-    AX25_data_link_state_machine_t *state = &data_link_state_machine[channel];
-    AX25_PACKET *dp = &state->decoded_packet;
+    char from_callsign[MAX_CALLSIGN_LEN];
+    AX25_data_link_state_machine_t *state;
+    uint8_t session;
     uint8_t *pkt = ax25_radio_buffer.bytes;
 
-    int rc = ax25_decode_packet(pkt, ax25_radio_buffer.len, dp);
-    if (!rc) return;
-    from_callsign = dp->from_callsign;
-    to_callsign = dp->to_callsign;
+    if (ax25_radio_buffer.len < 15)
+        return; // Not even the addresses and a control byte
+
+    if (ax25_address_matches(&pkt[0], bbs_address)) {
+        /* Find the session for this station on this channel, or a free one */
+        decode_call(&pkt[7], from_callsign);
+        session = ax25_find_session(channel, from_callsign);
+        if (session >= AX25_MAX_SESSIONS)
+            session = ax25_find_free_session();
+        if (session >= AX25_MAX_SESSIONS) {
+            //debug_print("AX25: BUSY!\n");
+            /*
+             * Send a DM with P=1 as the connection table is full
+             * and we can not accept a connection or other frames
+             */
+            clear_packet(&busy_response_packet);
+            busy_response_packet.PF = 1;
+            ax25_send_response(AX25_NO_SESSION, TYPE_U_DM, from_callsign,
+                               &busy_response_packet, NOT_EXPEDITED);
+            return;
+        }
+        state = &data_link_state_machine[session];
+
+        /* I and S frames have a 2 byte control field once a v2.2 connection is made */
+        bool extended = (state->dl_state != DISCONNECTED &&
+                         state->modulo == MODULO_EXTENDED);
+        int rc = ax25_decode_packet(pkt, ax25_radio_buffer.len,
+                                    &state->decoded_packet, extended);
+        if (!rc) return;
 
-    if (strcasecmp(to_callsign, BBS_CALLSIGN) == 0) {
         if (state->dl_state == DISCONNECTED) {
             /* New connection. */
-            strlcpy(state->callsign, from_callsign, MAX_CALLSIGN_LEN);
+            strlcpy(state->callsign, state->decoded_packet.from_callsign, MAX_CALLSIGN_LEN);
             state->channel = channel;
-            ax25_next_state_from_packet(state, dp);
-        } else {
-            /*
-             * This needs to be the same callsign for this channel,
-             * otherwise we are busy.
-             */
-            if (strcasecmp(state->callsign, from_callsign) == 0) {
-                ax25_next_state_from_packet(state, dp);
-            } else {
-                //debug_print("AX25: BUSY!\n");
-                /*
-                 * Send a DM with P=1 as we can not accept a
-                 * connection or other frames
-                 */
-                clear_packet(&state->response_packet);
-                state->response_packet.PF = 1;
-                ax25_send_response(channel, TYPE_U_DM, from_callsign,
-                                   &state->response_packet, NOT_EXPEDITED);
-            }
         }
-    } else if (strcasecmp(to_callsign, BROADCAST_CALLSIGN) == 0) {
-        // this was sent to the Broadcast Callsign
+        ax25_next_state_from_packet(state, &state->decoded_packet);
+    } else if (ax25_address_matches(&pkt[0], broadcast_address)) {
+        // this was sent to the Broadcast Callsign.  The PB decodes it
 
         /* Add to the queue and wait for 10ms to see if space is available */
         BaseType_t xStatus = xQueueSendToBack(xPbPacketQueue,
@@ -489,40 +822,169 @@ void ax25_process_lm_frame(uint8_t channel)
                                 (int)"AX25: ERROR: Could not add packet to PB Queue");
         }
     } else if (ReadMRAMBoolState(StateDigiEnabled)) {
-        if (dp->via_callsign[0] != 0) {
-            /* Then we have a via callsign
-             *
-             * We simplify things by only allowing one via digi, so it
-             * needs to be the first one.
-             */
-            if (strcasecmp(dp->via_callsign, DIGI_CALLSIGN) == 0 &&
-                    !dp->via_h) {
-                //debug_print(".....VIA Digi \n");
-                // Set the repeated bit, which is the last byte of the
-                // third callsign ie bit 7 byte 21
-                ax25_radio_buffer.bytes[20] |= 0x80;
-                BaseType_t xStatus = xQueueSendToBack(xTxPacketQueue,
-                                                      &ax25_radio_buffer,
-                                                      CENTISECONDS(10));
-                ReportToWatchdog(CurrentTaskWD);
-
-                if (xStatus != pdPASS) {
-                    /*
-                     * The send operation could not complete because
-                     * the queue was full
-                     */
-                    debug_print("TX QUEUE FULL: Could not add Digi UI frame to Packet Queue\n");
-                    ReportError(RTOSfailure, FALSE, CharString,
-                                        (int)"AX25: ERROR: Could not add Digi UI Frame to Queue");
-                }
+        /*
+         * The source address does not have the final bit set if there
+         * is a via callsign.  We simplify things by only allowing one
+         * via digi, so it needs to be the first one and the last
+         * address, and it must not have been repeated (H bit).
+         */
+        if ((pkt[13] & 0x01) == 0 && ax25_radio_buffer.len >= 22 &&
+                (pkt[20] & 0x01) &&
+                ax25_address_matches(&pkt[14], digi_address) &&
+                !(pkt[20] & 0x80)) {
+            //debug_print(".....VIA Digi \n");
+            TickType_t now = xTaskGetTickCount();
+            uint32_t hash;
+            if (digi_duplicate(pkt, ax25_radio_buffer.len, now, &hash)) {
+                digi_counters.duplicates++;
+                return;
+            }
+            if (!digi_airtime_available(ax25_radio_buffer.len, now)) {
+                digi_counters.over_budget++;
+                return;
+            }
+            // Set the repeated bit, which is the last byte of the
+            // third callsign ie bit 7 byte 21
+            ax25_radio_buffer.bytes[20] |= 0x80;
+            digi_tx_buffer.channel = ax25_radio_buffer.channel;
+            digi_tx_buffer.tx_modulation = tx_modulation;
+            memcpy(digi_tx_buffer.bytes, ax25_radio_buffer.bytes, ax25_radio_buffer.len);
+            digi_tx_buffer.len = ax25_radio_buffer.len;
+            bool queued = tx_queue_radio_buffer(&digi_tx_buffer, TX_CLASS_PB,
+                                                CENTISECONDS(10));
+            ReportToWatchdog(CurrentTaskWD);
+
+            if (!queued) {
+                /*
+                 * The send operation could not complete because
+                 * the queue was full
+                 */
+                digi_counters.queue_full++;
+                debug_print("TX QUEUE FULL: Could not add Digi UI frame to Packet Queue\n");
+                ReportError(RTOSfailure, FALSE, CharString,
+                                    (int)"AX25: ERROR: Could not add Digi UI Frame to Queue");
+            } else {
+                digi_remember(hash, ax25_radio_buffer.len, now);
+                digi_counters.forwarded++;
             }
         }
     } else {
         /* Silently ignore this, probably noise that looks like a packet */
-        //debug_print("AX25: Unknown destination: %s - Packet Ignored\n",to_callsign);
+        //debug_print("AX25: Unknown destination - Packet Ignored\n");
     }
 }
 
+/**
+ * digi_duplicate()
+ *
+ * Return true if this frame was repeated by the digipeater within the last
+ * DIGI_DUPLICATE_WINDOW.  The same frame is often heard on more than one
+ * receiver, or sent again by a station that did not hear the repeat.  The
+ * hash is returned so the frame can be remembered once it is repeated.  The
+ * H bit of the digi address is excluded from the hash, as it is set in the
+ * frames we repeat.
+ */
+bool digi_duplicate(uint8_t *bytes, uint16_t len, TickType_t now, uint32_t *hash_out) {
+    /* FNV-1a */
+    uint32_t hash = 2166136261u;
+    int i;
+    for (i = 0; i < len; i++) {
+        uint8_t b = bytes[i];
+        if (i == 20)
+            b &= 0x7F;
+        hash = (hash ^ b) * 16777619u;
+    }
+    for (i = 0; i < DIGI_DUPLICATE_CACHE_LEN; i++) {
+        if (digi_heard[i].len == len && digi_heard[i].hash == hash &&
+                (now - digi_heard[i].heard) < DIGI_DUPLICATE_WINDOW)
+            return true;
+    }
+    *hash_out = hash;
+    return false;
+}
+
+/**
+ * digi_remember()
+ *
+ * Add a frame we repeated to the duplicate cache, replacing the oldest entry.
+ */
+void digi_remember(uint32_t hash, uint16_t len, TickType_t now) {
+    digi_heard[digi_heard_next].hash = hash;
+    digi_heard[digi_heard_next].len = len;
+    digi_heard[digi_heard_next].heard = now;
+    digi_heard_next = (digi_heard_next + 1) % DIGI_DUPLICATE_CACHE_LEN;
+}
+
+/**
+ * digi_airtime_available()
+ *
+ * Token bucket that limits the digipeater to digi_airtime_percent of the
+ * transmitter time, so a busy digi can not starve the PB and the BBS.  The
+ * bucket holds up to DIGI_AIRTIME_WINDOW_SECONDS worth of that share, in ms,
+ * and refills as time passes.  Returns true and takes the airtime of the frame
+ * at the current TX bit rate if there is enough left, otherwise false.  With
+ * FX.25 the frame time includes the correlation tag, the padding of the code
+ * word and the parity.
+ */
+bool digi_airtime_available(uint16_t len, TickType_t now) {
+    uint32_t capacity = (uint32_t)digi_airtime_percent * DIGI_AIRTIME_WINDOW_SECONDS * 10;
+    uint32_t elapsed_ms = (now - digi_airtime_updated) * portTICK_RATE_MS;
+    digi_airtime_updated = now;
+
+    if (digi_airtime_percent >= 100)
+        return true;
+    if (elapsed_ms > DIGI_AIRTIME_WINDOW_SECONDS * 1000)
+        elapsed_ms = DIGI_AIRTIME_WINDOW_SECONDS * 1000;
+    digi_airtime_ms += elapsed_ms * digi_airtime_percent / 100;
+    if (digi_airtime_ms > capacity)
+        digi_airtime_ms = capacity;
+
+    uint32_t bytes = len + DIGI_FRAME_OVERHEAD_BYTES;
+    if (digi_tx_fx25) {
+        int fx25_len = fx25_encoded_len(len);
+        if (fx25_len != 0)
+            bytes = fx25_len + DIGI_FRAME_OVERHEAD_BYTES;
+    }
+    uint32_t frame_ms = (bytes * 8 * 1000 + digi_tx_bit_rate - 1) / digi_tx_bit_rate;
+    if (frame_ms > digi_airtime_ms)
+        return false;
+    digi_airtime_ms -= frame_ms;
+    return true;
+}
+
+/**
+ * ax25_set_digi_airtime_percent()
+ *
+ * Called by the command handler after the percent is written to MRAM.
+ * The bucket is not refilled, so raising the limit takes effect as
+ * the time passes.
+ */
+void ax25_set_digi_airtime_percent(uint16_t percent) {
+    if (percent > 100)
+        percent = 100;
+    digi_airtime_percent = percent;
+}
+
+/**
+ * ax25_set_tx_modulation()
+ *
+ * Called when the TX modulation changes, so the digipeater airtime is
+ * worked out at the new bit rate and with FX.25 if it is used.
+ */
+void ax25_set_tx_modulation(enum radio_modulation mod) {
+    digi_tx_bit_rate = modulation_to_bit_rate(mod);
+    digi_tx_fx25 = (MODULATION_TO_FEC(mod) == FEC_RS);
+}
+
+/**
+ * ax25_digi_counters()
+ *
+ * Copy the digipeater counters, which count since the last reset.
+ */
+void ax25_digi_counters(AX25_digi_counters_t *counters) {
+    *counters = digi_counters;
+}
+
 /**
  * Create a packet and send to TX for transmission.
  *
@@ -532,7 +994,7 @@ void ax25_process_lm_frame(uint8_t channel)
  * it correctly.  If there is a choice then it should already be set
  * correctly in the packet
  */
-void ax25_send_response(uint8_t channel, ax25_frame_type_t frame_type,
+void ax25_send_response(uint8_t session, ax25_frame_type_t frame_type,
                         char *to_callsign, AX25_PACKET *response_packet,
                         bool expedited)
 {
@@ -540,6 +1002,8 @@ void ax25_send_response(uint8_t channel, ax25_frame_type_t frame_type,
     strlcpy(response_packet->from_callsign, BBS_CALLSIGN, MAX_CALLSIGN_LEN);
 
     response_packet->frame_type = frame_type;
+    response_packet->extended = (session < AX25_MAX_SESSIONS &&
+        data_link_state_machine[session].modulo == MODULO_EXTENDED);
 #ifdef TRACE_AX25_DL
     trace_dl("AX25[%d]: ",rx_channel);
     print_decoded_packet("Send ", response_packet);
@@ -567,6 +1031,7 @@ bool ax25_send_event(AX25_data_link_state_machine_t *state,
 {
     BaseType_t xStatus;
 
+    send_event_buffer.session = state->session;
     send_event_buffer.rx_channel = state->channel;
     send_event_buffer.primitive = prim;
     send_event_buffer.error_num = error_num;
@@ -596,6 +1061,7 @@ bool ax25_send_lm_event(AX25_data_link_state_machine_t *state,
 {
     BaseType_t xStatus;
 
+    lm_event.session = state->session;
     lm_event.rx_channel = state->channel;
     lm_event.primitive = prim;
     lm_event.error_num = NO_ERROR;
@@ -715,6 +1181,7 @@ void ax25_state_disc_prim(AX25_data_link_state_machine_t *state,
         }
         case DL_CONNECT_Request : {
             trace_dl("Request to initiate connection from Layer 3\n");
+            set_version_2_0(state); // We do not know if the station supports v2.2
             establish_data_link(state);
             set_layer_3_initiated(state);
             state->dl_state = AWAITING_CONNECTION;
@@ -746,50 +1213,45 @@ void ax25_state_disc_packet(AX25_data_link_state_machine_t *state,
             trace_dl("UA\n");
             clear_packet(&state->response_packet);
             state->response_packet.PF = packet->PF & 0b1;
-            ax25_send_response(state->channel, TYPE_U_DM, state->callsign,
+            ax25_send_response(state->session, TYPE_U_DM, state->callsign,
                                &state->response_packet, NOT_EXPEDITED);
             break;
         }
-        case TYPE_U_SABM : {
-            trace_dl("SABM\n");
+        case TYPE_U_SABM :
+        case TYPE_U_SABME : {
+            trace_dl("SABM or SABME\n");
             clear_packet(&state->response_packet);
-            // Set version 2.0 - we already have the default values of
-            // MODULO 8 and no SREJ.
+            // SABM sets version 2.0 with MOD 8.  SABME sets version 2.2
+            // with MOD 128 and the larger window.
+            if (packet->frame_type == TYPE_U_SABME)
+                set_version_2_2(state);
+            else
+                set_version_2_0(state);
             state->response_packet.PF = packet->PF & 0b1;
-            ax25_send_response(state->channel, TYPE_U_UA, state->callsign,
+            ax25_send_response(state->session, TYPE_U_UA, state->callsign,
                                &state->response_packet, NOT_EXPEDITED);
             clear_exception_conditions(state);
+            release_iframes_sent(state);
             state->VS = 0;
             state->VA = 0;
             state->VR = 0;
 
             // Send DL_CONNECT_Indication to Layer 3
             ax25_send_event(state, DL_CONNECT_Indicate, packet, NO_ERROR);
-            // NOT IMPLEMENTED - SRT and T1V are not calculated and set
 
             // Make sure T1 is stopped as we start a new connection
-            stop_timer(timerT1[state->channel]);
-            start_timer(timerT3[state->channel]);
+            stop_timer(timerT1[state->session]);
+            start_timer(timerT3[state->session]);
             state->RC = 0;
             state->dl_state = CONNECTED;
             break;
         }
-        case TYPE_U_SABME : {
-            trace_dl("SABME - V2.2 NOT SUPPORTED\n");
-            // We dont support v2.2 yet, so send FRMR and remain in
-            // disconnected dl_state.
-            clear_packet(&state->response_packet);
-            state->response_packet.PF = packet->PF & 0b1;
-            ax25_send_response(state->channel, TYPE_U_FRMR, state->callsign,
-                               &state->response_packet, NOT_EXPEDITED);
-            break;
-        }
         default:
             // All other commands get a DM
             if (packet->command) {
                 clear_packet(&state->response_packet);
                 state->response_packet.PF = packet->PF & 0b1;
-                ax25_send_response(state->channel, TYPE_U_DM, state->callsign,
+                ax25_send_response(state->session, TYPE_U_DM, state->callsign,
                                    &state->response_packet, NOT_EXPEDITED);
             } else {
                 trace_dl("Ignoring unexpected pkt type: %0x from %s\n",
@@ -831,10 +1293,10 @@ void ax25_state_wait_conn_prim(AX25_data_link_state_machine_t *state,
             // DISC P = 1
             clear_packet(&state->response_packet);
             state->response_packet.PF = 1;
-            ax25_send_response(state->channel, TYPE_U_DISC, state->callsign,
+            ax25_send_response(state->session, TYPE_U_DISC, state->callsign,
                                &state->response_packet, NOT_EXPEDITED);
-            stop_timer(timerT3[state->channel]);
-            start_timer(timerT1[state->channel]);
+            stop_timer(timerT3[state->session]);
+            start_timer(timerT1[state->session]);
             state->dl_state = AWAITING_RELEASE;
             break;
         }
@@ -859,8 +1321,6 @@ void ax25_state_wait_conn_prim(AX25_data_link_state_machine_t *state,
             break;
         }
         case DL_POP_IFRAME_Request : {
-            BaseType_t xStatus;
-
             trace_dl("I-frame Request or pop from Layer 3\n");
             // Is layer 3 initiated
             if (state->layer_3_initiated_the_request) {
@@ -870,9 +1330,7 @@ void ax25_state_wait_conn_prim(AX25_data_link_state_machine_t *state,
                 
                 // Instead we could ignore the data and tell layer 3
                 // we are disconnected.  i.e. reset it.
-                xStatus = xQueueSendToFront(xIFrameQueue[state->channel], event,
-                                            CENTISECONDS(1));
-                if (xStatus != pdPASS) {
+                if (!push_back_iframe(state, event->iframe, CENTISECONDS(1))) {
                     /* The send operation could not complete because the queue was full */
                     // debug_print("AX25: IFRAME QUEUE FULL Channel %d: Could not push back to IFrame Queue for frame received in wrong state\n",state->channel);
                     // This can be ignored.  We are doing our best to conserve info received in the wrong state
@@ -890,14 +1348,15 @@ void ax25_state_wait_conn_prim(AX25_data_link_state_machine_t *state,
                  state->dl_state = DISCONNECTED;
              } else {
                  state->RC += 1;
-                 // SABM P = 1
+                 // SABM or SABME P = 1
                  clear_packet(&state->response_packet);
                  state->response_packet.PF = 1;
-                 ax25_send_response(state->channel, TYPE_U_SABM,
+                 ax25_send_response(state->session,
+                                    state->version == version_2_2 ? TYPE_U_SABME : TYPE_U_SABM,
                                     state->callsign, &state->response_packet,
                                     NOT_EXPEDITED);
-                 // Select T1 Value - is not implemented
-                 start_timer(timerT1[state->channel]);
+                 select_t1_value(state);
+                 start_timer(timerT1[state->session]);
              }
              break;
         }
@@ -920,7 +1379,7 @@ void ax25_state_wait_conn_packet(AX25_data_link_state_machine_t *state,
             if (packet->PF == 1) {
                 clear_packet(&state->response_packet);
                 state->response_packet.PF = 1;
-                ax25_send_response(state->channel, TYPE_U_DM, state->callsign,
+                ax25_send_response(state->session, TYPE_U_DM, state->callsign,
                                    &state->response_packet, NOT_EXPEDITED);
             }
             break;
@@ -929,25 +1388,37 @@ void ax25_state_wait_conn_packet(AX25_data_link_state_machine_t *state,
             trace_dl("SABM\n");
             clear_packet(&state->response_packet);
             state->response_packet.PF = packet->PF & 0b1;
-            ax25_send_response(state->channel, TYPE_U_UA, state->callsign,
+            ax25_send_response(state->session, TYPE_U_UA, state->callsign,
                                &state->response_packet, EXPEDITED);
             break;
         }
         case TYPE_U_SABME : {
             trace_dl("SABME\n");
+            // Both ends tried to connect.  Accept v2.2 as they asked
+            set_version_2_2(state);
             clear_packet(&state->response_packet);
             state->response_packet.PF = packet->PF & 0b1;
-            ax25_send_response(state->channel, TYPE_U_FRMR, state->callsign,
+            ax25_send_response(state->session, TYPE_U_UA, state->callsign,
                                &state->response_packet, EXPEDITED);
-            // TODO - stay in wait connection and hope they send SABM
-            // or move to DISCONNECTED?
+            break;
+        }
+        case TYPE_U_FRMR : {
+            trace_dl("FRMR\n");
+            if (state->version == version_2_2) {
+                // The other station does not support v2.2, so fall
+                // back to v2.0 and send SABM instead.  This is the
+                // AWAITING_V2_2_CONNECTION logic from the spec, which
+                // we track with the version rather than a separate state
+                set_version_2_0(state);
+                establish_data_link(state);
+            }
             break;
         }
         case TYPE_U_DISC : {
             trace_dl("DISC\n");
             clear_packet(&state->response_packet);
             state->response_packet.PF = packet->PF & 0b1;
-            ax25_send_response(state->channel, TYPE_U_DM, state->callsign,
+            ax25_send_response(state->session, TYPE_U_DM, state->callsign,
                                &state->response_packet, EXPEDITED);
             break;
         }
@@ -956,7 +1427,7 @@ void ax25_state_wait_conn_packet(AX25_data_link_state_machine_t *state,
             if (packet->PF == 1) {
                 discard_iframe_queue(state);
                 ax25_send_event(state, DL_DISCONNECT_Indicate, NULL, NO_ERROR);
-                stop_timer(timerT1[state->channel]);
+                stop_timer(timerT1[state->session]);
                 state->dl_state = DISCONNECTED;
             }
             // else stay in AWAITING CONNECTION state
@@ -977,12 +1448,13 @@ void ax25_state_wait_conn_packet(AX25_data_link_state_machine_t *state,
                                         NO_ERROR);
                     }
                 }
-                stop_timer(timerT1[state->channel]);
-                start_timer(timerT3[state->channel]);
+                stop_timer(timerT1[state->session]);
+                start_timer(timerT3[state->session]);
+                release_iframes_sent(state);
                 state->VS = 0;
                 state->VA = 0;
                 state->VR = 0;
-                // Select T1 value - NOT IMPLEMEMENTED
+                select_t1_value(state);
                 state->dl_state = CONNECTED;
             } else {
                 ax25_send_event(state, DL_ERROR_Indicate, NULL, ERROR_D);
@@ -1009,7 +1481,7 @@ void ax25_state_wait_release_prim(AX25_data_link_state_machine_t *state,
         case DL_DISCONNECT_Request : {
             clear_packet(&state->response_packet);
             state->response_packet.PF = 0;
-            ax25_send_response(state->channel, TYPE_U_DM, state->callsign,
+            ax25_send_response(state->session, TYPE_U_DM, state->callsign,
                                &state->response_packet, EXPEDITED);
             break;
         }
@@ -1025,10 +1497,10 @@ void ax25_state_wait_release_prim(AX25_data_link_state_machine_t *state,
                  // DISC P = 1
                  clear_packet(&state->response_packet);
                  state->response_packet.PF = 1;
-                 ax25_send_response(state->channel, TYPE_U_DISC, state->callsign,
+                 ax25_send_response(state->session, TYPE_U_DISC, state->callsign,
                                     &state->response_packet, NOT_EXPEDITED);
-                 // Select T1 Value - is not implemented
-                 start_timer(timerT1[state->channel]);
+                 select_t1_value(state);
+                 start_timer(timerT1[state->session]);
              }
              break;
          }
@@ -1051,27 +1523,19 @@ void ax25_state_wait_release_packet(AX25_data_link_state_machine_t *state,
                 ax25_send_event(state, DL_DISCONNECT_Confirm, NULL, NO_ERROR);
 
                 // Stop T1
-                stop_timer(timerT1[state->channel]);
+                stop_timer(timerT1[state->session]);
                 state->dl_state = DISCONNECTED;
             } else {
                 ax25_send_event(state, DL_ERROR_Indicate, NULL, ERROR_D);
             }
             break;
         }
-        case TYPE_U_SABM : {
-            trace_dl("SABM\n");
-            clear_packet(&state->response_packet);
-            state->response_packet.PF = packet->PF & 0b1;
-            ax25_send_response(state->channel, TYPE_U_DM, state->callsign,
-                               &state->response_packet, EXPEDITED);
-            break;
-        }
+        case TYPE_U_SABM :
         case TYPE_U_SABME : {
-            trace_dl("SABME - V2.2 NOT SUPPORTED\n");
-            // We dont support v2.2 yet, so send FRMR and remain in dl_state.
+            trace_dl("SABM or SABME\n");
             clear_packet(&state->response_packet);
             state->response_packet.PF = packet->PF & 0b1;
-            ax25_send_response(state->channel, TYPE_U_FRMR, state->callsign,
+            ax25_send_response(state->session, TYPE_U_DM, state->callsign,
                                &state->response_packet, EXPEDITED);
             break;
         }
@@ -1079,7 +1543,7 @@ void ax25_state_wait_release_packet(AX25_data_link_state_machine_t *state,
             trace_dl("UA\n");
             clear_packet(&state->response_packet);
             state->response_packet.PF = packet->PF & 0b1;
-            ax25_send_response(state->channel, TYPE_U_UA, state->callsign,
+            ax25_send_response(state->session, TYPE_U_UA, state->callsign,
                                &state->response_packet, EXPEDITED);
             break;
         }
@@ -1087,7 +1551,7 @@ void ax25_state_wait_release_packet(AX25_data_link_state_machine_t *state,
             trace_dl("DM\n");
             if (packet->PF == 1) {
                 ax25_send_event(state, DL_DISCONNECT_Confirm, packet, NO_ERROR);
-                stop_timer(timerT1[state->channel]);
+                stop_timer(timerT1[state->session]);
                 state->dl_state = DISCONNECTED;
             }
             // else if F != 1 just stay in awaiting release state
@@ -1099,7 +1563,7 @@ void ax25_state_wait_release_packet(AX25_data_link_state_machine_t *state,
             if (packet->PF == 1) {
                 clear_packet(&state->response_packet);
                 state->response_packet.PF = 1;
-                ax25_send_response(state->channel, TYPE_U_DM, state->callsign,
+                ax25_send_response(state->session, TYPE_U_DM, state->callsign,
                                    &state->response_packet, NOT_EXPEDITED);
             }
             break;
@@ -1112,7 +1576,7 @@ void ax25_state_wait_release_packet(AX25_data_link_state_machine_t *state,
             if (packet->PF == 1) {
                 clear_packet(&state->response_packet);
                 state->response_packet.PF = 1;
-                ax25_send_response(state->channel, TYPE_U_DM, state->callsign,
+                ax25_send_response(state->session, TYPE_U_DM, state->callsign,
                                    &state->response_packet, NOT_EXPEDITED);
             }
             break;
@@ -1124,7 +1588,7 @@ void ax25_state_wait_release_packet(AX25_data_link_state_machine_t *state,
                 if (packet->PF == 1) {
                     clear_packet(&state->response_packet);
                     state->response_packet.PF = 1;
-                    ax25_send_response(state->channel, TYPE_U_DM,
+                    ax25_send_response(state->session, TYPE_U_DM,
                                        state->callsign, &state->response_packet,
                                        EXPEDITED);
                 }
@@ -1154,11 +1618,11 @@ void ax25_state_connected_prim(AX25_data_link_state_machine_t *state,
             // DISC P = 1
             clear_packet(&state->response_packet);
             state->response_packet.PF = 1;
-            ax25_send_response(state->channel, TYPE_U_DISC, state->callsign,
+            ax25_send_response(state->session, TYPE_U_DISC, state->callsign,
                                &state->response_packet, NOT_EXPEDITED);
 
-            stop_timer(timerT3[state->channel]);
-            start_timer(timerT1[state->channel]);
+            stop_timer(timerT3[state->session]);
+            start_timer(timerT1[state->session]);
             state->dl_state = AWAITING_RELEASE;
             break;
         }
@@ -1184,10 +1648,12 @@ void ax25_state_connected_prim(AX25_data_link_state_machine_t *state,
         }
         case DL_FLOW_ON_Request : {
             trace_dl("Request FLOW ON from Layer 3\n");
+            own_receiver_flow_on(state);
             break;
         }
         case DL_FLOW_OFF_Request : {
             trace_dl("Request FLOW OFF from Layer 3\n");
+            own_receiver_flow_off(state);
             break;
         }
         case DL_CONNECT_Request : {
@@ -1234,13 +1700,17 @@ void ax25_state_connected_packet(AX25_data_link_state_machine_t *state,
 {
     //trace_dl("AX25: STATE CONNECTED (frame): ");
     switch (packet->frame_type) {
-        case TYPE_U_SABM : {
-            trace_dl("SABM\n");
+        case TYPE_U_SABM :
+        case TYPE_U_SABME : {
+            trace_dl("SABM or SABME\n");
             clear_packet(&state->response_packet);
             state->response_packet.PF = packet->PF &0b1;
-            // Set version 2.0 - we already have the default values of
-            // MODULO 8 and no SREJ.
-            ax25_send_response(state->channel, TYPE_U_UA, state->callsign,
+            // The other station reset the link, perhaps with a new version
+            if (packet->frame_type == TYPE_U_SABME)
+                set_version_2_2(state);
+            else
+                set_version_2_0(state);
+            ax25_send_response(state->session, TYPE_U_UA, state->callsign,
                                &state->response_packet, NOT_EXPEDITED);
             clear_exception_conditions(state);
 
@@ -1253,23 +1723,15 @@ void ax25_state_connected_packet(AX25_data_link_state_machine_t *state,
                 discard_iframe_queue(state);
                 ax25_send_event(state, DL_CONNECT_Indicate, packet, NO_ERROR);
             }
-            stop_timer(timerT1[state->channel]);
-            start_timer(timerT3[state->channel]);
+            stop_timer(timerT1[state->session]);
+            start_timer(timerT3[state->session]);
+            release_iframes_sent(state);
             state->VS = 0;
             state->VA = 0;
             state->VR = 0;
             state->RC = 0;
             break;
         }
-        case TYPE_U_SABME : {
-            trace_dl("SABME - NOT SUPPORTED YET\n");
-            // We dont support v2.2 yet, so send FRMR and remain in connected dl_state.
-            clear_packet(&state->response_packet);
-            state->response_packet.PF = packet->PF & 0b1;
-            ax25_send_response(state->channel, TYPE_U_FRMR, state->callsign,
-                               &state->response_packet, NOT_EXPEDITED);
-            break;
-        }
         case TYPE_U_FRMR : {
             trace_dl("FRMR\n");
             ax25_send_event(state, DL_ERROR_Indicate, NULL, ERROR_K);
@@ -1297,11 +1759,11 @@ void ax25_state_connected_packet(AX25_data_link_state_machine_t *state,
             discard_iframe_queue(state);
             clear_packet(&state->response_packet);
             state->response_packet.PF = packet->PF &0b1;
-            ax25_send_response(state->channel, TYPE_U_UA, state->callsign, &state->response_packet, NOT_EXPEDITED);
+            ax25_send_response(state->session, TYPE_U_UA, state->callsign, &state->response_packet, NOT_EXPEDITED);
             ax25_send_event(state, DL_DISCONNECT_Indicate, packet, NO_ERROR);
-            stop_timer(timerT3[state->channel]);
+            stop_timer(timerT3[state->session]);
             // This is set to STOP as per the previous flow chart and DireWolf
-            stop_timer(timerT1[state->channel]);
+            stop_timer(timerT1[state->session]);
             state->dl_state = DISCONNECTED;
             break;
         }
@@ -1310,8 +1772,8 @@ void ax25_state_connected_packet(AX25_data_link_state_machine_t *state,
             ax25_send_event(state, DL_ERROR_Indicate, packet, ERROR_E);
             ax25_send_event(state, DL_DISCONNECT_Indicate, packet, NO_ERROR);
             discard_iframe_queue(state);
-            stop_timer(timerT3[state->channel]);
-            stop_timer(timerT1[state->channel]);
+            stop_timer(timerT3[state->session]);
+            stop_timer(timerT1[state->session]);
             state->dl_state = DISCONNECTED;
             break;
         }
@@ -1327,8 +1789,16 @@ void ax25_state_connected_packet(AX25_data_link_state_machine_t *state,
             connected_rframe_response(state, packet);
             break;
         }
+        /* Resend just the frame NR, which the other station did not receive */
         case TYPE_S_SREJ : {
-            trace_dl("SREJ -- NOT IMPLEMENTED\n");
+            trace_dl("SREJ\n");
+            state->peer_receiver_busy = false;
+            if (VA_lte_NR_lte_VS(state, packet->NR)) {
+                selective_retransmission(state, packet);
+            } else {
+                nr_error_recovery(state, packet);
+                state->dl_state = AWAITING_CONNECTION;
+            }
             break;
         }
         /* Causes us to start resending I Frames at the specified number */
@@ -1337,11 +1807,11 @@ void ax25_state_connected_packet(AX25_data_link_state_machine_t *state,
             state->peer_receiver_busy = false;
             check_need_for_response(state, packet);
             if (VA_lte_NR_lte_VS(state, packet->NR)) {
-                state->VA = packet->NR;
-                stop_timer(timerT1[state->channel]);
-                stop_timer(timerT3[state->channel]);
+                acknowledge_iframes(state, packet->NR);
+                stop_timer(timerT1[state->session]);
+                stop_timer(timerT3[state->session]);
                 state->achnowledge_pending = false;
-                // Select T1 value
+                select_t1_value(state);
                 invoke_retransmission(state, packet->NR);
             } else {
                 nr_error_recovery(state, packet);
@@ -1350,6 +1820,11 @@ void ax25_state_connected_packet(AX25_data_link_state_machine_t *state,
 
             break;
         }
+        case TYPE_U_XID : {
+            trace_dl("XID\n");
+            process_xid(state, packet);
+            break;
+        }
         case TYPE_I : {
             trace_dl("I FRAME\n");
             process_iframe(state, packet, CONNECTED);
@@ -1377,10 +1852,10 @@ void ax25_state_timer_rec_prim(AX25_data_link_state_machine_t *state,
             // DISC P = 1
             clear_packet(&state->response_packet);
             state->response_packet.PF = 1;
-            ax25_send_response(state->channel, TYPE_U_DISC, state->callsign,
+            ax25_send_response(state->session, TYPE_U_DISC, state->callsign,
                                &state->response_packet, NOT_EXPEDITED);
-            stop_timer(timerT3[state->channel]);
-            start_timer(timerT1[state->channel]);
+            stop_timer(timerT3[state->session]);
+            start_timer(timerT1[state->session]);
             state->dl_state = AWAITING_RELEASE;
             break;
         }
@@ -1405,10 +1880,12 @@ void ax25_state_timer_rec_prim(AX25_data_link_state_machine_t *state,
         }
         case DL_FLOW_ON_Request : {
             trace_dl("Request FLOW ON from Layer 3\n");
+            own_receiver_flow_on(state);
             break;
         }
         case DL_FLOW_OFF_Request : {
             trace_dl("Request FLOW OFF from Layer 3\n");
+            own_receiver_flow_off(state);
             break;
         }
         case DL_CONNECT_Request : {
@@ -1445,7 +1922,7 @@ void ax25_state_timer_rec_prim(AX25_data_link_state_machine_t *state,
                 // response to P = 1.  This differs from the spec.
                 state->response_packet.PF = 0;
                 state->response_packet.command = AX25_RESPONSE;
-                ax25_send_response(state->channel, TYPE_U_DM, state->callsign,
+                ax25_send_response(state->session, TYPE_U_DM, state->callsign,
                                    &state->response_packet, NOT_EXPEDITED);
                 state->dl_state = DISCONNECTED;
             } else {
@@ -1494,18 +1971,22 @@ void ax25_state_timer_rec_packet(AX25_data_link_state_machine_t *state,
             ax25_send_event(state, DL_ERROR_Indicate, packet, ERROR_E);
             ax25_send_event(state, DL_DISCONNECT_Indicate, packet, NO_ERROR);
             discard_iframe_queue(state);
-            stop_timer(timerT3[state->channel]);
-            stop_timer(timerT1[state->channel]);
+            stop_timer(timerT3[state->session]);
+            stop_timer(timerT1[state->session]);
             state->dl_state = DISCONNECTED;
             break;
         }
-        case TYPE_U_SABM : {
-            trace_dl("SABM\n");
+        case TYPE_U_SABM :
+        case TYPE_U_SABME : {
+            trace_dl("SABM or SABME\n");
             clear_packet(&state->response_packet);
             state->response_packet.PF = packet->PF & 0b1;
-            // Set version 2.0 - we already have the default values of
-            // MODULO 8 and no SREJ.
-            ax25_send_response(state->channel, TYPE_U_UA, state->callsign,
+            // The other station reset the link, perhaps with a new version
+            if (packet->frame_type == TYPE_U_SABME)
+                set_version_2_2(state);
+            else
+                set_version_2_0(state);
+            ax25_send_response(state->session, TYPE_U_UA, state->callsign,
                                &state->response_packet, NOT_EXPEDITED);
             clear_exception_conditions(state);
 
@@ -1517,8 +1998,9 @@ void ax25_state_timer_rec_packet(AX25_data_link_state_machine_t *state,
                 discard_iframe_queue(state);
                 ax25_send_event(state, DL_CONNECT_Indicate, packet, NO_ERROR);
             }
-            stop_timer(timerT1[state->channel]);
-            start_timer(timerT3[state->channel]);
+            stop_timer(timerT1[state->session]);
+            start_timer(timerT3[state->session]);
+            release_iframes_sent(state);
             state->VS = 0;
             state->VA = 0;
             state->VR = 0;
@@ -1526,16 +2008,6 @@ void ax25_state_timer_rec_packet(AX25_data_link_state_machine_t *state,
             state->dl_state = CONNECTED;
             break;
         }
-        case TYPE_U_SABME : {
-            trace_dl("SABME - NOT SUPPORTED YET\n");
-            // We dont support v2.2 yet, so send FRMR and remain in
-            // disconnected dl_state.
-            clear_packet(&state->response_packet);
-            state->response_packet.PF = packet->PF & 0b1;
-            ax25_send_response(state->channel, TYPE_U_FRMR, state->callsign,
-                               &state->response_packet, NOT_EXPEDITED);
-            break;
-        }
         case TYPE_U_FRMR : {
             trace_dl("FRMR\n");
             ax25_send_event(state, DL_ERROR_Indicate, NULL, ERROR_K);
@@ -1554,11 +2026,11 @@ void ax25_state_timer_rec_packet(AX25_data_link_state_machine_t *state,
             discard_iframe_queue(state);
             clear_packet(&state->response_packet);
             state->response_packet.PF = packet->PF & 0b1;
-            ax25_send_response(state->channel, TYPE_U_UA, state->callsign,
+            ax25_send_response(state->session, TYPE_U_UA, state->callsign,
                                &state->response_packet, NOT_EXPEDITED);
             ax25_send_event(state, DL_DISCONNECT_Indicate, packet, NO_ERROR);
-            stop_timer(timerT3[state->channel]);
-            stop_timer(timerT1[state->channel]);
+            stop_timer(timerT3[state->session]);
+            stop_timer(timerT1[state->session]);
             state->dl_state = DISCONNECTED;
             break;
         }
@@ -1579,7 +2051,15 @@ void ax25_state_timer_rec_packet(AX25_data_link_state_machine_t *state,
         // transmit then send Eqnuiry Response if AckPending...
 
         case TYPE_S_SREJ : {
-            trace_dl("SREJ -- NOT IMPLEMENTED\n");
+            trace_dl("SREJ\n");
+            state->peer_receiver_busy = false;
+            if (VA_lte_NR_lte_VS(state, packet->NR)) {
+                // Stay in timer recovery.  T1 runs until the poll is answered
+                selective_retransmission(state, packet);
+            } else {
+                nr_error_recovery(state, packet);
+                state->dl_state = AWAITING_CONNECTION;
+            }
             break;
         }
         case TYPE_S_REJ : {
@@ -1587,19 +2067,19 @@ void ax25_state_timer_rec_packet(AX25_data_link_state_machine_t *state,
             state->peer_receiver_busy = false;
 
             if (packet->command == AX25_RESPONSE && packet->PF == 1) {
-                stop_timer(timerT1[state->channel]);
-                // Select T1 value
+                stop_timer(timerT1[state->session]);
+                select_t1_value(state);
                 if (VA_lte_NR_lte_VS(state, packet->NR)) {
-                    state->VA = packet->NR;
+                    acknowledge_iframes(state, packet->NR);
                     if (state->VS == state->VA) {
-                        start_timer(timerT3[state->channel]);
+                        start_timer(timerT3[state->session]);
                         state->RC = 0;
                         state->dl_state = CONNECTED;
                         return;
                     } else {
                         invoke_retransmission(state, packet->NR);
-                        stop_timer(timerT3[state->channel]);
-                        start_timer(timerT1[state->channel]);
+                        stop_timer(timerT3[state->session]);
+                        start_timer(timerT1[state->session]);
                         state->achnowledge_pending = false;
                         state->dl_state = TIMER_RECOVERY;
                         return;
@@ -1614,14 +2094,14 @@ void ax25_state_timer_rec_packet(AX25_data_link_state_machine_t *state,
                     enquiry_response(state, packet, 1);
                 }
                 if (VA_lte_NR_lte_VS(state, packet->NR)) {
-                    state->VA = packet->NR;
+                    acknowledge_iframes(state, packet->NR);
                     if (state->VS == state->VA) {
                         state->dl_state = TIMER_RECOVERY;
                         return;
                     } else {
                         invoke_retransmission(state, packet->NR);
-                        stop_timer(timerT3[state->channel]);
-                        start_timer(timerT1[state->channel]);
+                        stop_timer(timerT3[state->session]);
+                        start_timer(timerT1[state->session]);
                         state->achnowledge_pending = false;
                         state->dl_state = TIMER_RECOVERY;
                         return;
@@ -1633,6 +2113,11 @@ void ax25_state_timer_rec_packet(AX25_data_link_state_machine_t *state,
             }
             break;
         }
+        case TYPE_U_XID : {
+            trace_dl("XID\n");
+            process_xid(state, packet);
+            break;
+        }
         case TYPE_I : {
             trace_dl("I FRAME\n");
             process_iframe(state, packet, TIMER_RECOVERY);
@@ -1669,19 +2154,19 @@ void timer_rec_rframe_response(AX25_data_link_state_machine_t *state,
 {
     check_need_for_response(state, packet);
     if (packet->command == AX25_RESPONSE && packet->PF == 1) {
-        stop_timer(timerT1[state->channel]);
-        // Select T1 Value
+        stop_timer(timerT1[state->session]);
+        select_t1_value(state);
         if (VA_lte_NR_lte_VS(state, packet->NR)) {
-            state->VA = packet->NR;
+            acknowledge_iframes(state, packet->NR);
             if (state->VS == state->VA) {
-                start_timer(timerT3[state->channel]);
+                start_timer(timerT3[state->session]);
                 state->RC = 0;
                 state->dl_state = CONNECTED;
                 return;
             } else {
                 invoke_retransmission(state, packet->NR);
-                stop_timer(timerT3[state->channel]);
-                start_timer(timerT1[state->channel]);
+                stop_timer(timerT3[state->session]);
+                start_timer(timerT1[state->session]);
                 state->achnowledge_pending = true;
                 state->dl_state = TIMER_RECOVERY;
                 return;
@@ -1697,7 +2182,7 @@ void timer_rec_rframe_response(AX25_data_link_state_machine_t *state,
             enquiry_response(state, packet, 1);
         }
         if (VA_lte_NR_lte_VS(state, packet->NR)) {
-            state->VA = packet->NR;
+            acknowledge_iframes(state, packet->NR);
             state->dl_state = TIMER_RECOVERY;
             return;
         } else {
@@ -1715,50 +2200,53 @@ void timer_rec_rframe_response(AX25_data_link_state_machine_t *state,
 void iframe_pops_off_queue(AX25_data_link_state_machine_t *state,
                            AX25_event_t *event)
 {
-    BaseType_t xStatus;
+    AX25_PACKET *iframe = ax25_packet(event->iframe);
+    AX25_PACKET_HANDLE *slot;
     bool rc;
 
     //trace_dl("POP IFRAME Request\n");
-    //print_decoded_packet("I-frame pops off Queue: ",&(event->packet));
+    //print_decoded_packet("I-frame pops off Queue: ",iframe);
     if (state->peer_receiver_busy) {
         // push iframe back on queue
         trace_dl("POP Iframe, but.. Peer Busy, Iframe put back on queue\n");
-        xStatus = xQueueSendToFront(xIFrameQueue[state->channel], event,
-                                    CENTISECONDS(10));
-        if(xStatus != pdPASS) {
+        if (!push_back_iframe(state, event->iframe, CENTISECONDS(10))) {
             debug_print("AX25: PROGRAM LOGIC ERROR: IFRAME QUEUE FULL: Could not push back to IFrame Queue\n");
             ReportError(RTOSfailure, FALSE, CharString,
                                 (int)"AX25: ERROR: Could not add packet to IFrame Queue");
             return;
         }
-    } else if (state->VS == ((state->VA + K)%MODULO)) {
+    } else if (AX25_MODULO(state->VS - state->VA, state->modulo) >= state->k) {
+        // XID can lower k while frames are outstanding, so this is not just VS == VA + k
         // push iframe back on queue
         trace_dl("POP Iframe but .. VS == VA + K, Iframe put back on queue\n");
-        xStatus = xQueueSendToFront(xIFrameQueue[state->channel], event,
-                                    CENTISECONDS(10));
-        if( xStatus != pdPASS ) {
+        if (!push_back_iframe(state, event->iframe, CENTISECONDS(10))) {
             debug_print("AX25: PROGRAM LOGIC ERROR: IFRAME QUEUE FULL: Could not push back to IFrame Queue\n");
             ReportError(RTOSfailure, FALSE, CharString,
                                 (int)"AX25: ERROR: Could not add packet to IFrame Queue");
             return;
         }
+    } else if (iframe->data_len > state->n1) {
+        // Layer 3 should not send more than N1.  We can not split it, so drop it
+        debug_print("AX25: ERROR: I frame of %d bytes is longer than N1 of %d\n",
+                    iframe->data_len, state->n1);
+        ReportError(TxPacketDropped, FALSE, CharString,
+                    (int)"AX25: ERROR: I frame longer than N1.  Packet Dropped.");
     } else {
-        event->packet.NS = state->VS;
-        event->packet.NR = state->VR;
-        event->packet.PF = 0;
+        iframe->NS = state->VS;
+        iframe->NR = state->VR;
+        iframe->PF = 0;
+        iframe->extended = (state->modulo == MODULO_EXTENDED);
 #ifdef TRACE_AX25_DL
         trace_dl("AX25[%d]: ",state->rx_channel);
-        print_decoded_packet("I-frame Send ", &event->packet);
+        print_decoded_packet("I-frame Send ", iframe);
 #endif
-        rc = tx_send_packet(&event->packet, NOT_EXPEDITED, BLOCK,
+        rc = tx_send_packet(iframe, NOT_EXPEDITED, BLOCK,
 			    MODULATION_INVALID);
         if (rc == FALSE) {
             debug_print("ERROR: Could not send I frame to TX queue. Pushing back on I-frame queue\n");
             // push iframe back on queue, wait 2/10 second for queue
             // to become available if needed
-            xStatus = xQueueSendToFront(xIFrameQueue[state->channel], event,
-                                        CENTISECONDS(20));
-            if(xStatus != pdPASS) {
+            if (!push_back_iframe(state, event->iframe, CENTISECONDS(20))) {
                 /* The send operation could not complete because the queue was full */
                 ReportError(RTOSfailure, FALSE, CharString,
                                     (int)"AX25: ERROR: Could not add packet to IFrame Queue");
@@ -1770,8 +2258,13 @@ void iframe_pops_off_queue(AX25_data_link_state_machine_t *state,
             }
             return;
         }
-        state->I_frames_sent[state->VS] = event->packet;
-        state->VS = (state->VS + 1) % MODULO;
+        /* Keep a reference to the frame, rather than a copy, until it is acked.
+         * After a REJ the slot already holds this frame from the last time it was sent */
+        slot = &state->I_frames_sent[I_FRAME_SLOT(state->VS)];
+        ax25_packet_retain(event->iframe);
+        ax25_packet_release(*slot);
+        *slot = event->iframe;
+        state->VS = AX25_MODULO(state->VS + 1, state->modulo);
         state->achnowledge_pending = false;
         /*
          * The spec says that if T1 is running we do not need to start
@@ -1779,18 +2272,36 @@ void iframe_pops_off_queue(AX25_data_link_state_machine_t *state,
          * and stops T3.  This prevents us timing out too soon.  That
          * logic seems to make sense so it is implemented here.
          */
-//        BaseType_t act = xTimerIsTimerActive(timerT1[state->channel]);
-//        if (act != pdPASS) {
-            stop_timer(timerT3[state->channel]);
-            start_timer(timerT1[state->channel]);
+//        if (!timer_active(timerT1[state->session])) {
+            stop_timer(timerT3[state->session]);
+            start_timer(timerT1[state->session]);
 //        }
     }
 }
 
+/**
+ * push_back_iframe()
+ *
+ * Put an I frame back on the front of the xIFrameQueue so it is the next
+ * one sent.  The queue takes its own reference to the frame.
+ */
+bool push_back_iframe(AX25_data_link_state_machine_t *state, AX25_PACKET_HANDLE iframe,
+                      TickType_t wait)
+{
+    ax25_packet_retain(iframe);
+    if (xQueueSendToFront(xIFrameQueue[state->session], &iframe, wait) != pdPASS) {
+        ax25_packet_release(iframe);
+        return false;
+    }
+    return true;
+}
+
 /**
  * Process a received I Frame in CONNECTED and TIMER RECOVERY states
  *
- * This assumes SREJ is not enabled.
+ * On a v2.2 connection frames that arrive after a missing one are held and
+ * the missing frame is requested with SREJ.  Otherwise they are discarded and
+ * we send REJ, so the other station goes back and sends them all again.
  */
 void process_iframe(AX25_data_link_state_machine_t *state, AX25_PACKET *packet,
                     AX25_data_link_state_t final_state)
@@ -1805,7 +2316,7 @@ void process_iframe(AX25_data_link_state_machine_t *state, AX25_PACKET *packet,
         return;
     } else {
         // Data length is invalid
-        if (packet->data_len >= AX25_MAX_INFO_BYTES_LEN) {
+        if (packet->data_len > AX25_MAX_RX_INFO_LEN) {
             ax25_send_event(state, DL_ERROR_Indicate, packet, ERROR_O);
             establish_data_link(state);
             clear_layer_3_initiated(state);
@@ -1821,7 +2332,7 @@ void process_iframe(AX25_data_link_state_machine_t *state, AX25_PACKET *packet,
                         state->response_packet.PF = 1;
                         state->response_packet.command = AX25_RESPONSE;
                         state->response_packet.NR = state->VR;
-                        ax25_send_response(state->channel, TYPE_S_RNR,
+                        ax25_send_response(state->session, TYPE_S_RNR,
                                            state->callsign,
                                            &state->response_packet,
                                            NOT_EXPEDITED);
@@ -1831,15 +2342,16 @@ void process_iframe(AX25_data_link_state_machine_t *state, AX25_PACKET *packet,
                 } else { // own receiver is not busy
                     if (packet->NS == state->VR) {
                         // We expect frame number VR and that is what we got
-                        state->VR = (state->VR + 1) % MODULO;
+                        state->VR = AX25_MODULO(state->VR + 1, state->modulo);
                         state->reject_exception = false;
                         if (state->srej_exception > 0)
                             state->srej_exception--;
-                        // Send the IFrame data to Layer 3 and store in the sent iFrame Queue
+                        // Send the IFrame data to Layer 3
                         ax25_send_event(state, DL_DATA_Indicate, packet,
                                         NO_ERROR);
-                        ax25_copy_packet(packet,
-                                         &state->I_frames_sent[packet->NS]);
+                        // Then any frames that arrived early while we waited for this one
+                        if (state->held_mask != 0)
+                            deliver_held_iframes(state);
 
                         if (packet->PF == 1) {
                             send_rr_frame(state, packet);
@@ -1847,20 +2359,46 @@ void process_iframe(AX25_data_link_state_machine_t *state, AX25_PACKET *packet,
                             return;
                         } else {
                             if (!state->achnowledge_pending) {
-                                /* LM Seize Request
-                                 *
-                                 * This requests transmission at the
-                                 * next possible opportunity.  The
+                                /* Start T2 rather than asking to
+                                 * transmit now.  More I frames may
+                                 * arrive, or Layer 3 may answer,
+                                 * before it expires.  The
                                  * ack_pending will go in the next
                                  * available packet, either an IFrame
                                  * or a dedicated RR Frame.
                                  */
                                 state->achnowledge_pending = true;
+                                state->iframes_pending = 1;
+                                start_timer(timerT2[state->session]);
+                                state->dl_state = final_state;
+                                return;
+                            } else if (++state->iframes_pending >= state->k) {
+                                /* LM Seize Request
+                                 *
+                                 * A window of frames is waiting for
+                                 * an ack, so the other station may
+                                 * have stopped sending.  Request
+                                 * transmission at the next possible
+                                 * opportunity.
+                                 */
+                                stop_timer(timerT2[state->session]);
                                 ax25_send_lm_event(state, LM_SEIZE_Request);
                                 state->dl_state = final_state;
                                 return;
                             }
                         }
+                    } else if (state->srej_enabled) {
+                        /* Keep the frame if we have room and ask for just
+                         * the missing one.  If the station polls then the
+                         * SREJ may have been lost, so ask again. */
+                        bool held = hold_iframe(state, packet);
+                        if (held && (state->srej_exception == 0 || packet->PF == 1)) {
+                            send_srej_frame(state, packet->PF & 0b1);
+                        } else if (packet->PF == 1) {
+                            send_rr_frame(state, packet);
+                        }
+                        state->dl_state = final_state;
+                        return;
                     } else { // NS does not equal VS.  Uh oh
                         if (state->reject_exception) {
                             // We already have a rejection
@@ -1871,16 +2409,13 @@ void process_iframe(AX25_data_link_state_machine_t *state, AX25_PACKET *packet,
                             state->dl_state = final_state;
                             return;
                         } else { // send a rejection
-                            // if srej was enabled, then we do that,
-                            // but it is not
-                            
                             // Discard Iframe by ignoring
                             state->reject_exception = true;
                             clear_packet(&state->response_packet);
                             state->response_packet.PF = packet->PF & 0b1;
                             state->response_packet.command = AX25_RESPONSE;
                             state->response_packet.NR = state->VR;
-                            ax25_send_response(state->channel, TYPE_S_REJ,
+                            ax25_send_response(state->session, TYPE_S_REJ,
                                                state->callsign,
                                                &state->response_packet,
                                                NOT_EXPEDITED);
@@ -1910,7 +2445,7 @@ void send_rr_frame(AX25_data_link_state_machine_t *state, AX25_PACKET *packet)
     state->response_packet.PF = 1;
     state->response_packet.command = AX25_RESPONSE;
     state->response_packet.NR = state->VR;
-    ax25_send_response(state->channel, TYPE_S_RR, state->callsign,
+    ax25_send_response(state->session, TYPE_S_RR, state->callsign,
                        &state->response_packet, NOT_EXPEDITED);
     state->achnowledge_pending = false;
 }
@@ -1936,6 +2471,7 @@ void clear_exception_conditions(AX25_data_link_state_machine_t *state)
     state->own_receiver_busy = false;
     state->reject_exception = false;
     state->srej_exception = 0;
+    state->held_mask = 0;
     state->achnowledge_pending = false;
     discard_iframe_queue(state);
 }
@@ -1951,14 +2487,14 @@ void transmit_enquiry(AX25_data_link_state_machine_t *state)
     state->response_packet.command = AX25_COMMAND;
     state->response_packet.NR = state->VR;
     if (state->own_receiver_busy) {
-        ax25_send_response(state->channel, TYPE_S_RNR, state->callsign,
+        ax25_send_response(state->session, TYPE_S_RNR, state->callsign,
                            &state->response_packet, NOT_EXPEDITED);
     } else {
-        ax25_send_response(state->channel, TYPE_S_RR, state->callsign,
+        ax25_send_response(state->session, TYPE_S_RR, state->callsign,
                            &state->response_packet, NOT_EXPEDITED);
     }
     state->achnowledge_pending = false;
-    start_timer(timerT1[state->channel]);
+    start_timer(timerT1[state->session]);
 }
 
 /**
@@ -1980,23 +2516,21 @@ void enquiry_response(AX25_data_link_state_machine_t *state,
     state->response_packet.command = AX25_RESPONSE;
     state->response_packet.PF = F;
 
-    if (packet != NULL && packet->PF == 1 && (packet->frame_type == TYPE_S_RR ||
-            packet->frame_type == TYPE_S_RNR ||
-            packet->frame_type == TYPE_I)) {
-        if (state->own_receiver_busy) {
-            ax25_send_response(state->channel, TYPE_S_RNR, state->callsign,
-                               &state->response_packet, NOT_EXPEDITED);
-            state->achnowledge_pending = false;
-            return;
-        } else {
-            // SREJ is not enabled, otherwise additional logic needed
-            // here for out of sequence frames and SREJ
-            
-            // Instead, just send RR
-        }
+    /*
+     * While Layer 3 has flow turned off every acknowledgement is an
+     * RNR, otherwise an RR sent for a pending ack would tell the other
+     * station it can send more I frames.
+     */
+    if (state->own_receiver_busy) {
+        ax25_send_response(state->session, TYPE_S_RNR, state->callsign,
+                           &state->response_packet, NOT_EXPEDITED);
+        state->achnowledge_pending = false;
+        return;
     }
+    // Out of sequence frames are requested with SREJ when they are
+    // received, so an RR with VR is the right ack here
 
-    ax25_send_response(state->channel, TYPE_S_RR, state->callsign,
+    ax25_send_response(state->session, TYPE_S_RR, state->callsign,
                        &state->response_packet, NOT_EXPEDITED);
     state->achnowledge_pending = false;
     return;
@@ -2029,7 +2563,7 @@ void enquiry_response(AX25_data_link_state_machine_t *state,
 void invoke_retransmission(AX25_data_link_state_machine_t *state, int NR)
 {
     int vs;
-    BaseType_t xStatus;
+    AX25_PACKET_HANDLE handle;
 
     //backtrack.  Put all the frames on the queue again from NR.
     //Everything before is confirmed and VA already set to NR.
@@ -2040,31 +2574,31 @@ void invoke_retransmission(AX25_data_link_state_machine_t *state, int NR)
     vs = state->VS; // VS points to next frame we will send.
     do {
         // Start with the previous frame sent and go backwards
-        vs = AX25_MODULO(vs - 1);
+        vs = AX25_MODULO(vs - 1, state->modulo);
 //        if (state->I_frames_sent[vs] != null) {
             // NS stays the same, we are re-sending the frame from before
             // but we are confirming all frames up to N(R) -1 by setting NS = VR
-          if (state->I_frames_sent[vs].NS != vs) {
+          handle = state->I_frames_sent[I_FRAME_SLOT(vs)];
+          if (handle == AX25_NO_PACKET || ax25_packet(handle)->NS != vs) {
                 // Integrity check
-                trace_dl("ERROR: I_frames_sent corrupt? Wrong I frame being retransmitted VS: %d - NS:%d\n",
-                         state->VS, state->I_frames_sent[vs].NS);
+                trace_dl("ERROR: I_frames_sent corrupt? Wrong I frame being retransmitted VS: %d\n",
+                         state->VS);
           } else {
-            send_event_buffer.rx_channel = state->channel;
-            send_event_buffer.primitive = DL_DATA_Request;
-            send_event_buffer.packet = state->I_frames_sent[vs];
-            send_event_buffer.error_num = NO_ERROR;
-            xStatus = xQueueSendToFront(xIFrameQueue[state->channel],
-                                        &send_event_buffer, CENTISECONDS(10));
-            if(xStatus != pdPASS) {
-                /* The send operation could not complete because the queue was full */
+            // The slot keeps its reference, so the frame is not copied.  It is
+            // stored in the same slot again when it is sent
+            if (!push_back_iframe(state, handle, CENTISECONDS(10))) {
+                /* The send operation could not complete because the queue was full.  The frames
+                 * after this one are already on the queue, so VS must still be rewound to match
+                 * them.  This one and those before it are sent again when T1 expires. */
                 debug_print("AX25: SERIOUS IFRAME QUEUE FULL Channel %d: Could not push back to IFrame Queue for retransmission\n",
                             state->channel);
                 ReportError(RTOSfailure, FALSE, CharString,
                                     (int)"AX25: ERROR: Could not add packet to IFrame Queue");
+                state->VS = AX25_MODULO(vs + 1, state->modulo);
                 return;
             }
 #ifdef DEBUG
-            print_decoded_packet("RETRANSMIT: ",&send_event_buffer.packet);
+            print_decoded_packet("RETRANSMIT: ",ax25_packet(handle));
 #endif
           }
         //}
@@ -2074,6 +2608,110 @@ void invoke_retransmission(AX25_data_link_state_machine_t *state, int NR)
     state->VS = NR;
 }
 
+/**
+ * selective_retransmission()
+ *
+ * The other station sent SREJ for frame NR.  Send that frame again now,
+ * with our current VR, but do not rewind VS.  The frames after it were
+ * received and are held by the other station.  If F is 1 then the SREJ also
+ * acknowledges the frames before NR.
+ */
+void selective_retransmission(AX25_data_link_state_machine_t *state,
+                              AX25_PACKET *packet)
+{
+    int nr = packet->NR;
+
+    if (packet->PF == 1)
+        acknowledge_iframes(state, nr);
+    if (nr == state->VS) {
+        // Nothing outstanding at NR, so this was just an ack
+        return;
+    }
+    AX25_PACKET_HANDLE handle = state->I_frames_sent[I_FRAME_SLOT(nr)];
+    if (handle == AX25_NO_PACKET || ax25_packet(handle)->NS != nr) {
+        // Integrity check
+        trace_dl("ERROR: I_frames_sent corrupt? Wrong I frame for SREJ NR: %d\n", nr);
+        return;
+    }
+    AX25_PACKET *frame = ax25_packet(handle);
+    frame->NR = state->VR;
+    frame->PF = 0;
+    trace_dl("AX25[%d]: SREJ resend NS: %d\n", state->channel, nr);
+    bool rc = tx_send_packet(frame, NOT_EXPEDITED, BLOCK, MODULATION_INVALID);
+    if (rc == FALSE) {
+        // T1 will expire and the frame will be sent again when the other station is polled
+        ReportError(TxPacketDropped, FALSE, CharString,
+                    (int)"AX25: ERROR: Could not queue SREJ retransmission");
+        return;
+    }
+    state->achnowledge_pending = false;
+    stop_timer(timerT3[state->session]);
+    start_timer(timerT1[state->session]);
+}
+
+/**
+ * hold_iframe()
+ *
+ * Store an I frame that arrived after a missing one, so it does not need to
+ * be sent again.  Only the SREJ_HELD_FRAMES after VR can be held.  Anything
+ * further ahead is discarded and will be sent again by the other station.
+ *
+ * Returns true if the frame is held, including if we already had it.
+ */
+bool hold_iframe(AX25_data_link_state_machine_t *state, AX25_PACKET *packet)
+{
+    int ahead = shiftByV(packet->NS, state->VR, state->modulo);
+    if (ahead == 0 || ahead >= SREJ_HELD_FRAMES || ahead >= state->k)
+        return false;
+    int slot = HELD_SLOT(packet->NS);
+    if ((state->held_mask & (1 << slot)) == 0) {
+        ax25_copy_packet(packet, &state->I_frames_held[slot]);
+        state->held_mask |= (1 << slot);
+    }
+    return true;
+}
+
+/**
+ * deliver_held_iframes()
+ *
+ * The frame at VR has been received, so pass any held frames that now follow
+ * in sequence to Layer 3.  If frames are still held then there is another gap
+ * and we ask for that frame with SREJ.
+ */
+void deliver_held_iframes(AX25_data_link_state_machine_t *state)
+{
+    int slot = HELD_SLOT(state->VR);
+    while ((state->held_mask & (1 << slot)) != 0 &&
+           state->I_frames_held[slot].NS == state->VR) {
+        ax25_send_event(state, DL_DATA_Indicate, &state->I_frames_held[slot],
+                        NO_ERROR);
+        state->held_mask &= ~(1 << slot);
+        state->VR = AX25_MODULO(state->VR + 1, state->modulo);
+        slot = HELD_SLOT(state->VR);
+    }
+    if (state->held_mask != 0)
+        send_srej_frame(state, 0);
+}
+
+/**
+ * send_srej_frame()
+ *
+ * Ask the other station to resend just the frame VR.  Only one SREJ is
+ * outstanding at a time.  With F = 1 this also acknowledges the frames
+ * before VR.
+ */
+void send_srej_frame(AX25_data_link_state_machine_t *state, int F)
+{
+    clear_packet(&state->response_packet);
+    state->response_packet.PF = F;
+    state->response_packet.command = AX25_RESPONSE;
+    state->response_packet.NR = state->VR;
+    ax25_send_response(state->session, TYPE_S_SREJ, state->callsign,
+                       &state->response_packet, NOT_EXPEDITED);
+    state->srej_exception = 1;
+    state->achnowledge_pending = false;
+}
+
 /**
  * We have received a frame with an NR that is an ack for all frames
  * up to that point.  Or rather it says "I am ready for the next
@@ -2084,22 +2722,21 @@ void check_iframes_acknowledged(AX25_data_link_state_machine_t *state,
                                 AX25_PACKET *packet)
 {
     if (state->peer_receiver_busy) {
-        state->VA = packet->NR;
+        acknowledge_iframes(state, packet->NR);
         // revised flow chart says STOP T3. But PSGS and direwold have
         // Start T3 per the old flow chart.
-        start_timer(timerT3[state->channel]);
-        BaseType_t act = xTimerIsTimerActive(timerT1[state->channel]);
-         if (act != pdPASS) {
-             start_timer(timerT1[state->channel]);
-         }
+        start_timer(timerT3[state->session]);
+        if (!timer_active(timerT1[state->session])) {
+            start_timer(timerT1[state->session]);
+        }
     } else {
         if (packet->NR == state->VS) {
             // essentially this is an RR and NR is the next frame for
             // us - normal situation
-            state->VA = packet->NR;
-            stop_timer(timerT1[state->channel]);
-            start_timer(timerT3[state->channel]);
-            // Here we would  Select T1 Value
+            acknowledge_iframes(state, packet->NR);
+            stop_timer(timerT1[state->session]);
+            start_timer(timerT3[state->session]);
+            select_t1_value(state);
         } else {
             // then not all frames ACK'd
             if (packet->NR != state->VA) {
@@ -2107,8 +2744,8 @@ void check_iframes_acknowledged(AX25_data_link_state_machine_t *state,
                 // but not all.  Set the ack variable VA to the number
                 // we received.  Start T1 as we don't want to send any
                 // more data yet.
-                state->VA = packet->NR;
-                start_timer(timerT1[state->channel]);
+                acknowledge_iframes(state, packet->NR);
+                start_timer(timerT1[state->session]);
             }
             // otherwise the RR had an NR equal to the VA we already
             // have.  A second confirmation of where we are but if our
@@ -2124,12 +2761,13 @@ void establish_data_link(AX25_data_link_state_machine_t *state)
     state->RC = 1;
     clear_packet(&state->response_packet);
     state->response_packet.PF = 1;
-    // send SABM
-    ax25_send_response(state->channel, TYPE_U_SABM, state->callsign,
-                       &state->response_packet, NOT_EXPEDITED);
+    // send SABM, or SABME to keep a v2.2 connection at MOD 128
+    ax25_send_response(state->session,
+                       state->version == version_2_2 ? TYPE_U_SABME : TYPE_U_SABM,
+                       state->callsign, &state->response_packet, NOT_EXPEDITED);
 
-    stop_timer(timerT3[state->channel]);
-    start_timer(timerT1[state->channel]);
+    stop_timer(timerT3[state->session]);
+    start_timer(timerT1[state->session]);
 }
 
 /**
@@ -2138,16 +2776,49 @@ void establish_data_link(AX25_data_link_state_machine_t *state)
  */
 void discard_iframe_queue(AX25_data_link_state_machine_t *state)
 {
-    BaseType_t xStatus;
+    AX25_PACKET_HANDLE handle;
+
+    /* Each frame on the queue holds a reference, so drain it rather than
+     * resetting it.  The link is being reset, so the frames awaiting an
+     * ack go too. */
+    while (xQueueReceive(xIFrameQueue[state->session], &handle, 0) == pdPASS)
+        ax25_packet_release(handle);
+    release_iframes_sent(state);
+}
 
-    xStatus = xQueueReset(xIFrameQueue[state->channel]);
-    if(xStatus != pdPASS) {
-        /* The reset operation could not complete because something is
-         * blocking the queue.  It does not look like this can
-         * actually happen.  The underlying function only ever returns
-         * pdPASS.  If this error message shows up in testing we can
-         * work out how to handle it. */
-        debug_print("AX25: SERIOUS ERROR: Could not reset the IFrame Queue\n");
+/**
+ * acknowledge_iframes()
+ *
+ * Set VA to NR and release the frames that are now acknowledged, VA
+ * through NR - 1, back to the packet pool.  The NS check stops us
+ * releasing a frame in a slot that has been reused for a newer frame.
+ */
+void acknowledge_iframes(AX25_data_link_state_machine_t *state, int nr)
+{
+    AX25_PACKET_HANDLE *slot;
+
+    while (state->VA != nr) {
+        slot = &state->I_frames_sent[I_FRAME_SLOT(state->VA)];
+        if (*slot != AX25_NO_PACKET && ax25_packet(*slot)->NS == state->VA) {
+            ax25_packet_release(*slot);
+            *slot = AX25_NO_PACKET;
+        }
+        state->VA = AX25_MODULO(state->VA + 1, state->modulo);
+    }
+}
+
+/**
+ * release_iframes_sent()
+ *
+ * Release every frame awaiting an ack back to the packet pool.
+ */
+void release_iframes_sent(AX25_data_link_state_machine_t *state)
+{
+    int i;
+
+    for (i = 0; i < I_FRAMES_SENT_LEN; i++) {
+        ax25_packet_release(state->I_frames_sent[i]);
+        state->I_frames_sent[i] = AX25_NO_PACKET;
     }
 }
 
@@ -2161,6 +2832,160 @@ void check_need_for_response(AX25_data_link_state_machine_t *state,
     }
 }
 
+/**
+ * own_receiver_flow_off()
+ *
+ * Layer 3 can not keep up with the I frames, so tell the other station
+ * we are busy with an RNR.  Any I frames received while busy are
+ * discarded and are sent again after the flow is turned back on.
+ */
+void own_receiver_flow_off(AX25_data_link_state_machine_t *state)
+{
+    if (state->own_receiver_busy) return;
+    state->own_receiver_busy = true;
+    clear_packet(&state->response_packet);
+    state->response_packet.PF = 0;
+    state->response_packet.command = AX25_RESPONSE;
+    state->response_packet.NR = state->VR;
+    ax25_send_response(state->session, TYPE_S_RNR, state->callsign,
+                       &state->response_packet, EXPEDITED);
+    state->achnowledge_pending = false;
+}
+
+/**
+ * own_receiver_flow_on()
+ *
+ * Layer 3 has caught up.  Poll the other station with an RR so it
+ * knows we are ready and tells us where to restart.
+ */
+void own_receiver_flow_on(AX25_data_link_state_machine_t *state)
+{
+    if (!state->own_receiver_busy) return;
+    state->own_receiver_busy = false;
+    clear_packet(&state->response_packet);
+    state->response_packet.PF = 1;
+    state->response_packet.command = AX25_COMMAND;
+    state->response_packet.NR = state->VR;
+    ax25_send_response(state->session, TYPE_S_RR, state->callsign,
+                       &state->response_packet, EXPEDITED);
+    state->achnowledge_pending = false;
+    if (!timer_active(timerT1[state->session])) {
+        stop_timer(timerT3[state->session]);
+        start_timer(timerT1[state->session]);
+    }
+}
+
+/**
+ * set_version_2_0()
+ *
+ * A SABM was received, or a station did not accept our SABME.  Use MOD 8
+ * sequence numbers and the standard window.
+ */
+void set_version_2_0(AX25_data_link_state_machine_t *state)
+{
+    state->version = version_2_0;
+    state->modulo = MODULO;
+    state->k = K;
+    state->srej_enabled = false;
+    state->n1 = AX25_MAX_INFO_BYTES_LEN;
+    seed_t1_value(state);
+}
+
+/**
+ * set_version_2_2()
+ *
+ * A SABME was received.  Use MOD 128 sequence numbers, which allows
+ * a larger window so a station with a long round trip time can keep
+ * sending while it waits for the acks.
+ */
+void set_version_2_2(AX25_data_link_state_machine_t *state)
+{
+    state->version = version_2_2;
+    state->modulo = MODULO_EXTENDED;
+    state->k = K_EXTENDED;
+    state->srej_enabled = true;
+    state->n1 = AX25_MAX_INFO_BYTES_LEN;
+    seed_t1_value(state);
+}
+
+/**
+ * process_xid()
+ *
+ * The other station sent XID with the parameters it wants for this
+ * connection.  It tells us the largest I field and the window it can
+ * receive, so we use the smaller of those and what our buffers allow.
+ * T1 is the larger of ours and the one it asks for, up to
+ * AX25_TIMER_T1_MAX_PERIOD.  The modulo was set by SABM or SABME and
+ * does not change.  A command is answered with the values we will use.
+ */
+void process_xid(AX25_data_link_state_machine_t *state, AX25_PACKET *packet)
+{
+    AX25_XID xid;
+    int max_k = (state->modulo == MODULO_EXTENDED) ? I_FRAMES_SENT_LEN : MODULO - 1;
+
+    if (!ax25_decode_xid(packet->data, packet->data_len, &xid)) {
+        trace_dl("AX25[%d]: Invalid XID parameters ignored\n", state->channel);
+    } else {
+        if (xid.n1_rx != 0)
+            state->n1 = (xid.n1_rx < AX25_MAX_INFO_BYTES_LEN) ? xid.n1_rx : AX25_MAX_INFO_BYTES_LEN;
+        if (xid.k_rx != 0)
+            state->k = (xid.k_rx < max_k) ? xid.k_rx : max_k;
+        if (xid.hdlc_present && !(xid.hdlc_functions & XID_HDLC_SREJ))
+            state->srej_enabled = false;
+        if (xid.t1_ms != 0) {
+            int ticks = xid.t1_ms / portTICK_RATE_MS;
+            if (ticks < AX25_TIMER_T1_PERIOD)
+                ticks = AX25_TIMER_T1_PERIOD;
+            if (ticks > AX25_TIMER_T1_MAX_PERIOD)
+                ticks = AX25_TIMER_T1_MAX_PERIOD;
+            if (ticks != state->T1VInTicks) {
+                state->T1VInTicks = ticks;
+                set_t1_period(state);
+            }
+            // Measured round trip times then adjust T1 from here
+            state->SRTInTicks = ticks / 2;
+        }
+        trace_dl("AX25[%d]: XID N1:%d k:%d T1:%dms SREJ:%d\n", state->channel, state->n1,
+                 state->k, state->T1VInTicks * portTICK_RATE_MS, state->srej_enabled);
+    }
+    if (packet->command == AX25_COMMAND) {
+        xid.hdlc_present = true;
+        xid.hdlc_functions = XID_HDLC_REJ | XID_HDLC_EXTENDED_ADDRESS
+                | XID_HDLC_16_BIT_FCS | XID_HDLC_SYNCHRONOUS_TX;
+        if (state->srej_enabled)
+            xid.hdlc_functions |= XID_HDLC_SREJ;
+        if (state->modulo == MODULO_EXTENDED)
+            xid.hdlc_functions |= XID_HDLC_MODULO_128;
+        else
+            xid.hdlc_functions |= XID_HDLC_MODULO_8;
+        xid.n1_rx = AX25_MAX_RX_INFO_LEN;
+        xid.k_rx = state->k;
+        xid.t1_ms = state->T1VInTicks * portTICK_RATE_MS;
+        clear_packet(&state->response_packet);
+        state->response_packet.PF = packet->PF & 0b1;
+        state->response_packet.command = AX25_RESPONSE;
+        state->response_packet.data_len = ax25_encode_xid(&xid, state->response_packet.data,
+                                                          sizeof(state->response_packet.data));
+        ax25_send_response(state->session, TYPE_U_XID, state->callsign,
+                           &state->response_packet, NOT_EXPEDITED);
+    }
+}
+
+/**
+ * set_t1_period()
+ *
+ * Change the period of T1 to T1VInTicks.  If T1 is running it starts
+ * again with the new period.
+ */
+void set_t1_period(AX25_data_link_state_machine_t *state)
+{
+    ax25_timer_t timer = timerT1[state->session];
+
+    ax25_timers.timers[timer].period = state->T1VInTicks;
+    if (timer_active(timer))
+        wheel_start(&ax25_timers, timer, xTaskGetTickCount());
+}
+
 void ui_check(AX25_data_link_state_machine_t *state, AX25_PACKET *packet)
 {
     if (packet->command == AX25_COMMAND) {
@@ -2177,16 +3002,21 @@ void ui_check(AX25_data_link_state_machine_t *state, AX25_PACKET *packet)
 /**
  * select_t1_value()
  *
- * This calculates the value in RTOS Ticks.  However, it is currently
- * not used.  A dynamic time for T1 is used in AX25 to cope with
- * Digipeters in the path.  That is not currently in scope for
- * PACSAT. If we decide that digipeter paths via one or more
- * spacecraft will be supported in some way, then this may need to be
- * implemented.
+ * This calculates the value in RTOS Ticks.  A dynamic time for T1 is
+ * used in AX25 to cope with Digipeters in the path.  For PACSAT it
+ * follows the round trip time to each station, which depends on its
+ * TNC and how busy our transmitter is, so a station with a fast
+ * turnaround gets its retries sooner.
  *
- * Here are implementation notes from DireWolf.  This is not adopted
- * here, but these notes are left in case we implement in the future.
- * They come from this file:
+ * FreeRTOS can not tell us the time left on a timer, so
+ * start_timer() notes the tick count when T1 starts and stop_timer()
+ * saves how long it ran.  That is -1 if T1 was not running, which is
+ * the fix WB2OSZ describes below.  As in TCP (Karn's algorithm) only
+ * frames that were not retried give a sample, as we do not know which
+ * copy was acked.  A sample also updates the round trip time cache,
+ * which seed_t1_value() uses when the station connects again.
+ *
+ * Here are implementation notes from DireWolf.  They come from this file:
  * https://github.com/wb2osz/direwolf/blob/master/src/ax25_link.c
  *
  * WB2OSZ says:
@@ -2229,18 +3059,102 @@ void ui_check(AX25_data_link_state_machine_t *state, AX25_PACKET *packet)
  * I increase the time linearly by a fraction of a second.
  */
 void select_t1_value(AX25_data_link_state_machine_t *state) {
+    int t1v = state->T1VInTicks;
+
     if (state->RC == 0) {
-        state->SRTInTicks = (7 * state->SRTInTicks / 8 +
-                             AX25_TIMER_T1_PERIOD / 8 -
-                             state->T1TimeWhenLastStoppedInTicks / 8);
-        state->T1VInTicks = state->SRTInTicks * 2;
-    } else {
-        BaseType_t act = xTimerIsTimerActive(timerT1[state->channel]);
-        if (act != pdPASS) {
-            // Expired
-            state->T1VInTicks = (int)(state->RC / 4 + state->SRTInTicks * 2);
+        if (state->T1ElapsedWhenStoppedInTicks >= 0) {
+            state->SRTInTicks = (7 * state->SRTInTicks +
+                                 state->T1ElapsedWhenStoppedInTicks) / 8;
+            t1v = state->SRTInTicks * 2;
+            ax25_rtt_cache_update(state);
+        }
+    } else if (!timer_active(timerT1[state->session]) && state->T1ElapsedWhenStoppedInTicks < 0) {
+        // Expired.  Add a quarter of a second for each retry
+        t1v = state->RC * SECONDS(1) / 4 + state->SRTInTicks * 2;
+    }
+    state->T1ElapsedWhenStoppedInTicks = -1;
+
+    if (t1v < AX25_TIMER_T1_MIN_PERIOD)
+        t1v = AX25_TIMER_T1_MIN_PERIOD;
+    if (t1v > AX25_TIMER_T1_MAX_PERIOD)
+        t1v = AX25_TIMER_T1_MAX_PERIOD;
+    if (t1v != state->T1VInTicks) {
+        trace_dl("AX25[%d]: SRT:%dms T1:%dms\n", state->channel,
+                 state->SRTInTicks * portTICK_RATE_MS, t1v * portTICK_RATE_MS);
+        state->T1VInTicks = t1v;
+        set_t1_period(state);
+    }
+}
+
+/**
+ * seed_t1_value()
+ *
+ * Called when a connection starts.  If the station was connected
+ * within AX25_RTT_CACHE_MAX_AGE, which is about one pass, then start
+ * from the round trip time we measured, otherwise from the default T1.
+ * Older entries are cleared so the cache only holds this pass.
+ */
+void seed_t1_value(AX25_data_link_state_machine_t *state)
+{
+    TickType_t now = xTaskGetTickCount();
+    int t1v = AX25_TIMER_T1_PERIOD;
+    int i;
+
+    state->SRTInTicks = AX25_TIMER_T1_PERIOD / 2;
+    state->T1ElapsedWhenStoppedInTicks = -1;
+    for (i = 0; i < AX25_RTT_CACHE_LEN; i++) {
+        if (ax25_rtt_cache[i].callsign[0] == 0)
+            continue;
+        if ((TickType_t)(now - ax25_rtt_cache[i].updated) > AX25_RTT_CACHE_MAX_AGE) {
+            ax25_rtt_cache[i].callsign[0] = 0;
+        } else if (state->callsign[0] != 0
+                && strcasecmp(ax25_rtt_cache[i].callsign, state->callsign) == 0) {
+            state->SRTInTicks = ax25_rtt_cache[i].SRTInTicks;
+            t1v = state->SRTInTicks * 2;
+            if (t1v < AX25_TIMER_T1_MIN_PERIOD)
+                t1v = AX25_TIMER_T1_MIN_PERIOD;
+            if (t1v > AX25_TIMER_T1_MAX_PERIOD)
+                t1v = AX25_TIMER_T1_MAX_PERIOD;
+            trace_dl("AX25[%d]: %s SRT:%dms from earlier connection\n", state->channel,
+                     state->callsign, state->SRTInTicks * portTICK_RATE_MS);
         }
     }
+    if (t1v != state->T1VInTicks) {
+        state->T1VInTicks = t1v;
+        set_t1_period(state);
+    }
+}
+
+/**
+ * ax25_rtt_cache_update()
+ *
+ * Save the smoothed round trip time for the station on this connection.
+ * If it is not in the cache then it replaces an empty entry or the one
+ * that was updated longest ago.
+ */
+void ax25_rtt_cache_update(AX25_data_link_state_machine_t *state)
+{
+    TickType_t now = xTaskGetTickCount();
+    int i, slot = 0;
+
+    if (state->callsign[0] == 0)
+        return;
+    for (i = 0; i < AX25_RTT_CACHE_LEN; i++) {
+        if (ax25_rtt_cache[i].callsign[0] != 0
+                && strcasecmp(ax25_rtt_cache[i].callsign, state->callsign) == 0) {
+            slot = i;
+            break;
+        }
+        if (ax25_rtt_cache[slot].callsign[0] == 0)
+            continue; // keep the empty entry we already found
+        if (ax25_rtt_cache[i].callsign[0] == 0
+                || (TickType_t)(now - ax25_rtt_cache[i].updated) >
+                   (TickType_t)(now - ax25_rtt_cache[slot].updated))
+            slot = i;
+    }
+    strlcpy(ax25_rtt_cache[slot].callsign, state->callsign, MAX_CALLSIGN_LEN);
+    ax25_rtt_cache[slot].SRTInTicks = state->SRTInTicks;
+    ax25_rtt_cache[slot].updated = now;
 }
 
 /**
@@ -2271,9 +3185,9 @@ void set_layer_3_initiated(AX25_data_link_state_machine_t *state)
  */
 bool VA_lte_NR_lte_VS(AX25_data_link_state_machine_t *state, int nr)
 {
-    int shiftedVa = shiftByV(state->VA, state->VA);
-    int shiftedNr = shiftByV(nr, state->VA);
-    int shiftedVs = shiftByV(state->VS, state->VA);
+    int shiftedVa = shiftByV(state->VA, state->VA, state->modulo);
+    int shiftedNr = shiftByV(nr, state->VA, state->modulo);
+    int shiftedVs = shiftByV(state->VS, state->VA, state->modulo);
 
 //    trace_dl("AX25 Good NR? V(a) <= N(r) <= V(s) VA:%d NR: %d VS: %d\n",state->VA, nr, state->VS); // + " sVA:"+shiftedVa+" sNR:"+shiftedNr+" sVS:"+shiftedVs);
 
@@ -2283,13 +3197,13 @@ bool VA_lte_NR_lte_VS(AX25_data_link_state_machine_t *state, int nr)
 /**
  * Shift by VA or VR depending on what you pass in
  */
-int shiftByV(int x, int VA) {
-    return (x - VA) & (MODULO - 1);
+int shiftByV(int x, int VA, int modulo) {
+    return (x - VA) & (modulo - 1);
 }
 
-int AX25_MODULO(int vs) {
+int AX25_MODULO(int vs, int modulo) {
     // uses masking rather than % so that negative numbers handled correctly
-    return (vs & (MODULO - 1));
+    return (vs & (modulo - 1));
 }
 
 
@@ -2301,14 +3215,26 @@ int AX25_MODULO(int vs) {
 bool test_ax25_retransmission() {
     debug_print("## SELF TEST: ax25 retransmission for NR 6\n");
 
+    /* This uses the I frame queue of the first session and empties it at the end, so it must
+     * not run while that session has a station connected or frames waiting to be sent. */
+    if (data_link_state_machine[0].dl_state != DISCONNECTED || uxQueueMessagesWaiting(xIFrameQueue[0]) != 0) {
+        debug_print("## FAILED SELF TEST: session 0 is in use, disconnect it first\n");
+        return FALSE;
+    }
+
     in_test = TRUE;
     AX25_data_link_state_machine_t dl;
+    dl.session = 0;
     dl.channel = FIRST_RX_CHANNEL;
+    dl.callsign[0] = 0; // not in the round trip time cache
+    dl.T1VInTicks = AX25_TIMER_T1_PERIOD; // so the real T1 timer is not changed
+    set_version_2_0(&dl);
     dl.VA = 7;
     dl.VS = 0;
     dl.VR = 2;
 
     AX25_event_t send_event;
+    send_event.session = dl.session;
     send_event.rx_channel = dl.channel;
     send_event.packet.frame_type = TYPE_I;
     send_event.packet.PF = 0;
@@ -2317,17 +3243,228 @@ bool test_ax25_retransmission() {
     send_event.primitive = DL_DATA_Request;
 
     int n = 0;
+    for (n=0; n<I_FRAMES_SENT_LEN; n++)
+        dl.I_frames_sent[n] = AX25_NO_PACKET;
     for (n=0; n<8;n++) {
         send_event.packet.NR = 2;
         send_event.packet.NS = n;
-        ax25_copy_packet(&send_event.packet, &dl.I_frames_sent[n]);
+        dl.I_frames_sent[n] = ax25_packet_alloc();
+        if (dl.I_frames_sent[n] == AX25_NO_PACKET) {
+            debug_print("## FAILED SELF TEST: packet pool empty\n");
+            discard_iframe_queue(&dl);
+            in_test = FALSE;
+            return FALSE;
+        }
+        ax25_copy_packet(&send_event.packet, ax25_packet(dl.I_frames_sent[n]));
     }
 
     invoke_retransmission(&dl, 6);
+    /* Frames 6 and 7 are now on the queue and also still in their slots */
+    if (ax25_packet_refs[dl.I_frames_sent[6] - 1] != 2 || ax25_packet_refs[dl.I_frames_sent[5] - 1] != 1) {
+        debug_print("## FAILED SELF TEST: wrong packet pool references after retransmission\n");
+        discard_iframe_queue(&dl);
+        in_test = FALSE;
+        return FALSE;
+    }
+    /* Return the frames to the pool */
+    discard_iframe_queue(&dl);
+
+    /* A whole v2.2 window sent again behind a full backlog of new frames */
+    set_version_2_2(&dl);
+    dl.VA = 120;
+    dl.VS = AX25_MODULO(dl.VA + K_EXTENDED, dl.modulo);
+    AX25_PACKET_HANDLE handle;
+    for (n=0; n<IFRAME_QUEUE_BACKLOG + K_EXTENDED; n++) {
+        handle = ax25_packet_alloc();
+        if (handle == AX25_NO_PACKET) {
+            debug_print("## FAILED SELF TEST: packet pool empty\n");
+            discard_iframe_queue(&dl);
+            in_test = FALSE;
+            return FALSE;
+        }
+        send_event.packet.NS = AX25_MODULO(dl.VA + n - IFRAME_QUEUE_BACKLOG, dl.modulo);
+        ax25_copy_packet(&send_event.packet, ax25_packet(handle));
+        if (n < IFRAME_QUEUE_BACKLOG) {
+            /* New frames waiting to be sent, which have no NS yet */
+            xQueueSendToBack(xIFrameQueue[dl.session], &handle, 0);
+        } else {
+            dl.I_frames_sent[I_FRAME_SLOT(send_event.packet.NS)] = handle;
+        }
+    }
+    invoke_retransmission(&dl, dl.VA);
+    if (dl.VS != dl.VA || uxQueueMessagesWaiting(xIFrameQueue[dl.session]) != IFRAME_QUEUE_BACKLOG + K_EXTENDED
+            || xQueuePeek(xIFrameQueue[dl.session], &handle, 0) != pdPASS || ax25_packet(handle)->NS != dl.VA) {
+        debug_print("## FAILED SELF TEST: full window not queued for retransmission, VS %d\n", dl.VS);
+        discard_iframe_queue(&dl);
+        in_test = FALSE;
+        return FALSE;
+    }
+    discard_iframe_queue(&dl);
     debug_print("## PASSED SELF TEST: test retransmission\n");
 
     in_test = FALSE;
     return TRUE;
 }
 
+/**
+ * test_ax25_goodput()
+ *
+ * Model an upload of a number of full length I frames and return the goodput in
+ * bytes per second.  The station sends up to k frames and then waits one round trip
+ * for the ack.  With REJ a lost frame means it and the frames after it are sent again.
+ * With SREJ the frames after it are held, up to SREJ_HELD_FRAMES, so only the lost
+ * frames and any we could not hold are sent again.  If the whole window is lost the
+ * station waits for T1 and polls.  This is a model of the link rather than of this
+ * state machine, but it shows what the window and SREJ are worth when the round trip
+ * time is long.  The losses come from a fixed seed so the runs can be compared.  The
+ * number of frames transmitted, which is the airtime used, is returned in sent.
+ */
+static int test_ax25_goodput(int k, bool srej, int frames, int frame_ms, int rtt_ms,
+                             int loss_pct, int *sent)
+{
+    uint32_t seed = 12345;
+    uint32_t time_ms = 0;
+    int acked = 0;
+
+    *sent = 0;
+    while (acked < frames) {
+        int n = k;
+        if (n > frames - acked)
+            n = frames - acked;
+        int first_loss = n;
+        int received = 0; // frames that the receiver can keep
+        bool any_received = false;
+        int i;
+        for (i = 0; i < n; i++) {
+            seed = seed * 1103515245 + 12345;
+            if (((seed >> 16) % 100) < loss_pct) {
+                if (first_loss == n)
+                    first_loss = i;
+            } else {
+                any_received = true;
+                if (i < first_loss || (srej && i - first_loss < SREJ_HELD_FRAMES))
+                    received++;
+            }
+        }
+        *sent += n;
+        time_ms += n * frame_ms;
+        time_ms += any_received ? rtt_ms : AX25_TIMER_T1_PERIOD * portTICK_RATE_MS;
+        acked += srej ? received : first_loss;
+    }
+    return (int)((uint32_t)frames * AX25_MAX_INFO_BYTES_LEN * 1000 / time_ms);
+}
+
+bool test_ax25_window_goodput() {
+    debug_print("## SELF TEST: ax25 goodput v window size, REJ and SREJ\n");
+    const int windows[] = {K, 8, K_EXTENDED, 32};
+    const int losses[] = {0, 2, 10};
+    const int frames = 200;
+    const int rtt_ms = 400;
+    /* Full frame plus addresses, flags and CRC at 9600 bps */
+    const int frame_ms = (AX25_MAX_INFO_BYTES_LEN + 24) * 8 * 1000 / 9600;
+    bool rc = TRUE;
+    int l, w;
+
+    int sent, srej_sent;
+
+    for (l = 0; l < sizeof(losses)/sizeof(losses[0]); l++) {
+        debug_print("RTT %dms loss %d%%:\n", rtt_ms, losses[l]);
+        for (w = 0; w < sizeof(windows)/sizeof(windows[0]); w++) {
+            int rej = test_ax25_goodput(windows[w], false, frames, frame_ms, rtt_ms, losses[l], &sent);
+            int srej = test_ax25_goodput(windows[w], true, frames, frame_ms, rtt_ms, losses[l], &srej_sent);
+            debug_print("  k=%d REJ %d B/s %d frames, SREJ %d B/s %d frames\n",
+                        windows[w], rej, sent, srej, srej_sent);
+            if (srej_sent > sent) {
+                debug_print("** SREJ used more airtime than REJ\n");
+                rc = FALSE;
+            }
+        }
+        if (losses[l] <= 2 &&
+                test_ax25_goodput(K_EXTENDED, false, frames, frame_ms, rtt_ms, losses[l], &sent) <
+                test_ax25_goodput(K, false, frames, frame_ms, rtt_ms, losses[l], &sent)) {
+            debug_print("** Window %d is slower than window %d\n", K_EXTENDED, K);
+            rc = FALSE;
+        }
+    }
+    if (rc)
+        debug_print("## PASSED SELF TEST: ax25 goodput v window size\n");
+    else
+        debug_print("## FAILED SELF TEST: ax25 goodput v window size\n");
+    return rc;
+}
+
+/**
+ * test_ax25_timer_wheel()
+ *
+ * Check a test wheel, turned by hand, against the link timer periods.
+ * Each timer must expire within one wheel tick after its period and a
+ * stopped timer must not expire.  Then time starts and stops to give
+ * the timer work for a frame, which is about two starts and two stops:
+ * T1 and T3 swap when an I frame is sent and swap back on the ack.
+ */
+bool test_ax25_timer_wheel() {
+    debug_print("## SELF TEST: ax25 timer wheel\n");
+    static ax25_timer_wheel_t wheel; /* Not the Ax25Task wheel, which it turns */
+    const TickType_t periods[] = {AX25_TIMER_T1_PERIOD, AX25_TIMER_T1_MAX_PERIOD,
+                                  AX25_TIMER_T2_PERIOD, AX25_TIMER_T3_PERIOD, 1};
+    const int num = sizeof(periods)/sizeof(periods[0]);
+    const TickType_t start = 3; /* Part way through a wheel tick */
+    const int loops = 10000;
+    TickType_t expired_at[sizeof(periods)/sizeof(periods[0])];
+    TickType_t now, begin, ticks;
+    bool rc = TRUE;
+    int i;
+
+    wheel_init(&wheel, 0);
+    for (i = 0; i < num; i++) {
+        wheel.timers[i].period = periods[i];
+        wheel_start(&wheel, i, start);
+        expired_at[i] = 0;
+    }
+    wheel.timers[num].period = AX25_TIMER_T1_PERIOD;
+    wheel_start(&wheel, num, start);
+    for (now = start; now < start + AX25_TIMER_T3_PERIOD + 2 * AX25_TIMER_WHEEL_TICK; now++) {
+        wheel_advance(&wheel, now);
+        if (now == start + AX25_TIMER_T2_PERIOD)
+            wheel_stop(&wheel, num);
+        for (i = 0; i <= num; i++) {
+            if (wheel.expired & (1UL << i)) {
+                wheel.expired &= ~(1UL << i);
+                if (i == num) {
+                    debug_print("** Stopped timer expired at %d\n", now);
+                    rc = FALSE;
+                } else {
+                    expired_at[i] = now;
+                }
+            }
+        }
+    }
+    for (i = 0; i < num; i++) {
+        if (expired_at[i] < start + periods[i] || expired_at[i] > start + periods[i] + AX25_TIMER_WHEEL_TICK) {
+            debug_print("** Timer %d period %d started at %d expired at %d\n", i, periods[i], start, expired_at[i]);
+            rc = FALSE;
+        }
+    }
+
+    /* Time the start and stop of T1 and T3 that go with each frame */
+    wheel.timers[0].period = AX25_TIMER_T1_PERIOD;
+    wheel.timers[1].period = AX25_TIMER_T3_PERIOD;
+    begin = xTaskGetTickCount();
+    for (i = 0; i < loops; i++) {
+        wheel_stop(&wheel, 1);
+        wheel_start(&wheel, 0, wheel.time);
+        wheel_stop(&wheel, 0);
+        wheel_start(&wheel, 1, wheel.time);
+    }
+    ticks = xTaskGetTickCount() - begin;
+    debug_print("Timer work per frame: 4 operations in %d ns\n",
+                (int)(ticks * portTICK_RATE_MS * 1000 / (loops / 1000)));
+
+    if (rc)
+        debug_print("## PASSED SELF TEST: ax25 timer wheel\n");
+    else
+        debug_print("## FAILED SELF TEST: ax25 timer wheel\n");
+    return rc;
+}
+
 #endif
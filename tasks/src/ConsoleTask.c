@@ -192,6 +192,10 @@ enum {
     makeTxtQueFile,
     sendUplinkStatus,
     testRetransmission,
+    testWindow,
+    testTimerWheel,
+    testTxPriority,
+    testFx25,
     testUploadTable,
     listUploadTable,
     telem0,
@@ -422,6 +426,18 @@ const commandPairs debugCommands[] = {
     { "test retransmission",
       "Test the AX25 I frame retransmission",
       testRetransmission},
+    { "test window",
+      "Model the AX25 upload goodput for each window size",
+      testWindow},
+    { "test timers",
+      "Test the AX25 timer wheel and time the timer work per frame",
+      testTimerWheel},
+    { "test tx priority",
+      "Test the TX queue priority with the PB saturated",
+      testTxPriority},
+    { "test fx25",
+      "Test the FX.25 encoder against reference code words",
+      testFx25},
     { "test upload table",
       "Test the storage of Upload records in the MRAM table",
       testUploadTable},
@@ -487,7 +503,7 @@ const commandPairs commonCommands[] = {
     { "mod",
       "Get/set the radio to 1200 bps AFSK or 9600 GMSK",
       Modulation,
-      "[<chan> [1200|9600|1200fec|9600fec|19200fec|25kfec|50kfec|100kfec]]",
+      "[<chan> [1200|9600|1200fec|9600fec|1200fx25|9600fx25|19200fec|25kfec|50kfec|100kfec]]",
     },
     { "mount fs",
       "Mount the filesystem",
@@ -1883,6 +1899,10 @@ void RealConsoleTask(void)
                 debug_print("### Packet Decode TEST FAILED\n");
                 break;
             }
+            if (!test_ax25_util_fx25()) {
+                debug_print("### FX25 encode TEST FAILED\n");
+                break;
+            }
             if (! pb_test_list()) {
                 debug_print("### pb list TEST FAILED.  ** was PB Enabled?? Use 'open pb' to enable it ** \n");
                 break;
@@ -2000,6 +2020,26 @@ void RealConsoleTask(void)
             break;
         }
 
+        case testWindow: {
+            bool rc = test_ax25_window_goodput();
+            break;
+        }
+
+        case testTimerWheel: {
+            bool rc = test_ax25_timer_wheel();
+            break;
+        }
+
+        case testTxPriority: {
+            bool rc = test_tx_priority();
+            break;
+        }
+
+        case testFx25: {
+            bool rc = test_ax25_util_fx25();
+            break;
+        }
+
         case testUploadTable: {
             bool rc = test_ftl0_upload_table();
             break;
@@ -2362,6 +2402,8 @@ void RealConsoleTask(void)
                 mod = MODULATION_AFSK_1200;
             } else if (strcmp(modstr, "1200fec") == 0) {
                 mod = MODULATION_AFSK_1200_FEC;
+            } else if (strcmp(modstr, "1200fx25") == 0) {
+                mod = MODULATION_AFSK_1200_FX25;
             } else if (strcmp(modstr, "2400fec") == 0) {
                 mod = MODULATION_MSK_2400_FEC;
             } else if (strcmp(modstr, "4800fec") == 0) {
@@ -2370,6 +2412,8 @@ void RealConsoleTask(void)
                 mod = MODULATION_GMSK_9600;
             } else if (strcmp(modstr, "9600fec") == 0) {
                 mod = MODULATION_GMSK_9600_FEC;
+            } else if (strcmp(modstr, "9600fx25") == 0) {
+                mod = MODULATION_GMSK_9600_FX25;
             } else if (strcmp(modstr, "19200fec") == 0) {
                 mod = MODULATION_MSK_19200_FEC;
             } else if (strcmp(modstr, "25kfec") == 0) {
@@ -2379,7 +2423,7 @@ void RealConsoleTask(void)
             } else if (strcmp(modstr, "100kfec") == 0) {
                 mod = MODULATION_MSK_100K_FEC;
             } else {
-                printf("Invalid modulation %s, must be 1200, 1200fec, 9600, 9600fec, 19200fec, 25kfec, 50kfec, or 100kfec.\n",
+                printf("Invalid modulation %s, must be 1200, 1200fec, 1200fx25, 9600, 9600fec, 9600fx25, 19200fec, 25kfec, 50kfec, or 100kfec.\n",
                        modstr);
                 break;
             }
@@ -2394,6 +2438,7 @@ void RealConsoleTask(void)
                  * doesn't change while transmitting.
                  */
                 tx_modulation = mod;
+                ax25_set_tx_modulation(mod);
             } else if (rxing(chan)) {
                 start_rx(chan, DCTFreq[chan], DCTModulation[chan]);
             }
@@ -91,6 +91,7 @@ When we store data in a value or structure internally we need to convert it to b
 #include "command_handler.h"
 #include "TMS570Hardware.h"
 #include "crc16.h"
+#include "TelemAndControlTask.h"
 #ifdef DEBUG
 #include "time.h" // large file, not needed for flight
 #endif
@@ -217,7 +218,7 @@ int pb_send_ok(char *from_callsign) {
     int len = 3 + strlen(from_callsign);
     buffer[len] = 0x0D; // this replaces the string termination
     rc = tx_send_ui_packet(BROADCAST_CALLSIGN, from_callsign, PID_FILE,
-			   (uint8_t *)buffer, len, BLOCK,
+			   (uint8_t *)buffer, len, TX_CLASS_PB, BLOCK,
 			   MODULATION_INVALID);
     taskYIELD();
     return rc;
@@ -245,7 +246,7 @@ int pb_send_err(char *from_callsign, int err) {
     strlcat(buffer, from_callsign, sizeof(buffer));
     strncat(buffer,&CR,1); // very specifically add just one char to the end of the string for the CR
     rc = tx_send_ui_packet(BROADCAST_CALLSIGN, from_callsign, PID_FILE,
-			   (uint8_t *)buffer, len, BLOCK,
+			   (uint8_t *)buffer, len, TX_CLASS_PB, BLOCK,
 			   MODULATION_INVALID);
 
     return rc;
@@ -267,7 +268,7 @@ void pb_send_status() {
    if (!ReadMRAMBoolState(StatePbEnabled)) {
         char shut[] = "PB Closed.";
         int rc = tx_send_ui_packet(BROADCAST_CALLSIGN, PBSHUT, PID_NO_PROTOCOL,
-				   (uint8_t *)shut, strlen(shut), BLOCK,
+				   (uint8_t *)shut, strlen(shut), TX_CLASS_PB, BLOCK,
 				   MODULATION_INVALID);
         trace_pb("SENDING: %s |%s|\n",PBSHUT, shut);
         ReportToWatchdog(CurrentTaskWD);
@@ -283,7 +284,7 @@ void pb_send_status() {
         trace_pb("SENDING: %s |%s|\n",CALL, pb_status_buffer);
 
        int rc = tx_send_ui_packet(BROADCAST_CALLSIGN, CALL, PID_NO_PROTOCOL,
-				  (uint8_t *)pb_status_buffer, len, BLOCK,
+				  (uint8_t *)pb_status_buffer, len, TX_CLASS_PB, BLOCK,
 				  MODULATION_INVALID);
         ReportToWatchdog(CurrentTaskWD);
         return;
@@ -428,6 +429,7 @@ bool pb_add_request(char *from_callsign, uint8_t type, DIR_NODE * node, uint32_t
 
     number_on_pb++;
 //    debug_print(" .. Added\n");
+    tac_pb_status_changed();
     return TRUE;
 }
 
@@ -485,6 +487,7 @@ int pb_remove_request(int pos) {
         if (current_station_on_pb >= number_on_pb)
             current_station_on_pb = 0;
     }
+    tac_pb_status_changed();
     return TRUE;
 }
 
@@ -902,7 +905,7 @@ int pb_next_action() {
         return TRUE;
     }
 
-    if (uxQueueMessagesWaiting(xTxPacketQueue) > MAX_PKTS_IN_TX_PKT_QUEUE_FOR_TNC_TO_BE_BUSY) return TRUE; /* TNC is Busy */
+    if (tx_packets_waiting(TX_CLASS_PB) > MAX_PKTS_IN_TX_PKT_QUEUE_FOR_TNC_TO_BE_BUSY) return TRUE; /* TNC is Busy */
 
     /**
      *  Process Request to broadcast directory
@@ -963,7 +966,7 @@ int pb_next_action() {
 
             /* Send the fill and finish */
             int rc = tx_send_ui_packet(BROADCAST_CALLSIGN, QST, PID_DIRECTORY,
-				       data_buffer, data_len, BLOCK,
+				       data_buffer, data_len, TX_CLASS_PB, BLOCK,
 				       MODULATION_INVALID);
             ReportToWatchdog(CurrentTaskWD);
 
@@ -1257,7 +1260,7 @@ int pb_broadcast_next_file_chunk(DIR_NODE *node, uint32_t offset, int length, ui
     /* Send the broadcast and finish */
     /* Send the fill and finish */
     rc = tx_send_ui_packet(BROADCAST_CALLSIGN, QST, PID_FILE, data_buffer,
-			   data_len, BLOCK,
+			   data_len, TX_CLASS_PB, BLOCK,
 			   MODULATION_INVALID);
     ReportToWatchdog(CurrentTaskWD);
     if (rc != TRUE) {
@@ -193,21 +193,46 @@ print_raw_packet(const char *str, uint8_t *data, unsigned int len)
 }
 
 static rx_radio_buffer_t rxbufs[NUM_RX_CHANNELS];
+/* FIFO bytes that are read and not kept, e.g. past the end of rxbufs */
+static uint8_t fifo_discard[32];
+
+/*
+ * Read len bytes from the FIFO and throw them away.  This is rare, so
+ * a small buffer is used a few times rather than a large one.
+ */
+static void discard_fifo_data(rfchan chan, unsigned int len)
+{
+    unsigned int n;
+
+    while (len > 0) {
+        n = (len < sizeof(fifo_discard)) ? len : sizeof(fifo_discard);
+        ax5043ReadFifo(chan, fifo_discard, n);
+        len -= n;
+    }
+}
 
 static void handle_fifo_data(rfchan chan, uint8_t fifo_flags, uint8_t len)
 {
-    unsigned int i;
+    unsigned int room;
     rx_radio_buffer_t *rxb = &rxbufs[chan];
 
     if (fifo_flags & AX5043_QUEUE_PKTSTART_FLAG)
         /* New packet. */
         rxb->len = 0;
 
-    for (i = 0; i < len; i++) {
-        if (rxb->len < sizeof(rxb->bytes))
-            rxb->bytes[rxb->len] = ax5043ReadReg(chan, AX5043_FIFODATA);
-        rxb->len++;
+    /*
+     * Read the chunk straight into the packet in one SPI transfer.
+     * Anything past the end of the buffer is read and dropped, but
+     * still counted in the length so the packet is rejected below.
+     */
+    room = (rxb->len < sizeof(rxb->bytes)) ? sizeof(rxb->bytes) - rxb->len : 0;
+    if (len <= room) {
+        ax5043ReadFifo(chan, &rxb->bytes[rxb->len], len);
+    } else {
+        ax5043ReadFifo(chan, &rxb->bytes[rxb->len], room);
+        discard_fifo_data(chan, len - room);
     }
+    rxb->len += len;
 
     //debug_print("FIFO CMD:%d LEN:%d FLAGS:%x\n",fifo_cmd,len, fifo_flags);
     if (fifo_flags & AX5043_RECV_FLAG_ERR_MASK) {
@@ -273,12 +298,15 @@ static void handle_fifo_data(rfchan chan, uint8_t fifo_flags, uint8_t len)
         debug_print("RX QUEUE FULL: Could not add to Packet Queue\n");
         ReportError(TxPacketDropped, FALSE, CharString,
                     (int)"AX25: ERROR: RX Packet QUEUE FULL");
+    } else {
+        ax25_wake();
     }
 }
 
 static bool process_fifo(rfchan chan)
 {
     uint8_t fifo_cmd, fifo_flags, len;
+    uint8_t hdr[2];
 
     if (!rx_working(chan)) {
         debug_print("AX5043 Interrupt in pwrmode: %02x\n",
@@ -304,25 +332,35 @@ static bool process_fifo(rfchan chan)
     // top 3 bits encode payload length
     len = (fifo_cmd & 0xE0) >> 5;
 
-    if (len == 7)
-        // 7 means length in next byte
-        len = ax5043ReadReg(chan, AX5043_FIFODATA);
+    if (len == 7) {
+        // 7 means length in next byte, then the flags
+        ax5043ReadFifo(chan, hdr, 2);
+        len = hdr[0];
+        fifo_flags = hdr[1];
+    } else if (len != 0) {
+        fifo_flags = ax5043ReadReg(chan, AX5043_FIFODATA);
+    } else {
+        fifo_flags = 0; // no payload
+    }
     fifo_cmd &= 0x1F;
     /*
      * Note that the length byte and header byte are not
      * included in the length of the packet but length does
      * include the flag byte.
      */
-    // read command
-    fifo_flags = ax5043ReadReg(chan, AX5043_FIFODATA);
+    if (len == 0)
+        len = 1; // nothing follows the flags
     len--;
 
     if (fifo_cmd == AX5043_FIFOCMD_DATA) {
         GPIOSetOn(LED2);
         handle_fifo_data(chan, fifo_flags, len);
-    } else if (monitorRxPackets) {
-        debug_print("FIFO MESSAGE: %x LEN:%d FLAGS: %x\n", fifo_cmd, len,
-                    fifo_flags);
+    } else {
+        /* Keep the FIFO in step by reading the rest of the message */
+        discard_fifo_data(chan, len);
+        if (monitorRxPackets)
+            debug_print("FIFO MESSAGE: %x LEN:%d FLAGS: %x\n", fifo_cmd, len,
+                        fifo_flags);
     }
 
     return true;
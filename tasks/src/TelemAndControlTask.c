@@ -112,6 +112,9 @@ void tac_maintenance_timer_callback(TimerHandle_t xTimer);
 void tac_check_file_queues_timer_callback(TimerHandle_t xTimer);
 void tac_science_mode_timer_callback(TimerHandle_t xTimer);
 void tac_stop_science_mode_timer();
+bool tac_status_beacon_changed(xTimerHandle timer, uint32_t *period, TickType_t last_sent, uint16_t min_secs);
+void tac_status_beacon_sent(xTimerHandle timer, uint32_t *period, TickType_t *last_sent, uint16_t min_secs,
+                            uint16_t max_secs);
 void tac_check_auto_safe();
 void tac_collect_telemetry(telem_buffer_t *buffer);
 void tac_send_telemetry(telem_buffer_t *buffer);
@@ -156,6 +159,18 @@ static xTimerHandle timerScienceMode;
 /* timer to send the uplink status */
 static xTimerHandle timerUplinkStatus;
 
+/*
+ * The PB and Uplink status are sent as soon as their state changes and then
+ * repeated with a period that doubles each time, up to the keepalive period.
+ * These hold the current period in ticks and the time the last status was sent.
+ */
+static uint32_t pb_status_period;
+static TickType_t pb_status_last_sent;
+static uint32_t uplink_status_period;
+static TickType_t uplink_status_last_sent;
+static volatile bool pb_status_change_queued = false;
+static volatile bool uplink_status_change_queued = false;
+
 // Storage used to send messages to the Telemetry and Control task
 static Intertask_Message statusMsg;
 
@@ -190,8 +205,11 @@ portTASK_FUNCTION_PROTO(TelemAndControlTask, pvParameters)
     allow_autosafe = ReadMRAMBoolState(StateAutoSafeAllow);
 
     portBASE_TYPE timerStatus = pdFAIL;
+    pb_status_period = SECONDS(ReadMRAMPBStatusFreq());
+    uplink_status_period = SECONDS(ReadMRAMFTL0StatusFreq());
+
     /* Setup a timer to send the PB status periodically */
-    timerPbStatus = xTimerCreate("PB STATUS", SECONDS(ReadMRAMPBStatusFreq()),
+    timerPbStatus = xTimerCreate("PB STATUS", pb_status_period,
                                  TRUE, NULL,
                                  tac_pb_status_callback); // auto reload timer
     if (timerPbStatus != NULL) {
@@ -208,7 +226,7 @@ portTASK_FUNCTION_PROTO(TelemAndControlTask, pvParameters)
 
     /* Setup a timer to send the uplink status periodically */
     timerUplinkStatus = xTimerCreate("UPLINK STATUS",
-                                     SECONDS(ReadMRAMFTL0StatusFreq()), TRUE,
+                                     uplink_status_period, TRUE,
                                      NULL,
                                      tac_ftl0_status_callback);
     if (timerUplinkStatus != NULL) {
@@ -325,6 +343,7 @@ portTASK_FUNCTION_PROTO(TelemAndControlTask, pvParameters)
     vTaskDelay(WATCHDOG_SHORT_WAIT_TIME);
     if (getSpacecraftMode() == SpacecraftFileSystemMode)
         pb_send_status();
+    pb_status_last_sent = xTaskGetTickCount();
 
     ReportToWatchdog(TelemetryAndControlWD);
 
@@ -335,6 +354,7 @@ portTASK_FUNCTION_PROTO(TelemAndControlTask, pvParameters)
         if (now > CLOCK_MIN_UNIX_SECS)
             ax25_send_status();
     }
+    uplink_status_last_sent = xTaskGetTickCount();
     ReportToWatchdog(TelemetryAndControlWD);
 
     //TODO - include any checks needed here to make sure hardware is available
@@ -435,40 +455,41 @@ portTASK_FUNCTION_PROTO(TelemAndControlTask, pvParameters)
                     break;
                 }
                 break;
+            case TacPbStatusChanged:
+            case TacUpdatePbTimer:
+                /* A station was added or removed or the PB was opened or shut.  Send the status now unless
+                 * we sent one less than the minimum period ago, in which case the timer is brought forward. */
+                pb_status_change_queued = false;
+                if (!tac_status_beacon_changed(timerPbStatus, &pb_status_period, pb_status_last_sent,
+                                               ReadMRAMPBStatusFreq()))
+                    break;
+                /* Otherwise fall through and send it now */
             case TacSendPbStatus:
                 //debug_print("Telem & Control: Send the PB Status\n");
                 if (ReadMRAMBoolState(StatePbEnabled))
                     if (getSpacecraftMode() == SpacecraftFileSystemMode)
                         pb_send_status();
+                tac_status_beacon_sent(timerPbStatus, &pb_status_period, &pb_status_last_sent,
+                                       ReadMRAMPBStatusFreq(), ReadMRAMPBStatusMaxFreq());
                 break;
 
-            case TacUpdatePbTimer:
-                if (timerPbStatus != NULL) {
-                    timerStatus = xTimerChangePeriod(timerPbStatus, SECONDS(ReadMRAMPBStatusFreq()), pdMS_TO_TICKS(100));
-                    if (timerStatus != pdPASS) {
-                        ReportError(RTOSfailure, FALSE, CharString,
-                                    (int)"ERROR: Failed to change PB Timer period");
-                    }
-                }
-                break;
+            case TacUplinkStatusChanged:
+            case TacUpdateUplinkTimer:
+                /* A station connected or disconnected or the uplink was opened or shut */
+                uplink_status_change_queued = false;
+                if (!tac_status_beacon_changed(timerUplinkStatus, &uplink_status_period, uplink_status_last_sent,
+                                               ReadMRAMFTL0StatusFreq()))
+                    break;
+                /* Otherwise fall through and send it now */
             case TacSendUplinkStatus:
                 //debug_print("Telem & Control: Send the FTL0 Status\n");
                 if (ReadMRAMBoolState(StateUplinkEnabled)) {
                     now = getUnixTime(); // Get the time in seconds since the unix epoch
-                    if (now < CLOCK_MIN_UNIX_SECS)
-                        break;
-                    if (getSpacecraftMode() == SpacecraftFileSystemMode)
+                    if (now >= CLOCK_MIN_UNIX_SECS && getSpacecraftMode() == SpacecraftFileSystemMode)
                         ax25_send_status();
                 }
-                break;
-            case TacUpdateUplinkTimer:
-                if (timerUplinkStatus != NULL) {
-                    timerStatus = xTimerChangePeriod(timerUplinkStatus, SECONDS(ReadMRAMFTL0StatusFreq()), pdMS_TO_TICKS(100));
-                    if (timerStatus != pdPASS) {
-                        ReportError(RTOSfailure, FALSE, CharString,
-                                    (int)"ERROR: Failed to change FTL0 Uplink Timer period");
-                    }
-                }
+                tac_status_beacon_sent(timerUplinkStatus, &uplink_status_period, &uplink_status_last_sent,
+                                       ReadMRAMFTL0StatusFreq(), ReadMRAMFTL0StatusMaxFreq());
                 break;
             case TacMaintenanceMsg:
                 //debug_print("TAC: Running DIR Maintenance\n");
@@ -585,6 +606,110 @@ void tac_ftl0_status_callback(TimerHandle_t xTimer)
     NotifyInterTaskFromISR(ToTelemetryAndControl, &statusMsg);
 }
 
+/**
+ * tac_pb_status_changed()
+ *
+ * Called from the PB task when a station is added to or removed from the PB.
+ * Repeated calls before the Telemetry and Control task has acted on the first
+ * are coalesced into one message.
+ */
+void tac_pb_status_changed()
+{
+    Intertask_Message msg;
+    bool queued;
+
+    /* Test and set together, as this is called from more than one task */
+    taskENTER_CRITICAL();
+    queued = pb_status_change_queued;
+    pb_status_change_queued = true;
+    taskEXIT_CRITICAL();
+    if (queued) return;
+    msg.MsgType = TacPbStatusChanged;
+    if (!NotifyInterTask(ToTelemetryAndControl, 0, &msg))
+        pb_status_change_queued = false;
+}
+
+/**
+ * tac_uplink_status_changed()
+ *
+ * Called from the Uplink task when a station connects or disconnects.  Coalesced
+ * like tac_pb_status_changed().
+ */
+void tac_uplink_status_changed()
+{
+    Intertask_Message msg;
+    bool queued;
+
+    /* Test and set together, as this is called from more than one task */
+    taskENTER_CRITICAL();
+    queued = uplink_status_change_queued;
+    uplink_status_change_queued = true;
+    taskEXIT_CRITICAL();
+    if (queued) return;
+    msg.MsgType = TacUplinkStatusChanged;
+    if (!NotifyInterTask(ToTelemetryAndControl, 0, &msg))
+        uplink_status_change_queued = false;
+}
+
+/**
+ * tac_status_beacon_changed()
+ *
+ * The state behind a status beacon has changed, so the period is reset to the
+ * minimum.  Returns TRUE if the status should be sent now.  If the last status
+ * was sent less than the minimum period ago then the timer is set to expire
+ * when the minimum period is up and FALSE is returned.
+ */
+bool tac_status_beacon_changed(xTimerHandle timer, uint32_t *period, TickType_t last_sent, uint16_t min_secs)
+{
+    portBASE_TYPE timerStatus;
+    TickType_t elapsed = xTaskGetTickCount() - last_sent;
+
+    *period = SECONDS(min_secs);
+    if (elapsed >= *period)
+        return TRUE;
+    if (timer != NULL) {
+        timerStatus = xTimerChangePeriod(timer, *period - elapsed, pdMS_TO_TICKS(100));
+        if (timerStatus != pdPASS) {
+            ReportError(RTOSfailure, FALSE, CharString,
+                        (int)"ERROR: Failed to change status Timer period");
+        }
+    }
+    return FALSE;
+}
+
+/**
+ * tac_status_beacon_sent()
+ *
+ * Called each time a status beacon is due.  The timer is restarted with the
+ * current period and the period is then doubled, up to the keepalive period,
+ * so that a quiet PB or Uplink backs off to a slow keepalive.
+ */
+void tac_status_beacon_sent(xTimerHandle timer, uint32_t *period, TickType_t *last_sent, uint16_t min_secs,
+                            uint16_t max_secs)
+{
+    portBASE_TYPE timerStatus;
+    uint32_t max_period = SECONDS(max_secs);
+
+    if (max_secs < min_secs)
+        max_period = SECONDS(min_secs);
+    if (*period < SECONDS(min_secs))
+        *period = SECONDS(min_secs);
+    if (*period > max_period)
+        *period = max_period;
+
+    *last_sent = xTaskGetTickCount();
+    if (timer != NULL) {
+        timerStatus = xTimerChangePeriod(timer, *period, pdMS_TO_TICKS(100));
+        if (timerStatus != pdPASS) {
+            ReportError(RTOSfailure, FALSE, CharString,
+                        (int)"ERROR: Failed to change status Timer period");
+        }
+    }
+    *period = *period * 2;
+    if (*period > max_period)
+        *period = max_period;
+}
+
 /**
  * tac_telem_timer_callback()
  *
@@ -1094,7 +1219,7 @@ void tac_send_telemetry(telem_buffer_t *buffer)
 
             if (frame != NULL)
                 tx_send_ui_packet(BROADCAST_CALLSIGN, to_callsign, PID_NO_PROTOCOL,
-                                  frame, len, BLOCK, MODULATION_INVALID);
+                                  frame, len, TX_CLASS_TELEMETRY, BLOCK, MODULATION_INVALID);
         }
 }
 
@@ -1110,7 +1235,7 @@ void tac_send_time() {
     time_frame = (uint8_t *) &t;
 
     tx_send_ui_packet(BROADCAST_CALLSIGN, TIME, PID_NO_PROTOCOL,
-                      time_frame, len, BLOCK, MODULATION_INVALID);
+                      time_frame, len, TX_CLASS_TELEMETRY, BLOCK, MODULATION_INVALID);
 }
 
 
@@ -20,6 +20,7 @@
  */
 
 #include "ctype.h"
+#include <string.h>
 
 #include "pacsat.h"
 #include "radio.h"
@@ -30,6 +31,7 @@
 #include "ax25_util.h"
 #include "nonvolManagement.h"
 #include "gpioDriver.h"
+#include "adc_proc.h"
 
 /*
  * A note on AX5043 transmit processing and FEC:
@@ -65,7 +67,30 @@
  * doing back-to-back packets.
  *
  * -corey
+ *
+ * Without FEC the AX5043 adds the CRC and a closing flag at PKT_END and
+ * nothing more.  So when another frame is waiting, it is loaded while the
+ * end of the last one is still in the FIFO, after a few flags instead of
+ * the preamble.  The frames then go out back to back on one key up.
+ *
+ * FX.25 is sent raw, so the AX5043 does no framing or CRC.  The FX.25
+ * code word already holds the flags, the stuffed frame and the FCS.  It
+ * still goes through the NRZI encoding, as the rest of the frame would.
+ */
+
+#define TX_BURST_FLAGS 2 /* Flags between back to back frames, as well as the closing flag of the first */
+#define TX_FIFO_CMD_OVERHEAD 10 /* FIFO bytes for the flags command and the header of the data command */
+#define TX_FX25_TAIL_FLAGS 2 /* Flags after an FX.25 code word, which has no closing flag of its own */
+
+/*
+ * The FIFO raises the TX interrupt when it drains to the low water mark.
+ * That must hold enough bytes to cover the time to wake the TxTask and
+ * load more, including the tick fifo_commit() sleeps, or it runs dry in
+ * the middle of a frame.
  */
+#define TX_FIFO_REFILL_LATENCY_MS 30
+#define TX_FIFO_MIN_LOW_WATER 32
+#define TX_FIFO_MAX_LOW_WATER 128
 
 static rfchan txchan = FIRST_TX_CHANNEL;
 
@@ -78,6 +103,285 @@ static uint8_t tx_pow = DCT_DEFAULT_PA_POWER;
 /* Global Variable that is declared here and prevents the transmitter from generating RF */
 bool inhibitTransmit;
 
+static TX_fifo_counters_t fifo_counters;
+static uint8_t fx25_buffer[FX25_MAX_LEN + TX_FX25_TAIL_FLAGS];
+static uint16_t tx_fifo_threshold = 150; /* FIFO free bytes that raise the TX interrupt */
+static TickType_t tx_fifo_drain_ticks = CENTISECONDS(10); /* Time for the bytes below the threshold to go out */
+
+/*
+ * Copy the counts of frames sent and the ticks spent loading them into
+ * the FIFO.
+ */
+void tx_fifo_counters(TX_fifo_counters_t *counters)
+{
+    *counters = fifo_counters;
+}
+
+static xSemaphoreHandle TxFIFOReady;
+
+/* One queue for each enum tx_class, created by the TxTask */
+static QueueHandle_t xTxPacketQueue[TX_NUM_CLASSES];
+static const UBaseType_t tx_queue_len[TX_NUM_CLASSES] = {
+    TX_CONTROL_QUEUE_LEN, TX_CONNECTED_QUEUE_LEN, TX_PB_QUEUE_LEN,
+    TX_TELEMETRY_QUEUE_LEN
+};
+static uint8_t tx_passed_over[TX_NUM_CLASSES]; /* Frames sent ahead of a waiting class */
+static TX_queue_counters_t queue_counters;
+static TaskHandle_t tx_task_handle;
+
+/*
+ * The governor keeps the duty cycle and the PA temperature under the
+ * limits in MRAM.  The time the transmitter was keyed is summed in a ring
+ * of TX_DUTY_SLOTS slots of TX_DUTY_SLOT_TICKS each.
+ */
+static uint16_t tx_max_duty_percent = TX_DEFAULT_MAX_DUTY_PERCENT;
+static uint16_t tx_max_pa_temp = TX_DEFAULT_MAX_PA_TEMP;
+static uint32_t tx_keyed_ticks[TX_DUTY_SLOTS];
+static unsigned int tx_duty_slot;
+static TickType_t tx_duty_slot_start;
+static bool tx_keyed;
+static TickType_t tx_key_up; /* When the transmitter was keyed, while tx_keyed */
+static TickType_t tx_governor_updated;
+static TX_governor_status_t governor_status;
+
+/*
+ * Copy the frames sent from each TX queue and how long they waited.
+ */
+void tx_queue_counters(TX_queue_counters_t *counters)
+{
+    *counters = queue_counters;
+}
+
+/*
+ * tx_next_class()
+ *
+ * Pick the queue to send from, given the frames waiting in each, or
+ * return TX_NUM_CLASSES if they are all empty.  Control frames always go
+ * first.  Otherwise the highest class goes, unless a lower one has been
+ * passed over TX_CLASS_MAX_PASSED_OVER times.  The PB keeps its queue full
+ * while it has requests, so without this telemetry would never go.
+ */
+static int tx_next_class(const UBaseType_t waiting[], uint8_t passed_over[])
+{
+    int c, next = TX_NUM_CLASSES;
+
+    if (waiting[TX_CLASS_CONTROL] > 0)
+        return TX_CLASS_CONTROL;
+    for (c = TX_CLASS_CONTROL + 1; c < TX_NUM_CLASSES; c++)
+        if (waiting[c] > 0) {
+            next = c;
+            break;
+        }
+    if (next == TX_NUM_CLASSES)
+        return next;
+    for (c = TX_NUM_CLASSES - 1; c > next; c--)
+        if (waiting[c] > 0 && passed_over[c] >= TX_CLASS_MAX_PASSED_OVER) {
+            next = c;
+            break;
+        }
+    for (c = TX_CLASS_CONTROL + 1; c < TX_NUM_CLASSES; c++)
+        if (c != next && waiting[c] > 0 && passed_over[c] < 255)
+            passed_over[c]++;
+    passed_over[next] = 0;
+    return next;
+}
+
+/*
+ * Start a new slot in the duty cycle ring for each TX_DUTY_SLOT_TICKS
+ * since the current one started.
+ */
+static void tx_duty_advance(TickType_t now)
+{
+    unsigned int i;
+
+    if (now - tx_duty_slot_start >= TX_DUTY_SLOTS * TX_DUTY_SLOT_TICKS) {
+        /* Idle for the whole window */
+        for (i = 0; i < TX_DUTY_SLOTS; i++)
+            tx_keyed_ticks[i] = 0;
+        tx_duty_slot_start = now;
+        return;
+    }
+    while (now - tx_duty_slot_start >= TX_DUTY_SLOT_TICKS) {
+        tx_duty_slot = (tx_duty_slot + 1) % TX_DUTY_SLOTS;
+        tx_keyed_ticks[tx_duty_slot] = 0;
+        tx_duty_slot_start += TX_DUTY_SLOT_TICKS;
+    }
+}
+
+static void tx_key(bool on)
+{
+    TickType_t now = xTaskGetTickCount();
+
+    tx_duty_advance(now);
+    if (on) {
+        tx_key_up = now;
+    } else if (tx_keyed) {
+        tx_keyed_ticks[tx_duty_slot] += now - tx_key_up;
+    }
+    tx_keyed = on;
+}
+
+/*
+ * The percent of the window the transmitter was keyed, including the
+ * key up in progress.
+ */
+static unsigned int tx_duty_percent(TickType_t now)
+{
+    uint32_t keyed = 0;
+    unsigned int i;
+
+    tx_duty_advance(now);
+    for (i = 0; i < TX_DUTY_SLOTS; i++)
+        keyed += tx_keyed_ticks[i];
+    if (tx_keyed)
+        keyed += now - tx_key_up;
+    return keyed * 100 / (TX_DUTY_SLOTS * TX_DUTY_SLOT_TICKS);
+}
+
+/*
+ * tx_governor_update()
+ *
+ * Set the throttle from the duty cycle and the PA temperature that the
+ * IOTask last measured.  The PB is held first, as it is most of the
+ * traffic and the stations will ask again for what they missed.
+ */
+static void tx_governor_update(void)
+{
+    TickType_t now = xTaskGetTickCount();
+    unsigned int duty = tx_duty_percent(now);
+    int temp = board_temps[TEMPERATURE_VAL_PA];
+    enum tx_throttle throttle = TX_THROTTLE_NONE;
+
+    if (duty >= tx_max_duty_percent || temp >= (int)tx_max_pa_temp)
+        throttle = TX_THROTTLE_CONTROL_ONLY;
+    else if (duty >= tx_max_duty_percent * TX_THROTTLE_PB_PERCENT / 100
+             || temp >= (int)tx_max_pa_temp - TX_PA_TEMP_MARGIN)
+        throttle = TX_THROTTLE_PB;
+
+    governor_status.throttled_ticks[governor_status.throttle] += now - tx_governor_updated;
+    tx_governor_updated = now;
+    if (throttle != governor_status.throttle)
+        debug_print("TX: Throttle %d, duty cycle %d%%, PA temp %dC\n",
+                    throttle, duty, temp);
+    governor_status.throttle = throttle;
+    governor_status.duty_percent = duty;
+    governor_status.pa_temp = temp;
+}
+
+/*
+ * Copy the duty cycle, PA temperature and time spent throttled.
+ */
+void tx_governor_status(TX_governor_status_t *status)
+{
+    *status = governor_status;
+}
+
+/*
+ * Called by the command handler after the limits are written to MRAM.
+ */
+void tx_set_governor_limits(uint16_t max_duty_percent, uint16_t max_pa_temp)
+{
+    tx_max_duty_percent = max_duty_percent;
+    tx_max_pa_temp = max_pa_temp;
+}
+
+/*
+ * tx_receive_packet()
+ *
+ * Take the next frame to send from the TX queues.  Returns pdFAIL if they
+ * are all empty.
+ */
+static BaseType_t tx_receive_packet(tx_radio_buffer_t *buffer)
+{
+    UBaseType_t waiting[TX_NUM_CLASSES];
+    TickType_t wait;
+    int c;
+
+    tx_governor_update();
+    for (c = 0; c < TX_NUM_CLASSES; c++)
+        waiting[c] = uxQueueMessagesWaiting(xTxPacketQueue[c]);
+    /* Frames the governor holds stay on their queues until it lets them go */
+    if (governor_status.throttle >= TX_THROTTLE_PB)
+        waiting[TX_CLASS_PB] = 0;
+    if (governor_status.throttle >= TX_THROTTLE_CONTROL_ONLY) {
+        waiting[TX_CLASS_CONNECTED] = 0;
+        waiting[TX_CLASS_TELEMETRY] = 0;
+    }
+    c = tx_next_class(waiting, tx_passed_over);
+    if (c == TX_NUM_CLASSES)
+        return pdFAIL;
+    if (xQueueReceive(xTxPacketQueue[c], buffer, NO_TIMEOUT) != pdPASS)
+        return pdFAIL;
+
+    wait = xTaskGetTickCount() - buffer->queued;
+    queue_counters.frames[c]++;
+    queue_counters.wait_ticks[c] += wait;
+    if (wait > queue_counters.max_wait_ticks[c])
+        queue_counters.max_wait_ticks[c] = wait;
+    return pdPASS;
+}
+
+static bool tx_queues_empty(void)
+{
+    int c;
+
+    for (c = 0; c < TX_NUM_CLASSES; c++)
+        if (uxQueueMessagesWaiting(xTxPacketQueue[c]) > 0)
+            return false;
+    return true;
+}
+
+/*
+ * tx_packets_waiting()
+ *
+ * The number of frames in one TX queue.  The PB uses this to tell if the
+ * TX is busy.
+ */
+UBaseType_t tx_packets_waiting(enum tx_class tx_class)
+{
+    return uxQueueMessagesWaiting(xTxPacketQueue[tx_class]);
+}
+
+/*
+ * Wait for the frames in the FIFO to go out, e.g. before the modulation
+ * is changed.  Give up after 1/2 second, as the packet loop does.
+ */
+static void tx_wait_fifo_empty(void)
+{
+    unsigned int retries;
+
+    for (retries = 0; retries <= 50; retries++) {
+        if (fifo_status(txchan) & AX5043_FIFOSTAT_EMPTY)
+            return;
+        xSemaphoreTake(TxFIFOReady, CENTISECONDS(1));
+        ReportToWatchdog(CurrentTaskWD);
+    }
+    ReportError(AX5043error, false, CharString,
+                (int)"TX FIFO did not empty");
+}
+
+/*
+ * Set the FIFO threshold for the bit rate of a modulation.  Faster rates
+ * need a higher low water mark to cover the refill time.
+ */
+static void tx_set_fifo_threshold(enum radio_modulation mod)
+{
+    uint32_t bit_rate = modulation_to_bit_rate(mod);
+    uint32_t low_water;
+
+    low_water = bit_rate * TX_FIFO_REFILL_LATENCY_MS / 8000 + TX_FIFO_CMD_OVERHEAD;
+    if (low_water < TX_FIFO_MIN_LOW_WATER)
+        low_water = TX_FIFO_MIN_LOW_WATER;
+    if (low_water > TX_FIFO_MAX_LOW_WATER)
+        low_water = TX_FIFO_MAX_LOW_WATER;
+    tx_fifo_threshold = 256 - low_water;
+    fifo_set_free_threshold(txchan, tx_fifo_threshold);
+
+    tx_fifo_drain_ticks = CENTISECONDS(10);
+    if (bit_rate != 0)
+        tx_fifo_drain_ticks = low_water * 8 * 1000 / bit_rate / portTICK_RATE_MS + 1;
+}
+
 /* Test Buffer PB Empty */
 //uint8_t byteBuf[] = {0xA0,0x84,0x98,0x92,0xA6,0xA8,0x00,0xA0,0x8C,0xA6,0x66,
 //                     0x40,0x40,0x17,0x03,0xF0,0x50,0x42,0x3A,0x20,0x45,0x6D,0x70,0x74,0x79,0x2E,0x0D};
@@ -118,12 +422,13 @@ print_raw_packet(const char *str, uint8_t *data, unsigned int len)
     printf("\n");
 }
 
-static xSemaphoreHandle TxFIFOReady;
 static void tx_irq_handler(void *handler_data)
 {
-    BaseType_t higherPrioTaskWoken;
+    BaseType_t higherPrioTaskWoken = pdFALSE;
 
     xSemaphoreGiveFromISR(TxFIFOReady, &higherPrioTaskWoken);
+    /* Refill now rather than at the next tick */
+    portYIELD_FROM_ISR(higherPrioTaskWoken);
 }
 
 const static struct gpio_irq_info tx_gpio_info = {
@@ -135,12 +440,16 @@ portTASK_FUNCTION_PROTO(TxTask, pvParameters)
     /* Buffer used when data copied from tx queue */
     tx_radio_buffer_t tx_packet_buffer;
     enum radio_modulation curr_modulation = MODULATION_INVALID;
+    bool fifo_busy; /* The FIFO still holds the end of the last frame */
+    int i;
 
     tx_modulation = ReadMRAMModulation(txchan);
     tx_dac_val = ReadMRAMPaDAC();
     tx_pow = ReadMRAMPaPower();
     if (tx_pow > 100)
         tx_pow = 100;
+    tx_max_duty_percent = ReadMRAMTxMaxDutyPercent();
+    tx_max_pa_temp = ReadMRAMTxMaxPATemp();
 
     vTaskSetApplicationTaskTag((xTaskHandle) 0, (pdTASK_HOOK_CODE) TxTaskWD);
 
@@ -149,17 +458,20 @@ portTASK_FUNCTION_PROTO(TxTask, pvParameters)
     vSemaphoreCreateBinary(TxFIFOReady);
     GPIOInit(AX5043_Tx_Interrupt, &tx_gpio_info);
 
-    /* This is defined in pacsat.h, declared here */
-    xTxPacketQueue = xQueueCreate(TX_PACKET_QUEUE_LEN,
-                                  sizeof(tx_radio_buffer_t));
-    if (xTxPacketQueue == NULL) {
-        /*
-         * The queue could not be created.  This is fatal and should
-         * only happen in test if we are short of memory at startup.
-         */
-        ReportError(RTOSfailure, true, CharString,
-                    (int)"FATAL ERROR: Could not create TX Packet Queue");
+    for (i = 0; i < TX_NUM_CLASSES; i++) {
+        xTxPacketQueue[i] = xQueueCreate(tx_queue_len[i],
+                                         sizeof(tx_radio_buffer_t));
+        if (xTxPacketQueue[i] == NULL) {
+            /*
+             * The queue could not be created.  This is fatal and should
+             * only happen in test if we are short of memory at startup.
+             */
+            ReportError(RTOSfailure, true, CharString,
+                        (int)"FATAL ERROR: Could not create TX Packet Queue");
+        }
     }
+    /* Producers wake us with xTaskNotifyGive() once this is set */
+    tx_task_handle = xTaskGetCurrentTaskHandle();
 
     start_tx(txchan, ReadMRAMFreq(txchan), ReadMRAMModulation(txchan));
 
@@ -183,17 +495,16 @@ portTASK_FUNCTION_PROTO(TxTask, pvParameters)
     ReportToWatchdog(CurrentTaskWD);
 
     /*
-     * TODO - Add PA thermal management to this to keep the PA cool
-     * enough.  Probably add temperature monitoring and transmit
-     * limiting based on temperature.
+     * The governor in tx_receive_packet() keeps the PA cool enough by
+     * holding frames when the duty cycle or the PA temperature is high.
      */
     while (1) {
         BaseType_t xStatus;
 
         // TODO - adjust block time vs watchdog
-        xStatus = xQueueReceive(xTxPacketQueue, &tx_packet_buffer,
-                                CENTISECONDS(10));
+        ulTaskNotifyTake(pdTRUE, CENTISECONDS(10));
         ReportToWatchdog(CurrentTaskWD);
+        xStatus = tx_receive_packet(&tx_packet_buffer);
 
         if (xStatus != pdPASS)
             continue;
@@ -204,24 +515,43 @@ portTASK_FUNCTION_PROTO(TxTask, pvParameters)
         GPIOSetOn(LED1);
 
         GPIOSetOn(SSPAPower);
+        tx_key(true);
 #ifdef AFSK_HARDWARE3
         set_tx_dac(tx_dac_val);
         set_tx_power(txchan, tx_pow);
 #endif
 
         /* Transmit until we have no more packets. */
+        fifo_busy = false;
         while (xStatus == pdPASS) {
             /* Data was successfully received from the queue */
             uint8_t preamble_length = 32;
             unsigned int numbytesleft = tx_packet_buffer.len;
-            unsigned int numbytes, flag, bytepos, retries;
+            unsigned int numbytes, flag, bytepos, retries, max_first;
+            unsigned int raw_flag = 0;
+            uint8_t *frame = tx_packet_buffer.bytes;
+            TickType_t load_start;
             enum radio_modulation mod;
             enum fec fec;
+            bool burst;
 
             mod = (enum radio_modulation) tx_packet_buffer.tx_modulation;
 
+            /*
+             * The frame goes straight after the previous one, which is
+             * still in the FIFO, unless it needs FEC or a different
+             * modulation.  Then let the previous one go out first.
+             */
+            burst = fifo_busy;
+            if (burst && (mod != curr_modulation || MODULATION_TO_FEC(mod) == FEC_CONV)) {
+                tx_wait_fifo_empty();
+                burst = false;
+            }
+            fifo_busy = false;
+
             if (mod != curr_modulation) {
                 set_modulation(txchan, mod, true);
+                tx_set_fifo_threshold(mod);
                 curr_modulation = mod;
             }
 
@@ -236,6 +566,25 @@ portTASK_FUNCTION_PROTO(TxTask, pvParameters)
                 break;
             case MODULATION_GMSK_9600:
                 break;
+            default:
+                break;
+            }
+            if (burst)
+                preamble_length = TX_BURST_FLAGS;
+
+            if (fec & FEC_RS) {
+                /* FX.25, unless the frame is too long for the largest code */
+                int fx25_len = fx25_encode(tx_packet_buffer.bytes,
+                                           tx_packet_buffer.len, fx25_buffer);
+                if (fx25_len > 0) {
+                    memset(fx25_buffer + fx25_len, AX25_FLAG, TX_FX25_TAIL_FLAGS);
+                    frame = fx25_buffer;
+                    numbytesleft = fx25_len + TX_FX25_TAIL_FLAGS;
+                    raw_flag = AX5043_QUEUE_RAW_NO_CRC_FLAG;
+                    fifo_counters.fx25_frames++;
+                } else {
+                    fifo_counters.fx25_too_long++;
+                }
             }
 
             if (monitorTxPackets) {
@@ -249,8 +598,18 @@ portTASK_FUNCTION_PROTO(TxTask, pvParameters)
 
             //printf("FIFO_FREE 1: %d\n",fifo_free());
 
-            // clear FIFO data & flags
-            fifo_clear(txchan);
+            load_start = xTaskGetTickCount();
+            max_first = 200;
+            if (burst) {
+                /* Only the room left behind the previous frame */
+                max_first = fifo_free(txchan) - TX_FIFO_CMD_OVERHEAD;
+                if (max_first > 200)
+                    max_first = 200;
+                fifo_counters.burst_frames++;
+            } else {
+                // clear FIFO data & flags
+                fifo_clear(txchan);
+            }
 
             if (fec == FEC_CONV) {
                 /*
@@ -265,8 +624,8 @@ portTASK_FUNCTION_PROTO(TxTask, pvParameters)
                 fifo_repeat_byte(txchan, 0x7E, preamble_length,
                                  AX5043_QUEUE_RAW_NO_CRC_FLAG);
             } else {
-                // repeat the preamble bytes
-                //  TODO - no preamble for back to back packets
+                // repeat the preamble bytes, or a few flags between
+                // back to back packets
                 fifo_repeat_byte(txchan, 0x7E, preamble_length,
                                  AX5043_QUEUE_RAW_NO_CRC_FLAG |
                                  AX5043_QUEUE_PKTSTART_FLAG);
@@ -280,68 +639,89 @@ portTASK_FUNCTION_PROTO(TxTask, pvParameters)
              * up to 10 bytes, and leave a little slack.
              */
             bytepos = 0;
-            if (numbytesleft > 200) {
-                numbytes = 200;
-                numbytesleft -= 200;
+            if (numbytesleft > max_first) {
+                numbytes = max_first;
+                numbytesleft -= max_first;
                 flag = 0;
             } else {
                 numbytes = numbytesleft;
                 numbytesleft = 0;
                 flag = AX5043_QUEUE_PKTEND_FLAG;
             }
-            fifo_queue_buffer(txchan, tx_packet_buffer.bytes, numbytes, flag);
+            fifo_queue_buffer(txchan, frame, numbytes, flag | raw_flag);
             bytepos += numbytes;
+            fifo_counters.load_ticks += xTaskGetTickCount() - load_start;
+            fifo_counters.frames++;
             //       printf("FIFO_FREE 2: %d\n",fifo_free());
             fifo_commit(txchan);
             //       printf("INFO: Waiting for transmission to complete\n");
 
             /*
              * Handle sending more data and waiting for all data to be
-             * sent.
+             * sent.  The TX interrupt comes when the FIFO drains to the
+             * low water mark.  Then one FIFOSTAT read says if it really
+             * is that low, as the semaphore may be left over from the
+             * last frame, and if it ran dry.  After the last bytes are
+             * loaded there is no interrupt at empty, so wait for the
+             * time the low water mark takes to go out.
              */
             for (retries = 0; ; ) {
-                unsigned int free_room = fifo_free(txchan);
-                /* TX interrupt at 150 bytes free, and at empty. */
+                uint8_t status = fifo_status(txchan);
+                TickType_t wait = CENTISECONDS(10);
 
-                if (numbytesleft == 0 && free_room == 256)
-                    /* FIFO empty interrupt, finished processing. */
+                if (numbytesleft == 0 && (status & AX5043_FIFOSTAT_EMPTY))
+                    /* FIFO empty, finished processing. */
                     break;
 
-                if (free_room >= 150 && numbytesleft > 0) {
-                    /* 150 byte free interrupt, add another 100. */
-                    if (numbytesleft > 100) {
-                        numbytes = 100;
-                        numbytesleft -= 100;
+                if ((status & AX5043_FIFOSTAT_FREETHR) && numbytesleft > 0) {
+                    /* Fill it back up from the low water mark */
+                    unsigned int max_refill = tx_fifo_threshold - TX_FIFO_CMD_OVERHEAD;
+
+                    if (status & AX5043_FIFOSTAT_EMPTY)
+                        fifo_counters.underruns++;
+                    if (numbytesleft > max_refill) {
+                        numbytes = max_refill;
+                        numbytesleft -= max_refill;
                         flag = 0;
                     } else {
                         numbytes = numbytesleft;
                         numbytesleft = 0;
                         flag = AX5043_QUEUE_PKTEND_FLAG;
                     }
-                    fifo_queue_buffer(txchan,
-                                      tx_packet_buffer.bytes + bytepos,
-                                      numbytes, flag);
+                    load_start = xTaskGetTickCount();
+                    fifo_queue_buffer(txchan, frame + bytepos,
+                                      numbytes, flag | raw_flag);
                     bytepos += numbytes;
+                    fifo_counters.load_ticks += xTaskGetTickCount() - load_start;
+                    fifo_counters.refills++;
                     fifo_commit(txchan);
                     retries = 0;
                 } else {
-                    retries++;
-                }
-                if (retries > 50) {
-                    /* No progress in 1/2 second, time to log and give up. */
-                    ReportError(AX5043error, true, CharString,
-                                (int)"TX packet finish never happened");
-                    break;
+                    if (status & AX5043_FIFOSTAT_FREETHR) {
+                        if (fec != FEC_CONV && !tx_queues_empty()) {
+                            /* Load the next frame while this one goes out */
+                            fifo_busy = true;
+                            break;
+                        }
+                        wait = tx_fifo_drain_ticks;
+                    }
+                    if (++retries > 50) {
+                        /* No progress, time to log and give up. */
+                        ReportError(AX5043error, true, CharString,
+                                    (int)"TX packet finish never happened");
+                        break;
+                    }
                 }
-                xSemaphoreTake(TxFIFOReady, CENTISECONDS(10));
+                xSemaphoreTake(TxFIFOReady, wait);
                 ReportToWatchdog(CurrentTaskWD);
             }
 
             // See if we have another packet to send.
-            xStatus = xQueueReceive(xTxPacketQueue, &tx_packet_buffer,
-                                    NO_TIMEOUT);
+            xStatus = tx_receive_packet(&tx_packet_buffer);
             ReportToWatchdog(CurrentTaskWD);
         }
+        if (fifo_busy)
+            tx_wait_fifo_empty();
 
         /* Leave the PA on a bit to give time for the last bits to go out. */
         /* TODO - this should be calculated. */
@@ -350,6 +730,7 @@ portTASK_FUNCTION_PROTO(TxTask, pvParameters)
         //       printf("Turn off TX LED1\n");
         GPIOSetOff(LED1);
         GPIOSetOff(SSPAPower);
+        tx_key(false);
         //       printf("INFO: Transmission complete\n");
     }
 }
@@ -434,34 +815,37 @@ static bool tx_make_packet(AX25_PACKET *packet,
     int i;
     unsigned char buf[7];
 
-    // set the control byte
+    /*
+     * Set the control byte.  On a modulo 128 (v2.2) connection the I
+     * and S frames have a second control byte with NR and PF, which
+     * goes in the upper 8 bits of control.
+     */
+    uint16_t nr_pf = (packet->NR << 5) | (packet->PF << 4);
+    if (packet->extended)
+        nr_pf = ((packet->NR << 1) | packet->PF) << 8;
+
     switch (packet->frame_type) {
     case TYPE_I:
-        packet->control = ((packet->NR << 5) | (packet->PF << 4) |
-                           (packet->NS << 1) | 0b00);
+        packet->control = nr_pf | (packet->NS << 1) | 0b0;
         header_len = 16; // make room for pid
         packet->pid = 0xF0;
         packet->command = AX25_COMMAND;
         break;
 
     case TYPE_S_RR:
-        packet->control = ((packet->NR << 5) | (packet->PF << 4) |
-                           BITS_S_RECEIVE_READY);
+        packet->control = nr_pf | BITS_S_RECEIVE_READY;
         break;
 
     case TYPE_S_RNR:
-        packet->control = ((packet->NR << 5) | (packet->PF << 4) |
-                           BITS_S_RECEIVE_NOT_READY);
+        packet->control = nr_pf | BITS_S_RECEIVE_NOT_READY;
         break;
 
     case TYPE_S_REJ:
-        packet->control = ((packet->NR << 5) | (packet->PF << 4) |
-                           BITS_S_REJECT);
+        packet->control = nr_pf | BITS_S_REJECT;
         break;
 
     case TYPE_S_SREJ:
-        packet->control = ((packet->NR << 5) | (packet->PF << 4) |
-                           BITS_S_SELECTIVE_REJECT);
+        packet->control = nr_pf | BITS_S_SELECTIVE_REJECT;
         break;
 
     case TYPE_U_SABM:
@@ -519,6 +903,12 @@ static bool tx_make_packet(AX25_PACKET *packet,
         return false;
     }
 
+    /* Only I and S frames have the second control byte */
+    int control_len = 1;
+    if (packet->extended && packet->frame_type <= TYPE_S_SREJ)
+        control_len = 2;
+    header_len += control_len - 1;
+
     if (header_len + packet->data_len > sizeof(tx_radio_buffer->bytes))
         // TODO - should we log this?
         return false;
@@ -539,11 +929,13 @@ static bool tx_make_packet(AX25_PACKET *packet,
     for (i=0; i<7; i++)
         tx_radio_buffer->bytes[i+7] = buf[i];
 
-    tx_radio_buffer->bytes[14] = packet->control;
+    tx_radio_buffer->bytes[14] = packet->control & 0xff;
+    if (control_len == 2)
+        tx_radio_buffer->bytes[15] = packet->control >> 8;
 
     // If we have a pid then set it here
-    if (header_len == 16)
-        tx_radio_buffer->bytes[15] = packet->pid;
+    if (header_len == 15 + control_len)
+        tx_radio_buffer->bytes[14 + control_len] = packet->pid;
 
     // If there are data bytes then add them here
      for (i = 0; i < packet->data_len; i++)
@@ -571,17 +963,37 @@ static bool tx_make_packet(AX25_PACKET *packet,
     return true;
 }
 
+/**
+ * tx_queue_radio_buffer()
+ * Put a frame that is ready to send on the TX queue for its class and
+ * wake the TxTask.  Returns false if the queue stayed full for
+ * xTicksToWait.
+ */
+bool tx_queue_radio_buffer(tx_radio_buffer_t *buffer, enum tx_class tx_class,
+                           TickType_t xTicksToWait)
+{
+    buffer->queued = xTaskGetTickCount();
+    if (xQueueSendToBack(xTxPacketQueue[tx_class], buffer,
+                         xTicksToWait) != pdPASS) {
+        queue_counters.dropped[tx_class]++;
+        return false;
+    }
+    if (tx_task_handle != NULL)
+        xTaskNotifyGive(tx_task_handle);
+    return true;
+}
+
 /**
  * tx_send_ui_packet()
- * Create and queue an AX25 packet on the TX queue
+ * Create and queue an AX25 packet on the TX queue for tx_class
  * from and to callsigns are strings with nul termination
  * pid byte is F0, BB or BD
  * bytes is a buffer of length len that is sent in the body of the packet
  * The TX takes are of HDLC framing and CRC
  */
 bool tx_send_ui_packet(char *from_callsign, char *to_callsign, uint8_t pid,
-                       uint8_t *bytes, int len, bool block,
-                       enum radio_modulation modulation)
+                       uint8_t *bytes, int len, enum tx_class tx_class,
+                       bool block, enum radio_modulation modulation)
 {
     tx_radio_buffer_t tmp_packet_buffer;
     //uint8_t raw_bytes[AX25_PKT_BUFFER_LEN];
@@ -592,9 +1004,7 @@ bool tx_send_ui_packet(char *from_callsign, char *to_callsign, uint8_t pid,
     if (block)
         xTicksToWait = CENTISECONDS(20);
 
-    BaseType_t xStatus = xQueueSendToBack(xTxPacketQueue, &tmp_packet_buffer,
-                                          xTicksToWait);
-    if (xStatus != pdPASS) {
+    if (!tx_queue_radio_buffer(&tmp_packet_buffer, tx_class, xTicksToWait)) {
         /* The send operation could not complete because the queue was full */
         debug_print("TX QUEUE FULL: Could not add UI frame to Packet Queue.\n");
         ReportError(TxPacketDropped, FALSE, CharString,
@@ -638,18 +1048,20 @@ bool tx_send_packet(AX25_PACKET *packet, bool expedited, bool block,
     //print_packet("TX_SEND: ", &tmp_packet_buffer[1], tmp_packet_buffer[0]);
 
     TickType_t xTicksToWait = 0;
-    BaseType_t xStatus = pdFAIL;
     if (block)
          // wait for about 255/1200 seconds, which is long enough to
          // clear a packet from TX or several packets at 9600bps.
         xTicksToWait = CENTISECONDS(20);
-    if (expedited)
-        xStatus = xQueueSendToFront(xTxPacketQueue, &tmp_packet_buffer,
-                                    xTicksToWait);
-    else
-        xStatus = xQueueSendToBack(xTxPacketQueue, &tmp_packet_buffer,
-                                   xTicksToWait);
-    if (xStatus != pdPASS) {
+
+    /*
+     * RR, RNR and REJ carry an N(R), so they stay in order with the I
+     * frames unless the caller expedites them.  UA and DM have none.
+     */
+    enum tx_class tx_class = TX_CLASS_CONNECTED;
+    if (expedited || packet->frame_type == TYPE_U_UA
+            || packet->frame_type == TYPE_U_DM)
+        tx_class = TX_CLASS_CONTROL;
+    if (!tx_queue_radio_buffer(&tmp_packet_buffer, tx_class, xTicksToWait)) {
         /*
          * The send operation could not complete because the queue was
          * full.  */
@@ -693,9 +1105,8 @@ bool tx_test_make_packet(uint32_t len)
         return false;
     }
 
-    BaseType_t xStatus = xQueueSendToBack(xTxPacketQueue, &tmp_packet_buffer,
-                                          CENTISECONDS(1));
-    if(xStatus != pdPASS) {
+    if (!tx_queue_radio_buffer(&tmp_packet_buffer, TX_CLASS_PB,
+                               CENTISECONDS(1))) {
         /* The send operation could not complete because the queue was full */
         debug_print("TX QUEUE FULL: Could not add to Packet Queue\n");
         success = false;
@@ -703,3 +1114,92 @@ bool tx_test_make_packet(uint32_t len)
 
     return success;
 }
+
+#ifdef DEBUG
+/**
+ * test_tx_priority()
+ *
+ * Run the queue selection with the PB saturated, as it is while a
+ * station downloads a file.  An ack must go next and telemetry must still
+ * get its turn.  Then print how long an ack waits behind the PB frames
+ * with the priority classes, counting the frames tx_next_class() picks
+ * ahead of it, and how long it waited when all the classes shared one
+ * queue.
+ */
+bool test_tx_priority()
+{
+    UBaseType_t waiting[TX_NUM_CLASSES];
+    uint8_t passed_over[TX_NUM_CLASSES];
+    uint32_t bit_rate = modulation_to_bit_rate(tx_modulation);
+    unsigned int frames_ahead, priority_frames_ahead;
+    bool rc = TRUE;
+    int i, c, telem_sent = 0;
+
+    debug_print("## SELF TEST: tx priority\n");
+    for (c = 0; c < TX_NUM_CLASSES; c++) {
+        waiting[c] = 0;
+        passed_over[c] = 0;
+    }
+
+    /* The PB and telemetry queues never empty */
+    waiting[TX_CLASS_PB] = TX_PB_QUEUE_LEN;
+    waiting[TX_CLASS_TELEMETRY] = 1;
+    for (i = 0; i < 2 * (TX_CLASS_MAX_PASSED_OVER + 1); i++)
+        if (tx_next_class(waiting, passed_over) == TX_CLASS_TELEMETRY)
+            telem_sent++;
+    if (telem_sent != 2) {
+        debug_print("** Telemetry sent %d times in %d frames\n", telem_sent, i);
+        rc = FALSE;
+    }
+
+    /* An RR from the uplink, then a UA */
+    waiting[TX_CLASS_CONNECTED] = 1;
+    c = tx_next_class(waiting, passed_over);
+    if (c != TX_CLASS_CONNECTED) {
+        debug_print("** RR behind class %d\n", c);
+        rc = FALSE;
+    }
+    waiting[TX_CLASS_CONTROL] = 1;
+    c = tx_next_class(waiting, passed_over);
+    if (c != TX_CLASS_CONTROL) {
+        debug_print("** UA behind class %d\n", c);
+        rc = FALSE;
+    }
+
+    for (c = 0; c < TX_NUM_CLASSES; c++)
+        waiting[c] = 0;
+    if (tx_next_class(waiting, passed_over) != TX_NUM_CLASSES) {
+        debug_print("** Nothing waiting but a class was picked\n");
+        rc = FALSE;
+    }
+
+    /*
+     * With one queue the PB kept up to one more frame than its busy
+     * limit queued, so an ack waited for them all to go.  With the
+     * classes it waits for the frame on the air and any frames picked
+     * ahead of it.
+     */
+    frames_ahead = MAX_PKTS_IN_TX_PKT_QUEUE_FOR_TNC_TO_BE_BUSY + 1;
+    for (c = 0; c < TX_NUM_CLASSES; c++)
+        passed_over[c] = 0;
+    waiting[TX_CLASS_PB] = TX_PB_QUEUE_LEN;
+    waiting[TX_CLASS_TELEMETRY] = 1;
+    waiting[TX_CLASS_CONNECTED] = 1;
+    priority_frames_ahead = 1; /* The frame on the air */
+    for (i = 0; i < TX_PB_QUEUE_LEN; i++) {
+        if (tx_next_class(waiting, passed_over) == TX_CLASS_CONNECTED)
+            break;
+        priority_frames_ahead++;
+    }
+    if (bit_rate != 0)
+        debug_print("Ack wait behind a saturated PB at %d bps: one queue=%d ms, priority queues=%d ms\n",
+                    bit_rate, frames_ahead * MAX_DATA_LEN * 8 * 1000 / bit_rate,
+                    priority_frames_ahead * MAX_DATA_LEN * 8 * 1000 / bit_rate);
+
+    if (rc)
+        debug_print("## PASSED SELF TEST: tx priority\n");
+    else
+        debug_print("## FAILED SELF TEST: tx priority\n");
+    return rc;
+}
+#endif
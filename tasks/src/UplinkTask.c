@@ -26,6 +26,7 @@
 #include "UplinkTask.h"
 #include "FreeRTOS.h"
 #include "os_task.h"
+#include "os_semphr.h"
 #include "MET.h"
 #include "inet.h"
 #include "nonvol.h"
@@ -36,26 +37,47 @@
 #include "ax25_util.h"
 #include "pacsat_dir.h"
 #include "str_util.h"
+#include "TelemAndControlTask.h"
 
 /* Forward functions */
 void ftl0_next_state_from_primitive(ftl0_state_machine_t *state, AX25_event_t *event);
+void ftl0_next_state(ftl0_state_machine_t *state, AX25_event_t *event);
+void ftl0_stream_data_indicate(ftl0_state_machine_t *state, AX25_event_t *event);
+void ftl0_stream_deliver(ftl0_state_machine_t *state, AX25_event_t *event, int type, uint8_t *info, int len);
+void ftl0_stream_reset(ftl0_state_machine_t *state);
 void ftl0_state_uninit(ftl0_state_machine_t *state, AX25_event_t *event);
 void ftl0_state_cmd_wait(ftl0_state_machine_t *state, AX25_event_t *event);
 void ftl0_state_cmd_ok(ftl0_state_machine_t *state, AX25_event_t *event);
 void ftl0_state_data_rx(ftl0_state_machine_t *state, AX25_event_t *event);
 void ftl0_state_abort(ftl0_state_machine_t *state, AX25_event_t *event);
 
-bool ftl0_send_event(AX25_event_t *received_event, AX25_event_t *send_event);
-bool ftl0_add_request(char *from_callsign, uint8_t channel);
-bool ftl0_remove_request(uint8_t channel);
-bool ftl0_connection_received(char *from_callsign, char *to_callsign, uint8_t channel);
-bool ftl0_disconnect(char *to_callsign, uint8_t channel);
-int ftl0_send_err(char *from_callsign, int channel, int err);
-int ftl0_send_ack(char *from_callsign, int channel);
-int ftl0_send_nak(char *from_callsign, int channel, int err);
+bool ftl0_send_event(uint8_t session, uint8_t channel, char *to_callsign, AX25_event_t *send_event);
+bool ftl0_add_request(char *from_callsign, uint8_t session, uint8_t channel);
+bool ftl0_remove_request(uint8_t session);
+bool ftl0_connection_received(char *from_callsign, char *to_callsign, uint8_t session, uint8_t channel);
+bool ftl0_disconnect(char *to_callsign, uint8_t session, uint8_t channel);
+int ftl0_send_err(char *to_callsign, uint8_t session, int channel, int err);
+int ftl0_send_ack(char *to_callsign, uint8_t session, int channel);
+int ftl0_send_nak(char *to_callsign, uint8_t session, int channel, int err);
 int ftl0_process_upload_cmd(ftl0_state_machine_t *state, uint8_t *data, int len);
 int ftl0_process_data_cmd(ftl0_state_machine_t *state, uint8_t *data, int len);
 int ftl0_process_data_end_cmd(ftl0_state_machine_t *state, uint8_t *data, int len);
+int ftl0_buffer_data(ftl0_state_machine_t *state, uint8_t *data, int len);
+int ftl0_flush_write_buffer(ftl0_state_machine_t *state, bool flush_all);
+int ftl0_close_upload_file(ftl0_state_machine_t *state);
+void ftl0_start_preallocation(ftl0_state_machine_t *state);
+bool ftl0_preallocate_step();
+int32_t ftl0_release_upload_space(char *file_name_with_path, uint32_t keep_length);
+uint32_t ftl0_get_space_not_preallocated();
+void ftl0_check_flow_control();
+bool ftl0_queue_finalize(ftl0_state_machine_t *state);
+void ftl0_finalize_session(uint8_t session);
+void ftl0_finalize_cancel_replies(uint8_t session);
+bool ftl0_finalize_step();
+int ftl0_commit_upload_file(uint32_t file_id, char *file_name_with_path);
+void ftl0_finalize_done(ftl0_finalize_job_t *job, int err);
+bool ftl0_send_flow_event(uint8_t session, AX25_primitive_t primitive);
+bool ftl0_upload_in_use(uint32_t file_id);
 
 int ftl0_make_packet(uint8_t *data_bytes, uint8_t *info, int length, int frame_type);
 int ftl0_parse_packet_type(uint8_t * data);
@@ -67,14 +89,72 @@ bool ftl0_update_file_upload_record(InProcessFileUpload_t * file_upload_record);
 bool ftl0_remove_file_upload_record(uint32_t id);
 bool ftl0_mram_get_file_upload_record(uint32_t id, InProcessFileUpload_t * file_upload_record);
 bool ftl0_mram_set_file_upload_record(uint32_t id, InProcessFileUpload_t * file_upload_record);
+bool ftl0_load_upload_table();
+void ftl0_rebuild_upload_index();
+int ftl0_find_upload_slot(uint32_t file_id);
+static void ftl0_lock_upload_table();
+static bool ftl0_set_file_upload_record_locked(InProcessFileUpload_t * file_upload_record);
+static void ftl0_unlock_upload_table();
+static bool ftl0_upload_table_ready();
 
 /* Local variables */
-static ftl0_state_machine_t ftl0_state_machine[NUM_RX_CHANNELS];
+static ftl0_state_machine_t ftl0_state_machine[AX25_MAX_SESSIONS]; /* Indexed by the AX25 session */
 static AX25_event_t ax25_event; /* Static storage for event */
 static AX25_event_t send_event_buffer;
+static AX25_event_t flow_event_buffer; /* Static storage for flow control events */
 static const MRAMmap_t *LocalFlash = (MRAMmap_t *) 0; /* Used to index the MRAM static storage where the File Upload Table is stored */
 static HEADER ftl0_pfh_buffer; // Static allocation of a header to use when we need to load/save the header details
 static uint8_t ftl0_pfh_byte_buffer[MAX_BYTES_IN_PACSAT_FILE_HEADER]; /* Buffer for the bytes in a PFH when we decode a received file */
+static uint8_t ftl0_stream_frame[AX25_MAX_INFO_BYTES_LEN]; /* Copy of the I-frame info while its FTL0 packets are processed */
+
+/*
+ * RAM copy of the File Upload Table in MRAM.  It is loaded once and then every write goes
+ * to both MRAM and this copy, so lookups do not need to read the MRAM over SPI.  The index
+ * maps a file id to its slot with a small open addressed hash table and the space reserved
+ * by the table is kept as a running total.
+ */
+#define FTL0_UPLOAD_INDEX_LEN 64 /* Power of 2 and more than twice MAX_IN_PROCESS_FILE_UPLOADS */
+static InProcessFileUpload_t ftl0_upload_table[MAX_IN_PROCESS_FILE_UPLOADS];
+static int8_t ftl0_upload_index[FTL0_UPLOAD_INDEX_LEN];
+static uint32_t ftl0_upload_table_reserved = 0;
+static bool ftl0_upload_table_loaded = FALSE;
+/* The table is used by the Uplink task, by ftl0_maintenance() in the Telemetry and Control task
+ * and for telemetry, so the load, the index and every read and write of the table are done with
+ * this held.  It is recursive because the table routines call each other. */
+static SemaphoreHandle_t ftl0_upload_table_mutex = NULL;
+
+/* Counters for the uploaded data and what it costs to store it.  The MRAM bytes include
+ * the file system metadata, so mram_bytes / bytes_received is the write amplification */
+static uint32_t ftl0_upload_bytes_received = 0; /* DATA bytes received from ground stations */
+static uint32_t ftl0_upload_bytes_written = 0; /* Bytes passed to the file system */
+static uint32_t ftl0_upload_writes = 0; /* Number of writes to the file system */
+static uint32_t ftl0_upload_mram_bytes = 0; /* MRAM bytes written by the file system for those writes */
+static uint32_t ftl0_upload_bytes_preallocated = 0; /* Bytes reserved on disk by writing zeros ahead of the DATA */
+static uint32_t ftl0_upload_bytes_released = 0; /* Preallocated bytes given back when an upload stopped early */
+
+/* Flow control.  When the events waiting for this task reach the high watermark the data links are
+ * asked to send RNR, so I frames wait at the ground station rather than being lost in full queues.
+ * They are turned back on at the low watermark. */
+static bool ftl0_flow_off[AX25_MAX_SESSIONS]; /* DL_FLOW_OFF_Request has been sent to this session */
+static uint32_t ftl0_flow_off_count = 0; /* Number of times flow control engaged */
+static uint32_t ftl0_flow_off_ticks = 0; /* Total time flow control was engaged */
+static TickType_t ftl0_flow_off_time = 0; /* When flow control last engaged */
+static UBaseType_t ftl0_flow_max_backlog = 0; /* Most events we have seen waiting */
+
+/* Files waiting for validation and commit after DATA_END.  The head of the queue is worked on a
+ * piece at a time between events, so one long file does not hold up the other channels. */
+static ftl0_finalize_job_t ftl0_finalize_queue[UPLINK_FINALIZE_QUEUE_LEN];
+static uint8_t ftl0_finalize_head = 0;
+static uint8_t ftl0_finalize_count = 0;
+static uint8_t ftl0_finalize_buffer[FTL0_WRITE_BUFFER_LEN]; /* Body bytes being checked, or the zeros for a preallocation step */
+static uint32_t ftl0_finalize_queued = 0; /* Files queued for finalize */
+static uint32_t ftl0_finalize_failed = 0; /* Files that were NAKed after the checks */
+static uint8_t ftl0_finalize_max_depth = 0; /* Most files we have seen waiting */
+
+/* Set while a session still has zeros to write ahead of its DATA.  One buffer is written per pass of
+ * the task loop, so a large file does not hold up the other channels. */
+static bool ftl0_preallocate_pending = FALSE;
+static uint8_t ftl0_preallocate_next = 0; /* The session to look at first, so they take turns */
 
 #ifdef DEBUG
 /* This decodes the AX25 error numbers.  Only used for debug. */
@@ -112,14 +192,25 @@ portTASK_FUNCTION_PROTO(UplinkTask, pvParameters)  {
     ReportToWatchdog(UplinkTaskWD);
 //    debug_print("Initializing Uplink FTL0 Task\n");
 
+    int session;
+    for (session = 0; session < AX25_MAX_SESSIONS; session++) {
+        ftl0_state_machine[session].session = session;
+        ftl0_state_machine[session].fp = -1;
+        ftl0_state_machine[session].buffer_len = 0;
+        ftl0_state_machine[session].preallocated = FALSE;
+        ftl0_flow_off[session] = FALSE;
+    }
 
     while(1) {
         ReportToWatchdog(UplinkTaskWD);
-        BaseType_t xStatus = xQueueReceive( xUplinkEventQueue, &ax25_event, CENTISECONDS(1) );  // Wait to see if data available
+        /* Do not wait for an event if there are files to finalize or preallocate */
+        TickType_t wait = (ftl0_finalize_count != 0 || ftl0_preallocate_pending) ? 0 : CENTISECONDS(1);
+        BaseType_t xStatus = xQueueReceive( xUplinkEventQueue, &ax25_event, wait );  // Wait to see if data available
+        ftl0_check_flow_control();
         if( xStatus == pdPASS ) {
-            if (ax25_event.rx_channel >= NUM_RX_CHANNELS) {
+            if (ax25_event.session >= AX25_MAX_SESSIONS) {
                 // something is seriously wrong.  Programming error.  Unlikely to occur in flight
-                debug_print("ERR: AX25 channel %d is invalid\n",ax25_event.rx_channel);
+                debug_print("ERR: AX25 session %d is invalid\n",ax25_event.session);
             } else {
 //                trace_ftl0("Received event: %d\n",ax25_event.primitive);
 
@@ -129,10 +220,14 @@ portTASK_FUNCTION_PROTO(UplinkTask, pvParameters)  {
                         case ERROR_F : {
                             trace_ftl0("FTL0[%d]: DATA LINK RESET from AX25\n",ax25_event.rx_channel);
                             // We don't off load the callsign, we just reset the state machine
-                            ftl0_state_machine[ax25_event.rx_channel].ul_state = UL_CMD_OK;
-                            ftl0_state_machine[ax25_event.rx_channel].file_id = 0;
-                            ftl0_state_machine[ax25_event.rx_channel].request_time = 0;
-                            ftl0_state_machine[ax25_event.rx_channel].length = 0;
+                            ftl0_close_upload_file(&ftl0_state_machine[ax25_event.session]);
+                            ftl0_flow_off[ax25_event.session] = FALSE; // The reset cleared own receiver busy
+                            ftl0_finalize_cancel_replies(ax25_event.session);
+                            ftl0_stream_reset(&ftl0_state_machine[ax25_event.session]);
+                            ftl0_state_machine[ax25_event.session].ul_state = UL_CMD_OK;
+                            ftl0_state_machine[ax25_event.session].file_id = 0;
+                            ftl0_state_machine[ax25_event.session].request_time = 0;
+                            ftl0_state_machine[ax25_event.session].length = 0;
                             break;
                         }
                         default : {
@@ -142,10 +237,12 @@ portTASK_FUNCTION_PROTO(UplinkTask, pvParameters)  {
                     }
                 } else {
                     ReportToWatchdog(UplinkTaskWD);
-                    ftl0_next_state_from_primitive(&ftl0_state_machine[ax25_event.rx_channel], &ax25_event);
+                    ftl0_next_state_from_primitive(&ftl0_state_machine[ax25_event.session], &ax25_event);
                 }
             }
         }
+        ftl0_finalize_step();
+        ftl0_preallocate_pending = ftl0_preallocate_step();
 
     }
 }
@@ -168,6 +265,23 @@ error or packet again and again.
 
 */
 void ftl0_next_state_from_primitive(ftl0_state_machine_t *state, AX25_event_t *event) {
+    if (event->primitive == DL_DATA_Indicate) {
+        /* Send the ACK or NAK for an earlier file before we process anything else from this station */
+        ftl0_finalize_session(event->session);
+        /* The I-frame is split into FTL0 packets, which are each passed to the state machine */
+        ftl0_stream_data_indicate(state, event);
+        return;
+    }
+    ftl0_next_state(state, event);
+}
+
+/**
+ * ftl0_next_state()
+ *
+ * Process one event through the state machine.  For DL_DATA_Indicate the event holds exactly one
+ * FTL0 packet, or part of a DATA packet presented as a shorter DATA packet.
+ */
+void ftl0_next_state(ftl0_state_machine_t *state, AX25_event_t *event) {
     switch (state->ul_state) {
         case UL_UNINIT : {
             ftl0_state_uninit(state, event);
@@ -194,6 +308,100 @@ void ftl0_next_state_from_primitive(ftl0_state_machine_t *state, AX25_event_t *e
     }
 }
 
+/**
+ * ftl0_stream_data_indicate()
+ *
+ * FTL0 runs over the AX25 connection as a byte stream, so a packet does not have to line up with
+ * an I-frame.  A station may split a packet across several I-frames or put several packets in one.
+ * The bytes are parsed here with a small state held for each channel.  The 2 byte header is
+ * collected first.  The body of a DATA packet is passed on straight away as a shorter DATA packet,
+ * so a long DATA packet does not need to be held in RAM.  DATA is just a run of bytes at the next
+ * offset, so this is the same to the state machine.  Other packets are held in rx_info until they
+ * are complete.  Anything longer than we expect from a client is passed on with just its header,
+ * which the state machine rejects, and the rest of the frame is discarded.
+ */
+void ftl0_stream_data_indicate(ftl0_state_machine_t *state, AX25_event_t *event) {
+    if (state->ul_state == UL_UNINIT) {
+        ftl0_next_state(state, event); // Not connected, so there is no stream to parse
+        return;
+    }
+    int len = event->packet.data_len;
+    if (len > AX25_MAX_INFO_BYTES_LEN)
+        len = AX25_MAX_INFO_BYTES_LEN;
+    /* The packets are written back into the event, so work from a copy of the frame */
+    memcpy(ftl0_stream_frame, event->packet.data, len);
+
+    int i = 0;
+    while (i < len) {
+        if (state->rx_header_len < 2) {
+            state->rx_header[state->rx_header_len++] = ftl0_stream_frame[i++];
+            if (state->rx_header_len < 2)
+                continue;
+            state->rx_remaining = ftl0_parse_packet_length(state->rx_header);
+            state->rx_info_len = 0;
+            int type = ftl0_parse_packet_type(state->rx_header);
+            if (type != DATA && state->rx_remaining > FTL0_MAX_RX_INFO_LEN) {
+                trace_ftl0("FTL0[%d]: FTL0 packet type %d too long: %d\n",state->channel, type, state->rx_remaining);
+                /* Pass on just the header so the state machine sees the bad length and rejects it */
+                event->packet.data[0] = state->rx_header[0];
+                event->packet.data[1] = state->rx_header[1];
+                event->packet.data_len = 2;
+                ftl0_stream_reset(state);
+                ftl0_next_state(state, event);
+                return;
+            }
+        } else {
+            int type = ftl0_parse_packet_type(state->rx_header);
+            int n = len - i;
+            if (n > state->rx_remaining)
+                n = state->rx_remaining;
+            if (type == DATA) {
+                state->rx_remaining -= n;
+                ftl0_stream_deliver(state, event, DATA, &ftl0_stream_frame[i], n);
+            } else {
+                memcpy(&state->rx_info[state->rx_info_len], &ftl0_stream_frame[i], n);
+                state->rx_info_len += n;
+                state->rx_remaining -= n;
+            }
+            i += n;
+        }
+        if (state->rx_header_len == 2 && state->rx_remaining == 0) {
+            int type = ftl0_parse_packet_type(state->rx_header);
+            state->rx_header_len = 0;
+            /* DATA has already been passed on, unless it was empty, which the state machine rejects */
+            if (type != DATA || ftl0_parse_packet_length(state->rx_header) == 0)
+                ftl0_stream_deliver(state, event, type, state->rx_info, state->rx_info_len);
+        }
+        if (state->ul_state == UL_UNINIT) {
+            /* The station was removed, so the rest of the frame is not for anyone */
+            ftl0_stream_reset(state);
+            return;
+        }
+    }
+}
+
+/**
+ * ftl0_stream_deliver()
+ *
+ * Put a complete FTL0 packet into the event and pass it to the state machine.
+ */
+void ftl0_stream_deliver(ftl0_state_machine_t *state, AX25_event_t *event, int type, uint8_t *info, int len) {
+    ftl0_make_packet(event->packet.data, info, len, type);
+    event->packet.data_len = len + 2;
+    ftl0_next_state(state, event);
+}
+
+/**
+ * ftl0_stream_reset()
+ *
+ * Discard any partly received FTL0 packet.  Called when the connection starts or ends or is reset
+ */
+void ftl0_stream_reset(ftl0_state_machine_t *state) {
+    state->rx_header_len = 0;
+    state->rx_remaining = 0;
+    state->rx_info_len = 0;
+}
+
 /**
  * The Uplink is idle and waiting for a connection
  */
@@ -208,18 +416,18 @@ void ftl0_state_uninit(ftl0_state_machine_t *state, AX25_event_t *event) {
         case DL_DISCONNECT_Indicate :
         case DL_DISCONNECT_Confirm : {
             trace_ftl0("Disconnected from Layer 2\n");
-            ftl0_remove_request(event->rx_channel);
+            ftl0_remove_request(event->session);
             break;
         }
         /* We receive either a CONNECT Indicate or a CONNECT Confirm.  We only get the confirm if the Uplink initiated the request  */
         case DL_CONNECT_Indicate : {
             trace_ftl0("Connection from Layer 2\n");
-            ftl0_connection_received(event->packet.from_callsign, event->packet.to_callsign, event->rx_channel);
+            ftl0_connection_received(event->packet.from_callsign, event->packet.to_callsign, event->session, event->rx_channel);
             break;
         }
         case DL_CONNECT_Confirm : {
             trace_ftl0("Connection from Layer 2 Confirmed\n");
-            ftl0_connection_received(event->packet.from_callsign, event->packet.to_callsign, event->rx_channel);
+            ftl0_connection_received(event->packet.from_callsign, event->packet.to_callsign, event->session, event->rx_channel);
             break;
         }
         default : {
@@ -241,15 +449,15 @@ void ftl0_state_cmd_ok(ftl0_state_machine_t *state, AX25_event_t *event) {
         case DL_DISCONNECT_Indicate :
         case DL_DISCONNECT_Confirm : {
             trace_ftl0("Disconnected from Layer 2\n");
-            ftl0_remove_request(event->rx_channel);
+            ftl0_remove_request(event->session);
             break;
         }
         case DL_CONNECT_Indicate :
         case DL_CONNECT_Confirm : {
             trace_ftl0("Connection from Layer 2\n");
             // Perhaps the other end missed the connection and was still trying.  Send the CMD OK message again.
-            ftl0_remove_request(event->rx_channel); // remove them first
-            ftl0_connection_received(event->packet.from_callsign, event->packet.to_callsign, event->rx_channel);
+            ftl0_remove_request(event->session); // remove them first
+            ftl0_connection_received(event->packet.from_callsign, event->packet.to_callsign, event->session, event->rx_channel);
             break;
         }
         case DL_DATA_Indicate : {
@@ -257,13 +465,13 @@ void ftl0_state_cmd_ok(ftl0_state_machine_t *state, AX25_event_t *event) {
             int rc;
             int ftl0_type = ftl0_parse_packet_type(event->packet.data);
             if (ftl0_type >= MAX_PACKET_ID) {
-                rc = ftl0_send_err(event->packet.from_callsign, event->rx_channel, ER_ILL_FORMED_CMD);
+                rc = ftl0_send_err(event->packet.from_callsign, event->session, event->rx_channel, ER_ILL_FORMED_CMD);
                 if (rc != TRUE) {
                     /* We likely could not send the error.  Something serious has gone wrong.
                      * Not much we can do as we are going to offload the request anyway */
                 }
-                ftl0_disconnect(state->callsign, state->channel);
-                ftl0_remove_request(state->channel);
+                ftl0_disconnect(state->callsign, state->session, state->channel);
+                ftl0_remove_request(state->session);
             }
             trace_ftl0("FTL0[%d]: %s: UL_CMD_OK - %s\n",state->channel, state->callsign, ftl0_packet_type_names[ftl0_type]);
 
@@ -279,12 +487,12 @@ void ftl0_state_cmd_ok(ftl0_state_machine_t *state, AX25_event_t *event) {
                         // All is good
                     } else {
                         // send the error
-                        rc = ftl0_send_err(event->packet.from_callsign, event->rx_channel, err);
+                        rc = ftl0_send_err(event->packet.from_callsign, event->session, event->rx_channel, err);
                         if (rc != TRUE) {
                             /* We likely could not send the error.  Something serious has gone wrong.
                              * But the best we can do is remove the station and return the error code. */
-                            ftl0_disconnect(state->callsign, state->channel);
-                            ftl0_remove_request(state->channel);
+                            ftl0_disconnect(state->callsign, state->session, state->channel);
+                            ftl0_remove_request(state->session);
                             break;
                         }
                         // If we sent error successfully then we stay in state UL_CMD_OK and the station can try another file
@@ -298,8 +506,8 @@ void ftl0_state_cmd_ok(ftl0_state_machine_t *state, AX25_event_t *event) {
                 }
                 default: {
                     trace_ftl0("FTL0: Unknown FTL0 command %d\n",ftl0_type);
-                    ftl0_disconnect(state->callsign, state->channel);
-                    ftl0_remove_request(state->channel);
+                    ftl0_disconnect(state->callsign, state->session, state->channel);
+                    ftl0_remove_request(state->session);
                     break;
                 }
             }
@@ -308,8 +516,8 @@ void ftl0_state_cmd_ok(ftl0_state_machine_t *state, AX25_event_t *event) {
         }
         default : {
             trace_ftl0(".. Unexpected packet or event, disconnect\n");
-            ftl0_disconnect(state->callsign, event->rx_channel);
-            ftl0_remove_request(state->channel);
+            ftl0_disconnect(state->callsign, event->session, event->rx_channel);
+            ftl0_remove_request(state->session);
             break;
         }
     }
@@ -361,7 +569,7 @@ void ftl0_state_data_rx(ftl0_state_machine_t *state, AX25_event_t *event) {
         case DL_DISCONNECT_Indicate :
         case DL_DISCONNECT_Confirm : {
             trace_ftl0("Disconnected from Layer 2\n");
-            ftl0_remove_request(event->rx_channel);
+            ftl0_remove_request(event->session);
             break;
         }
         case DL_DATA_Indicate : {
@@ -369,13 +577,13 @@ void ftl0_state_data_rx(ftl0_state_machine_t *state, AX25_event_t *event) {
             int rc;
             int ftl0_type = ftl0_parse_packet_type(event->packet.data);
             if (ftl0_type >= MAX_PACKET_ID) {
-                rc = ftl0_send_err(event->packet.from_callsign, event->rx_channel, ER_ILL_FORMED_CMD);
+                rc = ftl0_send_err(event->packet.from_callsign, event->session, event->rx_channel, ER_ILL_FORMED_CMD);
                 if (rc != TRUE) {
                     /* We likely could not send the error.  Something serious has gone wrong.
                      * Not much we can do as we are going to offload the request anyway */
                 }
-                ftl0_disconnect(state->callsign, state->channel);
-                ftl0_remove_request(state->channel);
+                ftl0_disconnect(state->callsign, state->session, state->channel);
+                ftl0_remove_request(state->session);
             }
             trace_ftl0("FTL0[%d]: Layer 2 Data from %s: in FTL0 Packet: %s\n",state->channel, state->callsign, ftl0_packet_type_names[ftl0_type]);
 
@@ -386,12 +594,12 @@ void ftl0_state_data_rx(ftl0_state_machine_t *state, AX25_event_t *event) {
                     int err = ftl0_process_data_cmd(state, event->packet.data, event->packet.data_len);
                     if (err != ER_NONE) {
                         // send the error - per the FTL0 Spec, this should be a NAK not an ERROR.
-                        rc = ftl0_send_nak(event->packet.from_callsign, event->rx_channel, err);
+                        rc = ftl0_send_nak(event->packet.from_callsign, event->session, event->rx_channel, err);
                         if (rc != TRUE) {
                             /* We likely could not send the error.  Something serious has gone wrong.
                              * But the best we can do is remove the station and return the error code. */
-                            ftl0_disconnect(state->callsign, state->channel);
-                            ftl0_remove_request(state->channel);
+                            ftl0_disconnect(state->callsign, state->session, state->channel);
+                            ftl0_remove_request(state->session);
                             break;
                         }
                         // If we sent error successfully then we stay in state UL_DATA_RX and the station can send more data
@@ -401,7 +609,11 @@ void ftl0_state_data_rx(ftl0_state_machine_t *state, AX25_event_t *event) {
                     InProcessFileUpload_t file_upload_record;
                     if (ftl0_get_file_upload_record(state->file_id, &file_upload_record) ) {
                         file_upload_record.request_time = getUnixTime(); // this is updated when we receive data
-                        file_upload_record.offset = state->offset;
+                        /* Only what has been written to the file is recorded, not what is still in the
+                         * write buffer, so a continue after a reset does not skip it.  A preallocated file
+                         * is already full length on disk, so its offset is only moved when it is closed. */
+                        if (!state->preallocated)
+                            file_upload_record.offset = state->buffer_offset;
                         if (!ftl0_update_file_upload_record(&file_upload_record) ) {
                             debug_print("Unable to update upload record in MRAM\n");
                             // do not treat this as fatal because the file can still be uploaded
@@ -414,24 +626,24 @@ void ftl0_state_data_rx(ftl0_state_machine_t *state, AX25_event_t *event) {
                     int err = ftl0_process_data_end_cmd(state, event->packet.data, event->packet.data_len);
                     if (err != ER_NONE) {
                         //debug_print(" FTL0[%d] SENDING %s NAK for file %04x\n",state->channel, state->callsign, state->file_id);
-                        rc = ftl0_send_nak(event->packet.from_callsign, event->rx_channel, err);
+                        rc = ftl0_send_nak(event->packet.from_callsign, event->session, event->rx_channel, err);
+                        if (!ftl0_remove_file_upload_record(state->file_id))  {
+                            debug_print(" FTL0[%d] Could not remove upload record for %s file id %04x\n",state->channel, state->callsign, state->file_id);
+                        }
                     } else {
-                        //debug_print(" FTL0[%d] SENDING %s ACK for file %04x\n",state->channel, state->callsign, state->file_id);
-                        rc = ftl0_send_ack(event->packet.from_callsign, event->rx_channel);
-                    }
-                    if (!ftl0_remove_file_upload_record(state->file_id))  {
-                        debug_print(" FTL0[%d] Could not remove upload record for %s file id %04x\n",state->channel, state->callsign, state->file_id);
+                        /* The file is queued and the ACK or NAK is sent when it has been checked and committed */
+                        rc = TRUE;
                     }
                     state->ul_state = UL_CMD_OK;
                     if (rc != TRUE) {
-                        ftl0_disconnect(state->callsign, state->channel);
-                        ftl0_remove_request(state->channel);
+                        ftl0_disconnect(state->callsign, state->session, state->channel);
+                        ftl0_remove_request(state->session);
                     }
                     break;
                 }
                 default : {
-                    ftl0_disconnect(state->callsign, state->channel);
-                    ftl0_remove_request(state->channel);
+                    ftl0_disconnect(state->callsign, state->session, state->channel);
+                    ftl0_remove_request(state->session);
                     break;
                 }
             }
@@ -440,8 +652,8 @@ void ftl0_state_data_rx(ftl0_state_machine_t *state, AX25_event_t *event) {
         }
         default : {
             trace_ftl0(".. Unexpected packet or event, disconnect\n");
-            ftl0_disconnect(state->callsign, event->rx_channel);
-            ftl0_remove_request(state->channel);
+            ftl0_disconnect(state->callsign, event->session, event->rx_channel);
+            ftl0_remove_request(state->session);
             break;
         }
     }
@@ -454,7 +666,7 @@ void ftl0_state_abort(ftl0_state_machine_t *state, AX25_event_t *event) {
         case DL_DISCONNECT_Indicate :
         case DL_DISCONNECT_Confirm : {
             trace_ftl0("Disconnected from Layer 2\n");
-            ftl0_remove_request(event->rx_channel);
+            ftl0_remove_request(event->session);
             break;
         }
         case DL_DATA_Indicate : {
@@ -463,35 +675,53 @@ void ftl0_state_abort(ftl0_state_machine_t *state, AX25_event_t *event) {
         }
         default : {
             trace_ftl0(".. Unexpected packet or event, disconnect\n");
-            ftl0_disconnect(state->callsign, event->rx_channel);
-            ftl0_remove_request(state->channel);
+            ftl0_disconnect(state->callsign, event->session, event->rx_channel);
+            ftl0_remove_request(state->session);
             break;
         }
     }
 }
 
 /**
- * Send event to the data link state machine (Layer 2)
+ * Send event to the data link state machine (Layer 2) for the station to_callsign on this session and channel.
  * The Event type and any attached packet should already be set in the send_event
  *
  */
-bool ftl0_send_event(AX25_event_t *received_event, AX25_event_t *send_event) {
-    send_event->rx_channel = received_event->rx_channel;
+bool ftl0_send_event(uint8_t session, uint8_t channel, char *to_callsign, AX25_event_t *send_event) {
+    send_event->session = session;
+    send_event->rx_channel = channel;
     send_event->primitive = DL_DATA_Request;
     send_event->packet.frame_type = TYPE_I;
-    strlcpy(send_event->packet.to_callsign, received_event->packet.from_callsign, MAX_CALLSIGN_LEN);
+    strlcpy(send_event->packet.to_callsign, to_callsign, MAX_CALLSIGN_LEN);
     strlcpy(send_event->packet.from_callsign, BBS_CALLSIGN, MAX_CALLSIGN_LEN);
 
     if (send_event->primitive == DL_DATA_Request) {
-        // Add data events directly to the iFrame Queue
-        BaseType_t xStatus = xQueueSendToBack( xIFrameQueue[received_event->rx_channel], send_event, CENTISECONDS(1) );
+        // Add data events directly to the iFrame Queue.  The queue holds a
+        // handle to the frame in the AX25 packet pool, not a copy.  Only the
+        // backlog is used for new frames, so there is always room to put a
+        // whole window back on the queue when frames are sent again.
+        if (uxQueueMessagesWaiting(xIFrameQueue[session]) >= IFRAME_QUEUE_BACKLOG) {
+            debug_print("I FRAME QUEUE FULL: Could not add to Event Queue for channel %d\n",channel);
+            return FALSE;
+        }
+        AX25_PACKET_HANDLE iframe = ax25_packet_alloc();
+        if (iframe == AX25_NO_PACKET) {
+            debug_print("AX25 PACKET POOL EMPTY: Could not add to Event Queue for channel %d\n",channel);
+            ReportError(RTOSfailure, FALSE, CharString,
+                              (int)"ERROR: AX25 packet pool empty");
+            return FALSE;
+        }
+        *ax25_packet(iframe) = send_event->packet;
+        BaseType_t xStatus = xQueueSendToBack( xIFrameQueue[session], &iframe, CENTISECONDS(1) );
         if( xStatus != pdPASS ) {
             /* The send operation could not complete because the queue was full */
-            debug_print("I FRAME QUEUE FULL: Could not add to Event Queue for channel %d\n",received_event->rx_channel);
+            ax25_packet_release(iframe);
+            debug_print("I FRAME QUEUE FULL: Could not add to Event Queue for channel %d\n",channel);
             ReportError(RTOSfailure, FALSE, CharString,
                               (int)"ERROR: Could not add to Event Queue");
             return FALSE;
         }
+        ax25_wake();
     } else {
         // All other events are added to the event Queue
         BaseType_t xStatus = xQueueSendToBack( xRxEventQueue, send_event, CENTISECONDS(1) );
@@ -503,6 +733,7 @@ bool ftl0_send_event(AX25_event_t *received_event, AX25_event_t *send_event) {
             return FALSE;
         } else {
             trace_ftl0("FTL0[%d]: Sending Event %d\n",send_event->rx_channel, send_event->primitive);
+            ax25_wake();
         }
     }
     return TRUE;
@@ -522,7 +753,7 @@ bool ftl0_send_event(AX25_event_t *received_event, AX25_event_t *send_event) {
  * returns EXIT_SUCCESS it it succeeds or EXIT_FAILURE if the PB is shut or full
  *
  */
-bool ftl0_add_request(char *from_callsign, uint8_t channel) {
+bool ftl0_add_request(char *from_callsign, uint8_t session, uint8_t channel) {
     if (!ReadMRAMBoolState(StateUplinkEnabled)) {
         trace_ftl0("FTL0: Uplink closed\n");
         return FALSE;
@@ -530,7 +761,7 @@ bool ftl0_add_request(char *from_callsign, uint8_t channel) {
 
     int i;
     /* Each station can only be on the Uplink once, so reject if the callsign is already in the list */
-    for (i=0; i < NUM_CHANNELS; i++) {
+    for (i=0; i < AX25_MAX_SESSIONS; i++) {
         if (ftl0_state_machine[i].ul_state != UL_UNINIT) {
             if (strcasecmp(ftl0_state_machine[i].callsign, from_callsign) == 0) {
                 trace_ftl0("FTL0: %s is already on the uplink\n",from_callsign);
@@ -539,40 +770,51 @@ bool ftl0_add_request(char *from_callsign, uint8_t channel) {
         }
     }
 
-//    trace_ftl0("FTL0 Connecting %s\n",ftl0_state_machine[channel].callsign);
-    strlcpy(ftl0_state_machine[channel].callsign, from_callsign, MAX_CALLSIGN_LEN);
-    ftl0_state_machine[channel].ul_state = UL_CMD_OK;
-    ftl0_state_machine[channel].channel = channel;
-    ftl0_state_machine[channel].file_id = 0; // Set once the UPLD packet received
-    ftl0_state_machine[channel].request_time = getUnixTime(); // for timeout
-    ftl0_state_machine[channel].offset = 0; // Set when UPLD packet received
-    ftl0_state_machine[channel].length = 0; // Set when UPLD packet received
-
+//    trace_ftl0("FTL0 Connecting %s\n",ftl0_state_machine[session].callsign);
+    strlcpy(ftl0_state_machine[session].callsign, from_callsign, MAX_CALLSIGN_LEN);
+    ftl0_state_machine[session].ul_state = UL_CMD_OK;
+    ftl0_state_machine[session].channel = channel;
+    ftl0_state_machine[session].file_id = 0; // Set once the UPLD packet received
+    ftl0_state_machine[session].request_time = getUnixTime(); // for timeout
+    ftl0_state_machine[session].offset = 0; // Set when UPLD packet received
+    ftl0_state_machine[session].length = 0; // Set when UPLD packet received
+    ftl0_stream_reset(&ftl0_state_machine[session]);
+
+    tac_uplink_status_changed(); // send the uplink status now that this session is busy
     return TRUE;
 }
 
 /**
  * ftl0_remove_request()
  *
- * Remove the callsign / channel
+ * Remove the callsign / session
  *
  *
  * return TRUE unless there is no item to remove.
  *
  */
-bool ftl0_remove_request(uint8_t channel) {
+bool ftl0_remove_request(uint8_t session) {
 #ifdef TRACE_FTL0
     uint32_t now = getSeconds();
-    int duration = (int)(now - ftl0_state_machine[channel].request_time);
-    trace_ftl0("FTL0 Disconnecting %s - connected for %d seconds\n",ftl0_state_machine[channel].callsign, duration);
+    int duration = (int)(now - ftl0_state_machine[session].request_time);
+    trace_ftl0("FTL0 Disconnecting %s - connected for %d seconds\n",ftl0_state_machine[session].callsign, duration);
 #endif
-    /* Remove the item */
-    ftl0_state_machine[channel].ul_state = UL_UNINIT;
-    ftl0_state_machine[channel].file_id = 0;
-    ftl0_state_machine[channel].request_time = 0;
-    ftl0_state_machine[channel].length = 0;
-    ftl0_state_machine[channel].callsign[0] = 0;
+    /* Save anything we have received so far, so the station can continue the upload later */
+    ftl0_close_upload_file(&ftl0_state_machine[session]);
+    ftl0_flow_off[session] = FALSE;
+    ftl0_finalize_cancel_replies(session);
 
+    /* Remove the item */
+    ftl0_state_machine[session].ul_state = UL_UNINIT;
+    ftl0_state_machine[session].file_id = 0;
+    ftl0_state_machine[session].request_time = 0;
+    ftl0_state_machine[session].length = 0;
+    ftl0_state_machine[session].callsign[0] = 0;
+    ftl0_stream_reset(&ftl0_state_machine[session]);
+
+    /* This is also called when Layer 2 confirms the disconnect, so the status
+     * is refreshed once the session is actually free */
+    tac_uplink_status_changed();
     return TRUE;
 }
 
@@ -618,17 +860,17 @@ variables to UL_CMD_WAIT
  * other stations can see who has logged in??
  *
  */
-bool ftl0_connection_received(char *from_callsign, char *to_callsign, uint8_t channel) {
+bool ftl0_connection_received(char *from_callsign, char *to_callsign, uint8_t session, uint8_t channel) {
     //trace_ftl0("FTL0: Connection for File Upload from: %s\n",from_callsign);
 
     uint32_t now = getUnixTime(); // Get the time in seconds since the unix epoch
 
     /* Add the request, which initializes their uplink state machine. At this point we don't know the
      * file number, offset or dir node */
-    bool rc = ftl0_add_request(from_callsign, channel);
+    bool rc = ftl0_add_request(from_callsign, session, channel);
     if (rc == FALSE){
         /* We could not add this request, either full or already on the uplink.  Disconnect. */
-        ftl0_disconnect(from_callsign, channel);
+        ftl0_disconnect(from_callsign, session, channel);
         return FALSE;
     } else {
         trace_ftl0("FTL0: Added %s to uplink list\n",from_callsign);
@@ -654,7 +896,7 @@ bool ftl0_connection_received(char *from_callsign, char *to_callsign, uint8_t ch
 
     send_event_buffer.packet.data_len = sizeof(login_data)+2;
 
-    rc = ftl0_send_event(&ax25_event, &send_event_buffer);
+    rc = ftl0_send_event(session, channel, from_callsign, &send_event_buffer);
 
     if (rc != TRUE) {
         // TODO Disconnect??  Retry??  ftl0_send_event() has already logged the error
@@ -670,7 +912,7 @@ bool ftl0_connection_received(char *from_callsign, char *to_callsign, uint8_t ch
      * but there is not much we can do about that. */
     if (now < CLOCK_MIN_UNIX_SECS) {
         debug_print("** Could not login %s as the clock is not set\n", from_callsign);
-        ftl0_disconnect(from_callsign, channel);
+        ftl0_disconnect(from_callsign, session, channel);
         return FALSE;
     }
 
@@ -678,17 +920,84 @@ bool ftl0_connection_received(char *from_callsign, char *to_callsign, uint8_t ch
 }
 
 
+/**
+ * ftl0_check_flow_control()
+ *
+ * Called each time round the task loop.  Count the events still waiting for us and turn the
+ * flow off on every connected channel at the high watermark and back on at the low watermark.
+ */
+void ftl0_check_flow_control() {
+    int session;
+    UBaseType_t backlog = uxQueueMessagesWaiting(xUplinkEventQueue);
+    if (backlog > ftl0_flow_max_backlog)
+        ftl0_flow_max_backlog = backlog;
+    bool any_off = FALSE;
+    for (session = 0; session < AX25_MAX_SESSIONS; session++)
+        if (ftl0_flow_off[session]) any_off = TRUE;
+
+    if (!any_off && backlog >= UPLINK_FLOW_OFF_HIGH_WATERMARK) {
+        for (session = 0; session < AX25_MAX_SESSIONS; session++) {
+            if (ftl0_state_machine[session].ul_state != UL_UNINIT) {
+                if (ftl0_send_flow_event(session, DL_FLOW_OFF_Request)) {
+                    ftl0_flow_off[session] = TRUE;
+                    any_off = TRUE;
+                }
+            }
+        }
+        if (any_off) {
+            trace_ftl0("FTL0: Flow OFF with %d events waiting\n", backlog);
+            ftl0_flow_off_count++;
+            ftl0_flow_off_time = xTaskGetTickCount();
+        }
+    } else if (any_off && backlog <= UPLINK_FLOW_ON_LOW_WATERMARK) {
+        /* A session stays off if the FLOW_ON can not be sent and is tried again next time round */
+        bool still_off = FALSE;
+        for (session = 0; session < AX25_MAX_SESSIONS; session++) {
+            if (ftl0_flow_off[session]) {
+                if (ftl0_send_flow_event(session, DL_FLOW_ON_Request))
+                    ftl0_flow_off[session] = FALSE;
+                else
+                    still_off = TRUE;
+            }
+        }
+        if (!still_off) {
+            trace_ftl0("FTL0: Flow ON with %d events waiting\n", backlog);
+            ftl0_flow_off_ticks += xTaskGetTickCount() - ftl0_flow_off_time;
+        }
+    }
+}
+
+/**
+ * ftl0_send_flow_event()
+ *
+ * Send DL_FLOW_OFF_Request or DL_FLOW_ON_Request to the Data Link State Machine for a session.
+ * These go on the event queue, unlike data, which goes directly on the I frame queue.
+ */
+bool ftl0_send_flow_event(uint8_t session, AX25_primitive_t primitive) {
+    flow_event_buffer.session = session;
+    flow_event_buffer.rx_channel = ftl0_state_machine[session].channel;
+    flow_event_buffer.primitive = primitive;
+    flow_event_buffer.error_num = NO_ERROR;
+    BaseType_t xStatus = xQueueSendToBack( xRxEventQueue, &flow_event_buffer, CENTISECONDS(1) );
+    if( xStatus != pdPASS ) {
+        debug_print("RX Event QUEUE FULL: Could not send flow control for session %d\n",session);
+        return FALSE;
+    }
+    ax25_wake();
+    return TRUE;
+}
+
 /**
  * ftl0_disconnect()
  *
  * Disconnect from the station specified in to_callsign
  *
  */
-bool ftl0_disconnect(char *to_callsign, uint8_t channel) {
+bool ftl0_disconnect(char *to_callsign, uint8_t session, uint8_t channel) {
     trace_ftl0("FTL0: Disconnecting: %s\n", to_callsign);
     send_event_buffer.primitive = DL_DISCONNECT_Request;
 
-    bool rc = ftl0_send_event(&ax25_event, &send_event_buffer);
+    bool rc = ftl0_send_event(session, channel, to_callsign, &send_event_buffer);
 
     if (rc != TRUE) {
         debug_print("Could not send FTL0 Disconnect Event to Data Link State Machine \n");
@@ -697,7 +1006,7 @@ bool ftl0_disconnect(char *to_callsign, uint8_t channel) {
     return TRUE;
 }
 
-int ftl0_send_err(char *from_callsign, int channel, int err) {
+int ftl0_send_err(char *to_callsign, uint8_t session, int channel, int err) {
     int frame_type = UL_ERROR_RESP;
     uint8_t err_info[1];
     err_info[0] = err;
@@ -709,7 +1018,7 @@ int ftl0_send_err(char *from_callsign, int channel, int err) {
     }
     send_event_buffer.packet.data_len = sizeof(err_info)+2;
 
-    rc = ftl0_send_event(&ax25_event, &send_event_buffer);
+    rc = ftl0_send_event(session, channel, to_callsign, &send_event_buffer);
     if (rc != TRUE) {
         debug_print("Could not send FTL0 ERR packet to TNC \n");
         return FALSE;
@@ -720,7 +1029,7 @@ int ftl0_send_err(char *from_callsign, int channel, int err) {
 }
 
 
-int ftl0_send_ack(char *from_callsign, int channel) {
+int ftl0_send_ack(char *to_callsign, uint8_t session, int channel) {
     int frame_type = UL_ACK_RESP;
 
     int rc = ftl0_make_packet(send_event_buffer.packet.data, (uint8_t *)NULL, 0, frame_type);
@@ -730,7 +1039,7 @@ int ftl0_send_ack(char *from_callsign, int channel) {
     }
     send_event_buffer.packet.data_len = 2;
 
-    rc = ftl0_send_event(&ax25_event, &send_event_buffer);
+    rc = ftl0_send_event(session, channel, to_callsign, &send_event_buffer);
     if (rc != TRUE) {
         debug_print("Could not send FTL0 ACK packet to TNC \n");
         return FALSE;
@@ -740,7 +1049,7 @@ int ftl0_send_ack(char *from_callsign, int channel) {
     return TRUE;
 }
 
-int ftl0_send_nak(char *from_callsign, int channel, int err) {
+int ftl0_send_nak(char *to_callsign, uint8_t session, int channel, int err) {
     int frame_type = UL_NAK_RESP;
     uint8_t err_info[1];
     err_info[0] = err;
@@ -752,7 +1061,7 @@ int ftl0_send_nak(char *from_callsign, int channel, int err) {
     }
     send_event_buffer.packet.data_len = sizeof(err_info)+2;
 
-    rc = ftl0_send_event(&ax25_event, &send_event_buffer);
+    rc = ftl0_send_event(session, channel, to_callsign, &send_event_buffer);
     if (rc != TRUE) {
         debug_print("Could not send FTL0 NAK packet to TNC \n");
         return FALSE;
@@ -785,6 +1094,9 @@ file.
  */
 int ftl0_process_upload_cmd(ftl0_state_machine_t *state, uint8_t *data, int len) {
 
+    /* Make sure nothing is left open from a previous upload on this channel */
+    ftl0_close_upload_file(state);
+
     int ftl0_length = ftl0_parse_packet_length(data);
     if (ftl0_length != 8)
         return ER_ILL_FORMED_CMD;
@@ -816,8 +1128,9 @@ int ftl0_process_upload_cmd(ftl0_state_machine_t *state, uint8_t *data, int len)
         } else {
             uint32_t available = redstatfs.f_frsize * redstatfs.f_bfree;
 
-            /* Need to check all the partially uploaded files to see what remaining space they have claimed. */
-            uint32_t upload_table_space = ftl0_get_space_reserved_by_upload_table();
+            /* Need to check all the partially uploaded files to see what remaining space they have claimed.  Files
+             * that are preallocated already hold their space on disk, so they are not counted twice. */
+            uint32_t upload_table_space = ftl0_get_space_not_preallocated();
 
             trace_ftl0("File length: %d. Upload table: %d  Disk has Free blocks: %d of %d.  Free Bytes: %d\n",state->length, upload_table_space, redstatfs.f_bfree, redstatfs.f_blocks, available);
             if ((state->length + upload_table_space + UPLOAD_SPACE_THRESHOLD) > available )
@@ -849,9 +1162,15 @@ int ftl0_process_upload_cmd(ftl0_state_machine_t *state, uint8_t *data, int len)
             debug_print("Unable to close %s: %s\n", file_name_with_path, red_strerror(red_errno));
         }
 
+        /* Reserve the whole file, so the blocks are contiguous rather than interleaved with
+         * other uploads as the DATA arrives.  The zeros are written in the background. */
+        if (ReadMRAMBoolState(StateFTL0Preallocate))
+            ftl0_start_preallocation(state);
+
         /* Store in an upload table record.  The state will now contain all the details */
          InProcessFileUpload_t file_upload_record;
          strlcpy(file_upload_record.callsign,state->callsign, sizeof(file_upload_record.callsign));
+         file_upload_record.preallocated = state->preallocated;
          file_upload_record.file_id = state->file_id;
          file_upload_record.length = state->length;
          file_upload_record.request_time = state->request_time;
@@ -936,13 +1255,31 @@ int ftl0_process_upload_cmd(ftl0_state_machine_t *state, uint8_t *data, int len)
             return ER_NO_SUCH_FILE_NUMBER;
         } else {
             state->offset = off;
-            trace_ftl0("FTL0[%d]: Continuing file %04x at offset %d\n",state->channel, state->file_id, state->offset);
         }
         rc = red_close(fp);
         if (rc != 0) {
             debug_print("Unable to close %s: %s\n", file_name_with_path, red_strerror(red_errno));
         }
 
+        /* A file longer than the upload record is still preallocated, e.g. after a reset.  Anything past the
+         * recorded offset was not committed, so release it and continue from the record. */
+        if (state->offset > upload_record.offset) {
+            if (ftl0_release_upload_space(file_name_with_path, upload_record.offset) == -1)
+                return ER_NO_SUCH_FILE_NUMBER;
+            state->offset = upload_record.offset;
+        }
+        trace_ftl0("FTL0[%d]: Continuing file %04x at offset %d\n",state->channel, state->file_id, state->offset);
+
+        if (ReadMRAMBoolState(StateFTL0Preallocate)) {
+            ftl0_start_preallocation(state);
+            if (state->preallocated && !upload_record.preallocated) {
+                upload_record.preallocated = TRUE;
+                if (!ftl0_update_file_upload_record(&upload_record) ) {
+                    debug_print("Unable to update upload record in MRAM\n");
+                }
+            }
+        }
+
         ul_go_data.server_file_no = htotl(state->file_id);
         ul_go_data.byte_offset = htotl(state->offset); // this is the end of the file so far
     }
@@ -955,7 +1292,11 @@ int ftl0_process_upload_cmd(ftl0_state_machine_t *state, uint8_t *data, int len)
 
     send_event_buffer.packet.data_len = sizeof(ul_go_data)+2;
 
-    rc = ftl0_send_event(&ax25_event, &send_event_buffer);
+    /* DATA is buffered from the offset we tell the station to start at */
+    state->buffer_offset = state->offset;
+    state->buffer_len = 0;
+
+    rc = ftl0_send_event(state->session, state->channel, state->callsign, &send_event_buffer);
     if (rc != TRUE) {
         debug_print("Could not send FTL0 UL GO packet to TNC \n");
         return ER_NO_ROOM; // This means the queue was full.
@@ -991,14 +1332,15 @@ int ftl0_process_data_cmd(ftl0_state_machine_t *state, uint8_t *data, int len) {
     }
 
     unsigned char * data_bytes = (unsigned char *)data + 2; /* Point to the data just past the header */
+    ftl0_upload_bytes_received += ftl0_length;
 
-    char file_name_with_path[MAX_FILENAME_WITH_PATH_LEN];
-    dir_get_upload_file_path_from_file_id(state->file_id, file_name_with_path, MAX_FILENAME_WITH_PATH_LEN);
-
-    int32_t rc = dir_fs_write_file_chunk(file_name_with_path, data_bytes, ftl0_length, state->offset);
-    if (rc == -1) {
+    /* The data is buffered and written in block aligned runs, rather than opening, writing and
+     * closing the file for every packet.  The buffer is flushed and the file closed when
+     * DATA_END is received or the station disconnects. */
+    int err = ftl0_buffer_data(state, data_bytes, ftl0_length);
+    if (err != ER_NONE) {
         debug_print("FTL0[%d]:File I/O error writing chunk\n",state->channel);
-        return ER_NO_ROOM; // This is most likely caused by running out of file ids or space
+        return err; // This is most likely caused by running out of file ids or space
     }
 
     state->offset += ftl0_length;
@@ -1021,60 +1363,190 @@ int ftl0_process_data_end_cmd(ftl0_state_machine_t *state, uint8_t *data, int le
         return ER_BAD_HEADER; /* This will cause a NAK to be sent as the data is corrupt in some way */
     }
 
-    char file_name_with_path[MAX_FILENAME_WITH_PATH_LEN];
-    dir_get_upload_file_path_from_file_id(state->file_id, file_name_with_path, MAX_FILENAME_WITH_PATH_LEN);
+    /* Write any buffered data and close the file so it is committed before we check it */
+    int err = ftl0_close_upload_file(state);
+    if (err != ER_NONE) {
+        return err;
+    }
 
-    /* We can't call dir_load_pacsat_file() here because we want to check the tmp file first, then
-     * add the file after we rename it. So we validate it. */
+    /* The file is checked and added to the directory by ftl0_finalize_step(), which sends the ACK or NAK */
+    if (!ftl0_queue_finalize(state)) {
+        return ER_NO_ROOM;
+    }
+    return ER_NONE;
+}
 
-    // Read enough of the file to parse the PFH
-    int32_t rc = dir_fs_read_file_chunk(file_name_with_path, ftl0_pfh_byte_buffer, sizeof(ftl0_pfh_byte_buffer), 0);
-    if (rc == -1) {
-        debug_print("Error reading file: %s\n",file_name_with_path);
-        ReportToWatchdog(UplinkTaskWD);
-        return ER_NO_SUCH_FILE_NUMBER;
+/**
+ * ftl0_queue_finalize()
+ *
+ * Add the file on this channel to the queue of files waiting to be validated and added to the
+ * directory.  If the queue is full, the oldest file is finished first to make room.
+ */
+bool ftl0_queue_finalize(ftl0_state_machine_t *state) {
+    while (ftl0_finalize_count == UPLINK_FINALIZE_QUEUE_LEN) {
+        if (!ftl0_finalize_step())
+            return FALSE;
     }
-    ReportToWatchdog(UplinkTaskWD);
-    uint16_t size;
-    bool crc_passed = FALSE;
-    pfh_extract_header(&ftl0_pfh_buffer, ftl0_pfh_byte_buffer, sizeof(ftl0_pfh_byte_buffer), &size, &crc_passed);
-    if (!crc_passed) {
-        /* Header is invalid */
-        trace_ftl0("FTL0[%d] ** Header check failed for file: %s\n",state->channel, file_name_with_path);
-        int32_t fp = red_unlink(file_name_with_path);
-        if (fp == -1) {
-            debug_print("Unable to remove tmp file: %s : %s\n", file_name_with_path, red_strerror(red_errno));
+    /* The queue is changed with the upload table locked, so ftl0_maintenance() sees the file is still in use */
+    ftl0_lock_upload_table();
+    ftl0_finalize_job_t *job = &ftl0_finalize_queue[(ftl0_finalize_head + ftl0_finalize_count) % UPLINK_FINALIZE_QUEUE_LEN];
+    job->session = state->session;
+    job->channel = state->channel;
+    job->send_reply = TRUE;
+    strlcpy(job->callsign, state->callsign, MAX_CALLSIGN_LEN);
+    job->file_id = state->file_id;
+    job->fp = -1;
+    job->offset = 0;
+    job->body_size = 0;
+    job->body_checksum = 0;
+    ftl0_finalize_count++;
+    ftl0_unlock_upload_table();
+    ftl0_finalize_queued++;
+    if (ftl0_finalize_count > ftl0_finalize_max_depth)
+        ftl0_finalize_max_depth = ftl0_finalize_count;
+    return TRUE;
+}
+
+/**
+ * ftl0_finalize_session()
+ *
+ * Finish any file from this session that is still waiting for its ACK or NAK.  This is called
+ * before we process more data from the station, so that the reply is sent before anything
+ * that follows it, as FTL0 expects.  Files queued before it are finished first.
+ */
+void ftl0_finalize_session(uint8_t session) {
+    int i;
+    bool waiting = TRUE;
+    while (waiting) {
+        waiting = FALSE;
+        for (i=0; i < ftl0_finalize_count; i++) {
+            ftl0_finalize_job_t *job = &ftl0_finalize_queue[(ftl0_finalize_head + i) % UPLINK_FINALIZE_QUEUE_LEN];
+            if (job->session == session && job->send_reply)
+                waiting = TRUE;
         }
-        ReportToWatchdog(UplinkTaskWD);
-        return ER_BAD_HEADER;
+        if (waiting && !ftl0_finalize_step())
+            return;
+    }
+}
+
+/**
+ * ftl0_finalize_cancel_replies()
+ *
+ * The station on this session has gone or the link was reset, so do not send it the ACK or NAK
+ * for files still in the queue.  The files are still added to the directory if they are good, and
+ * a later continue gets ER_FILE_COMPLETE.
+ */
+void ftl0_finalize_cancel_replies(uint8_t session) {
+    int i;
+    for (i=0; i < ftl0_finalize_count; i++) {
+        ftl0_finalize_job_t *job = &ftl0_finalize_queue[(ftl0_finalize_head + i) % UPLINK_FINALIZE_QUEUE_LEN];
+        if (job->session == session)
+            job->send_reply = FALSE;
     }
+}
+
+/**
+ * ftl0_finalize_step()
+ *
+ * Do the next piece of work for the file at the head of the finalize queue.  The first call
+ * checks the header, each following call checks one buffer of the body and the last one
+ * renames the file and adds it to the directory.  We can process events from the other
+ * channels between the steps, rather than waiting for the whole file.
+ *
+ * Returns TRUE if work was done and FALSE if the queue is empty.
+ */
+bool ftl0_finalize_step() {
+    if (ftl0_finalize_count == 0)
+        return FALSE;
+    ftl0_finalize_job_t *job = &ftl0_finalize_queue[ftl0_finalize_head];
     ReportToWatchdog(UplinkTaskWD);
 
-    int err = dir_validate_file(&ftl0_pfh_buffer, file_name_with_path, UplinkTaskWD);
+    char file_name_with_path[MAX_FILENAME_WITH_PATH_LEN];
+    dir_get_upload_file_path_from_file_id(job->file_id, file_name_with_path, MAX_FILENAME_WITH_PATH_LEN);
+
+    if (job->fp == -1) {
+        /* We can't call dir_load_pacsat_file() here because we want to check the tmp file first, then
+         * add the file after we rename it. So we validate it. */
+
+        // Read enough of the file to parse the PFH
+        int32_t rc = dir_fs_read_file_chunk(file_name_with_path, ftl0_pfh_byte_buffer, sizeof(ftl0_pfh_byte_buffer), 0);
+        if (rc == -1) {
+            debug_print("Error reading file: %s\n",file_name_with_path);
+            ftl0_finalize_done(job, ER_NO_SUCH_FILE_NUMBER);
+            return TRUE;
+        }
+        uint16_t size;
+        bool crc_passed = FALSE;
+        pfh_extract_header(&ftl0_pfh_buffer, ftl0_pfh_byte_buffer, sizeof(ftl0_pfh_byte_buffer), &size, &crc_passed);
+        if (!crc_passed) {
+            /* Header is invalid */
+            trace_ftl0("FTL0[%d] ** Header check failed for file: %s\n",job->channel, file_name_with_path);
+            if (red_unlink(file_name_with_path) == -1) {
+                debug_print("Unable to remove tmp file: %s : %s\n", file_name_with_path, red_strerror(red_errno));
+            }
+            ftl0_finalize_done(job, ER_BAD_HEADER);
+            return TRUE;
+        }
+        job->offset = ftl0_pfh_buffer.bodyOffset;
+        job->fp = red_open(file_name_with_path, RED_O_RDONLY);
+        if (job->fp == -1 || red_lseek(job->fp, job->offset, RED_SEEK_SET) == -1) {
+            debug_print("Unable to open %s to check the body: %s\n", file_name_with_path, red_strerror(red_errno));
+            ftl0_finalize_done(job, ER_NO_SUCH_FILE_NUMBER);
+        }
+        return TRUE;
+    }
+
+    /* Check the next part of the body */
+    int32_t num_of_bytes_read = red_read(job->fp, ftl0_finalize_buffer, sizeof(ftl0_finalize_buffer));
+    if (num_of_bytes_read == -1) {
+        debug_print("Unable to read %s: %s\n", file_name_with_path, red_strerror(red_errno));
+        ftl0_finalize_done(job, ER_NO_SUCH_FILE_NUMBER);
+        return TRUE;
+    }
+    dir_validate_body_chunk(ftl0_finalize_buffer, num_of_bytes_read, &job->body_checksum, &job->body_size);
+    job->offset += num_of_bytes_read;
+    if (num_of_bytes_read == sizeof(ftl0_finalize_buffer))
+        return TRUE; // more to check
+
+    if (red_close(job->fp) != 0) {
+        debug_print("Unable to close %s: %s\n", file_name_with_path, red_strerror(red_errno));
+    }
+    job->fp = -1;
+
+    int err = dir_validate_body(&ftl0_pfh_buffer, job->body_checksum, job->body_size, file_name_with_path);
     if (err != ER_NONE) {
-        trace_ftl0("FTL0[%d] ** File validation failed for file: %s\n",state->channel, file_name_with_path);
-        int32_t fp = red_unlink(file_name_with_path);
-        if (fp == -1) {
+        trace_ftl0("FTL0[%d] ** File validation failed for file: %s\n",job->channel, file_name_with_path);
+        if (red_unlink(file_name_with_path) == -1) {
             debug_print("Unable to remove tmp file: %s : %s\n", file_name_with_path, red_strerror(red_errno));
             ReportError(REDFSIOerror, FALSE, CharString,
                                    (int)"ERROR: Disk IO Error removing failed file after uploading");
         }
-        ReportToWatchdog(UplinkTaskWD);
-        return err;
+        ftl0_finalize_done(job, err);
+        return TRUE;
     }
     ReportToWatchdog(UplinkTaskWD);
+    ftl0_finalize_done(job, ftl0_commit_upload_file(job->file_id, file_name_with_path));
+    return TRUE;
+}
 
-    /* Otherwise this looks good.  Rename the file by linking a new name and removing the old name. Then
-     * add it to the directory. */
+/**
+ * ftl0_commit_upload_file()
+ *
+ * The tmp file has passed its checks.  Rename the file by linking a new name and removing the old
+ * name. Then add it to the directory.  ftl0_pfh_buffer holds its header.
+ *
+ * Returns ER_NONE or the error to NAK with.
+ */
+int ftl0_commit_upload_file(uint32_t file_id, char *file_name_with_path) {
     /* Note that we are renaming the file before we know that the ground station has received an ACK
            That is OK as long as we handle the situation where the ground station tries to finish the upload
            and we no longer have the tmp file.  This is handled in process_upload_command() where ER_FILE_COMPLETE
            is sent.
      */
     char new_file_name_with_path[MAX_FILENAME_WITH_PATH_LEN];
-    dir_get_file_path_from_file_id(state->file_id, DIR_FOLDER, new_file_name_with_path, MAX_FILENAME_WITH_PATH_LEN);
+    dir_get_file_path_from_file_id(file_id, DIR_FOLDER, new_file_name_with_path, MAX_FILENAME_WITH_PATH_LEN);
 
-    rc = red_link(file_name_with_path, new_file_name_with_path);
+    int32_t rc = red_link(file_name_with_path, new_file_name_with_path);
     if (rc == -1) {
         debug_print("Unable to link new file: %s : %s\n", new_file_name_with_path, red_strerror(red_errno));
         ReportError(REDFSIOerror, FALSE, CharString,
@@ -1092,7 +1564,7 @@ int ftl0_process_data_end_cmd(ftl0_state_machine_t *state, uint8_t *data, int le
 
     /* We pass just the filename without the path into the dir add function */
     char file_id_str[5];
-    dir_get_filename_from_file_id(state->file_id, file_id_str, sizeof(file_id_str));
+    dir_get_filename_from_file_id(file_id, file_id_str, sizeof(file_id_str));
     DIR_NODE *p = dir_add_pfh(file_id_str, &ftl0_pfh_buffer);
     if (p == NULL) {
         debug_print("** Could not add %s to dir\n", new_file_name_with_path);
@@ -1120,6 +1592,330 @@ int ftl0_process_data_end_cmd(ftl0_state_machine_t *state, uint8_t *data, int le
     return ER_NONE;
 }
 
+/**
+ * ftl0_finalize_done()
+ *
+ * Send the ACK or NAK for the file at the head of the finalize queue, remove its upload record
+ * and take it off the queue.
+ */
+void ftl0_finalize_done(ftl0_finalize_job_t *job, int err) {
+    if (job->fp != -1) {
+        red_close(job->fp);
+        job->fp = -1;
+    }
+    if (err != ER_NONE)
+        ftl0_finalize_failed++;
+    if (job->send_reply) {
+        int rc;
+        if (err != ER_NONE) {
+            //debug_print(" FTL0[%d] SENDING %s NAK for file %04x\n",job->channel, job->callsign, job->file_id);
+            rc = ftl0_send_nak(job->callsign, job->session, job->channel, err);
+        } else {
+            //debug_print(" FTL0[%d] SENDING %s ACK for file %04x\n",job->channel, job->callsign, job->file_id);
+            rc = ftl0_send_ack(job->callsign, job->session, job->channel);
+        }
+        if (rc != TRUE) {
+            ftl0_disconnect(job->callsign, job->session, job->channel);
+            ftl0_remove_request(job->session);
+        }
+    }
+    /* The job held the upload record until now.  Remove it and the job together. */
+    ftl0_lock_upload_table();
+    if (!ftl0_remove_file_upload_record(job->file_id))  {
+        debug_print(" FTL0[%d] Could not remove upload record for %s file id %04x\n",job->channel, job->callsign, job->file_id);
+    }
+    ftl0_finalize_head = (ftl0_finalize_head + 1) % UPLINK_FINALIZE_QUEUE_LEN;
+    ftl0_finalize_count--;
+    ftl0_unlock_upload_table();
+}
+
+/**
+ * ftl0_buffer_data()
+ *
+ * Add received DATA bytes to the write buffer for this channel.  Each time the buffer
+ * fills, the block aligned part of it is written to the tmp file, which is kept open.
+ * The first run may be shorter if a continued upload starts part way through a block.
+ *
+ * Returns ER_NONE or the error to NAK with.
+ */
+int ftl0_buffer_data(ftl0_state_machine_t *state, uint8_t *data, int len) {
+    while (len > 0) {
+        int n = FTL0_WRITE_BUFFER_LEN - state->buffer_len;
+        if (n > len)
+            n = len;
+        memcpy(state->write_buffer + state->buffer_len, data, n);
+        state->buffer_len += n;
+        data += n;
+        len -= n;
+        if (state->buffer_len == FTL0_WRITE_BUFFER_LEN) {
+            int err = ftl0_flush_write_buffer(state, FALSE);
+            if (err != ER_NONE)
+                return err;
+        }
+    }
+    return ER_NONE;
+}
+
+/**
+ * ftl0_flush_write_buffer()
+ *
+ * Write the buffered bytes to the tmp file.  Only whole blocks are written unless
+ * flush_all is set, in which case any partial block at the end is written too.  The
+ * file is opened if it is not already open.
+ *
+ * If the write fails then the buffer is discarded, the file is closed and the offset
+ * is set back to the end of the data on disk.  Returns ER_NONE or ER_NO_ROOM.
+ */
+int ftl0_flush_write_buffer(ftl0_state_machine_t *state, bool flush_all) {
+    if (state->buffer_len == 0)
+        return ER_NONE;
+
+    uint32_t n = state->buffer_len;
+    if (!flush_all) {
+        uint32_t end = state->buffer_offset + state->buffer_len;
+        uint32_t aligned_end = end - (end % REDCONF_BLOCK_SIZE);
+        if (aligned_end <= state->buffer_offset)
+            return ER_NONE; // Not yet a full block
+        n = aligned_end - state->buffer_offset;
+    }
+
+    char file_name_with_path[MAX_FILENAME_WITH_PATH_LEN];
+    dir_get_upload_file_path_from_file_id(state->file_id, file_name_with_path, MAX_FILENAME_WITH_PATH_LEN);
+
+    uint32_t mram_bytes = getBytesWrittenNV(NVFileSystem);
+    if (state->fp == -1) {
+        state->fp = red_open(file_name_with_path, RED_O_CREAT | RED_O_WRONLY);
+        if (state->fp == -1) {
+            debug_print("Unable to open %s for writing: %s\n", file_name_with_path, red_strerror(red_errno));
+            state->offset = state->buffer_offset;
+            state->buffer_len = 0;
+            return ER_NO_ROOM;
+        }
+        if (state->buffer_offset != 0) {
+            int32_t rc = red_lseek(state->fp, state->buffer_offset, RED_SEEK_SET);
+            if (rc == -1) {
+                debug_print("Unable to seek %s to offset %d: %s\n", file_name_with_path, state->buffer_offset, red_strerror(red_errno));
+                state->buffer_len = 0;
+                ftl0_close_upload_file(state);
+                state->offset = state->buffer_offset;
+                return ER_NO_ROOM;
+            }
+        }
+    }
+
+    int32_t written = red_write(state->fp, state->write_buffer, n);
+    ftl0_upload_mram_bytes += getBytesWrittenNV(NVFileSystem) - mram_bytes;
+    ftl0_upload_writes++;
+    if (written != n) {
+        debug_print("Unable to write %d bytes to %s: %s\n", n, file_name_with_path, red_strerror(red_errno));
+        if (written > 0) {
+            ftl0_upload_bytes_written += written;
+            state->buffer_offset += written;
+        }
+        state->buffer_len = 0;
+        ftl0_close_upload_file(state);
+        state->offset = state->buffer_offset;
+        return ER_NO_ROOM;
+    }
+    ftl0_upload_bytes_written += n;
+
+    /* Keep any partial block for the next write */
+    state->buffer_len -= n;
+    state->buffer_offset += n;
+    if (state->buffer_len > 0)
+        memmove(state->write_buffer, state->write_buffer + n, state->buffer_len);
+    return ER_NONE;
+}
+
+/**
+ * ftl0_close_upload_file()
+ *
+ * Write anything left in the buffer and close the tmp file.  The close is a transaction
+ * point, so after this the data is safe on disk.  This is called when DATA_END is
+ * received, when the station disconnects or times out and when the data link is reset.
+ *
+ * Returns ER_NONE or ER_NO_ROOM if the buffered data could not be written.
+ */
+int ftl0_close_upload_file(ftl0_state_machine_t *state) {
+    int err = ER_NONE;
+    if (state->buffer_len > 0 && state->file_id != 0)
+        err = ftl0_flush_write_buffer(state, TRUE);
+    state->buffer_len = 0;
+    if (state->fp != -1) {
+        uint32_t mram_bytes = getBytesWrittenNV(NVFileSystem);
+        int32_t rc = red_close(state->fp);
+        ftl0_upload_mram_bytes += getBytesWrittenNV(NVFileSystem) - mram_bytes;
+        if (rc != 0) {
+            debug_print("FTL0[%d]: Unable to close upload file: %s\n", state->channel, red_strerror(red_errno));
+        }
+        state->fp = -1;
+    }
+    if (state->preallocated) {
+        /* Give back the space we reserved but did not receive */
+        char file_name_with_path[MAX_FILENAME_WITH_PATH_LEN];
+        dir_get_upload_file_path_from_file_id(state->file_id, file_name_with_path, MAX_FILENAME_WITH_PATH_LEN);
+        ftl0_release_upload_space(file_name_with_path, state->buffer_offset);
+        state->preallocated = FALSE;
+    }
+    if (state->file_id != 0) {
+        /* Record what is now committed on disk, including the buffer we just flushed */
+        InProcessFileUpload_t file_upload_record;
+        if (ftl0_get_file_upload_record(state->file_id, &file_upload_record)
+                && (file_upload_record.offset != state->buffer_offset || file_upload_record.preallocated)) {
+            file_upload_record.offset = state->buffer_offset;
+            file_upload_record.preallocated = FALSE;
+            if (!ftl0_update_file_upload_record(&file_upload_record) ) {
+                debug_print("Unable to update upload record in MRAM\n");
+            }
+        }
+    }
+    return err;
+}
+
+/**
+ * ftl0_start_preallocation()
+ *
+ * Start extending the tmp file with zeros from the current offset to the promised length.
+ * Reliance Edge has no fallocate and a truncate that extends a file leaves it sparse, so the
+ * blocks are reserved by writing them.  ftl0_preallocate_step() writes the zeros a buffer at
+ * a time ahead of the DATA, which then overwrites them in place.  The caller marks the upload
+ * record as preallocated.
+ */
+void ftl0_start_preallocation(ftl0_state_machine_t *state) {
+    if (state->offset >= state->length)
+        return;
+    state->prealloc_offset = state->offset;
+    state->preallocated = TRUE;
+    ftl0_preallocate_pending = TRUE;
+}
+
+/**
+ * ftl0_preallocate_step()
+ *
+ * Write the next buffer of zeros for one of the sessions that is preallocating.  The zeros
+ * always go past the data already written to the file, so the DATA is never overwritten.
+ * The tmp file is opened if needed and left at the offset the next DATA write expects.
+ *
+ * If the file can not be extended, the zeros are released and the rest of the file is
+ * allocated as the DATA arrives instead.
+ *
+ * Returns TRUE if there is more to write.
+ */
+bool ftl0_preallocate_step() {
+    int i;
+    ftl0_state_machine_t *state = NULL;
+    for (i=0; i < AX25_MAX_SESSIONS; i++) {
+        ftl0_state_machine_t *s = &ftl0_state_machine[(ftl0_preallocate_next + i) % AX25_MAX_SESSIONS];
+        if (s->preallocated && s->file_id != 0 && s->prealloc_offset < s->length) {
+            state = s;
+            break;
+        }
+    }
+    if (state == NULL)
+        return FALSE;
+    ftl0_preallocate_next = (state->session + 1) % AX25_MAX_SESSIONS;
+    ReportToWatchdog(UplinkTaskWD);
+
+    char file_name_with_path[MAX_FILENAME_WITH_PATH_LEN];
+    dir_get_upload_file_path_from_file_id(state->file_id, file_name_with_path, MAX_FILENAME_WITH_PATH_LEN);
+
+    if (state->prealloc_offset < state->buffer_offset)
+        state->prealloc_offset = state->buffer_offset;
+    uint32_t n = state->length - state->prealloc_offset;
+    if (n > sizeof(ftl0_finalize_buffer))
+        n = sizeof(ftl0_finalize_buffer);
+
+    int32_t rc = 0;
+    if (state->fp == -1) {
+        state->fp = red_open(file_name_with_path, RED_O_CREAT | RED_O_WRONLY);
+        if (state->fp == -1)
+            rc = -1;
+    }
+    uint32_t mram_bytes = getBytesWrittenNV(NVFileSystem);
+    if (rc != -1)
+        rc = red_lseek(state->fp, state->prealloc_offset, RED_SEEK_SET);
+    if (rc != -1) {
+        memset(ftl0_finalize_buffer, 0, n);
+        if (red_write(state->fp, ftl0_finalize_buffer, n) != n)
+            rc = -1;
+    }
+    ftl0_upload_mram_bytes += getBytesWrittenNV(NVFileSystem) - mram_bytes;
+    if (rc != -1)
+        rc = red_lseek(state->fp, state->buffer_offset, RED_SEEK_SET);
+    if (rc == -1) {
+        debug_print("Unable to preallocate %d bytes for %s: %s\n", state->length - state->prealloc_offset, file_name_with_path, red_strerror(red_errno));
+        if (state->fp != -1) {
+            red_ftruncate(state->fp, state->buffer_offset);
+            red_lseek(state->fp, state->buffer_offset, RED_SEEK_SET);
+        }
+        ftl0_upload_bytes_released += state->prealloc_offset - state->buffer_offset;
+        state->prealloc_offset = state->length;
+        state->preallocated = FALSE;
+        return TRUE;
+    }
+    state->prealloc_offset += n;
+    ftl0_upload_bytes_preallocated += n;
+    return TRUE;
+}
+
+/**
+ * ftl0_release_upload_space()
+ *
+ * Truncate a tmp file to keep_length if it is longer, which frees any preallocated space
+ * past the data that was received.  Returns the length of the file or -1 if there is an error.
+ */
+int32_t ftl0_release_upload_space(char *file_name_with_path, uint32_t keep_length) {
+    int32_t fp = red_open(file_name_with_path, RED_O_WRONLY);
+    if (fp == -1) {
+        debug_print("Unable to open %s to release space: %s\n", file_name_with_path, red_strerror(red_errno));
+        return -1;
+    }
+    int32_t off = red_lseek(fp, 0, RED_SEEK_END);
+    if (off != -1 && off > keep_length) {
+        if (red_ftruncate(fp, keep_length) == -1) {
+            debug_print("Unable to truncate %s: %s\n", file_name_with_path, red_strerror(red_errno));
+            off = -1;
+        } else {
+            ftl0_upload_bytes_released += off - keep_length;
+            off = keep_length;
+        }
+    }
+    if (red_close(fp) != 0) {
+        debug_print("Unable to close %s: %s\n", file_name_with_path, red_strerror(red_errno));
+    }
+    return off;
+}
+
+/**
+ * ftl0_get_space_not_preallocated()
+ *
+ * Return the space reserved by the upload table that is not yet allocated on disk.  Uploads
+ * in progress that are preallocated already hold the zeros they have written, so they are not
+ * counted twice.  The space is released when the file is closed.
+ */
+uint32_t ftl0_get_space_not_preallocated() {
+    uint32_t space = 0;
+    int i, j;
+    ftl0_lock_upload_table();
+    if (ftl0_upload_table_ready()) {
+        for (i=0; i < MAX_IN_PROCESS_FILE_UPLOADS; i++) {
+            InProcessFileUpload_t *rec = &ftl0_upload_table[i];
+            if (rec->file_id == 0 || rec->length <= rec->offset)
+                continue;
+            uint32_t remaining = rec->length - rec->offset;
+            for (j=0; j < AX25_MAX_SESSIONS; j++) {
+                ftl0_state_machine_t *state = &ftl0_state_machine[j];
+                if (state->preallocated && state->file_id == rec->file_id && state->prealloc_offset > rec->offset) {
+                    uint32_t allocated = state->prealloc_offset - rec->offset;
+                    remaining = (allocated < remaining) ? remaining - allocated : 0;
+                }
+            }
+            space += remaining;
+        }
+    }
+    ftl0_unlock_upload_table();
+    return space;
+}
 
 /**
  * ftl0_make_packet()
@@ -1172,14 +1968,18 @@ int ftl0_parse_packet_length(uint8_t * data) {
  *
  */
 bool ftl0_get_file_upload_record(uint32_t file_id, InProcessFileUpload_t * file_upload_record) {
-    int i;
-    for (i=0; i < MAX_IN_PROCESS_FILE_UPLOADS; i++) {
-        bool rc = ftl0_mram_get_file_upload_record(i, file_upload_record);
-        if (rc == FALSE) return FALSE;
-        if (file_id == file_upload_record->file_id)
-            return TRUE;
+    bool rc = FALSE;
+    if (file_id == 0) return FALSE;
+    ftl0_lock_upload_table();
+    if (ftl0_upload_table_ready()) {
+        int slot = ftl0_find_upload_slot(file_id);
+        if (slot != -1) {
+            *file_upload_record = ftl0_upload_table[slot];
+            rc = TRUE;
+        }
     }
-    return FALSE;
+    ftl0_unlock_upload_table();
+    return rc;
 }
 
 /**
@@ -1188,6 +1988,15 @@ bool ftl0_get_file_upload_record(uint32_t file_id, InProcessFileUpload_t * file_
  * Return true if it could be stored or false otherwise.
  */
 bool ftl0_set_file_upload_record(InProcessFileUpload_t * file_upload_record) {
+    bool rc;
+    ftl0_lock_upload_table();
+    rc = ftl0_set_file_upload_record_locked(file_upload_record);
+    ftl0_unlock_upload_table();
+    return rc;
+}
+
+/* The body of ftl0_set_file_upload_record(), called with the table locked */
+static bool ftl0_set_file_upload_record_locked(InProcessFileUpload_t * file_upload_record) {
     int i;
     int oldest_id = -1;
     int first_empty_id = -1;
@@ -1212,7 +2021,7 @@ bool ftl0_set_file_upload_record(InProcessFileUpload_t * file_upload_record) {
                  * live right now and then note it as the oldest */
                 bool on_the_uplink_now = FALSE;
                 int j;
-                for (j=0; j < NUM_CHANNELS; j++) {
+                for (j=0; j < AX25_MAX_SESSIONS; j++) {
                     if (ftl0_state_machine[j].ul_state != UL_UNINIT) {
                         if (strcasecmp(ftl0_state_machine[j].callsign, tmp_file_upload_record.callsign) == 0) {
                             on_the_uplink_now = TRUE;                        }
@@ -1247,48 +2056,161 @@ bool ftl0_set_file_upload_record(InProcessFileUpload_t * file_upload_record) {
  * Return true if it could be updated or false otherwise.
  */
 bool ftl0_update_file_upload_record(InProcessFileUpload_t * file_upload_record) {
-    int i;
-    InProcessFileUpload_t tmp_file_upload_record;
-    /* Find the record and update it */
-    for (i=0; i < MAX_IN_PROCESS_FILE_UPLOADS; i++) {
-        bool rc = ftl0_mram_get_file_upload_record(i, &tmp_file_upload_record);
-        if (rc == FALSE) return FALSE;
-        if (tmp_file_upload_record.file_id == file_upload_record->file_id) {
-            /* Update the record in this slot */
-            bool rc3 = ftl0_mram_set_file_upload_record(i, file_upload_record);
-            if (rc3 == FALSE) return FALSE;
-            return TRUE;
-        }
+    bool rc = FALSE;
+    if (file_upload_record->file_id == 0) return FALSE;
+    ftl0_lock_upload_table();
+    if (ftl0_upload_table_ready()) {
+        int slot = ftl0_find_upload_slot(file_upload_record->file_id);
+        if (slot != -1)
+            rc = ftl0_mram_set_file_upload_record(slot, file_upload_record);
     }
-
-    return FALSE;
+    ftl0_unlock_upload_table();
+    return rc;
 }
 
 
 /**
- * Read a record from the file upload table slot
+ * Read a record from the file upload table slot.  This comes from the RAM copy of the table.
  */
 bool ftl0_mram_get_file_upload_record(uint32_t slot, InProcessFileUpload_t * file_upload_record) {
-    bool rc = readNV(file_upload_record, sizeof(InProcessFileUpload_t),NVConfigData, (int)&(LocalFlash->FileUploadsTable[slot]));
-    if (!rc) {
-        debug_print("MRAM File Upload table read - FAILED\n");
-        return FALSE;
+    bool rc = FALSE;
+    if (slot >= MAX_IN_PROCESS_FILE_UPLOADS) return FALSE;
+    ftl0_lock_upload_table();
+    if (ftl0_upload_table_ready()) {
+        *file_upload_record = ftl0_upload_table[slot];
+        rc = TRUE;
     }
-    return TRUE;
+    ftl0_unlock_upload_table();
+    return rc;
 }
 
 /**
- * Write a record to the file upload table
+ * Write a record to the file upload table.  It is written to MRAM and then to the RAM
+ * copy, with the index and the reserved space updated to match.
  */
 bool ftl0_mram_set_file_upload_record(uint32_t id, InProcessFileUpload_t * file_upload_record) {
+    if (id >= MAX_IN_PROCESS_FILE_UPLOADS) return FALSE;
+    ftl0_lock_upload_table();
+    if (!ftl0_upload_table_ready()) {
+        ftl0_unlock_upload_table();
+        return FALSE;
+    }
     bool rc = writeNV(file_upload_record, sizeof(InProcessFileUpload_t),NVConfigData, (int)&(LocalFlash->FileUploadsTable[id]));
     if (!rc) {
+        ftl0_unlock_upload_table();
         debug_print("MRAM File Upload table write - FAILED\n");
         return FALSE;
     }
+    InProcessFileUpload_t *rec = &ftl0_upload_table[id];
+    bool index_changed = (rec->file_id != file_upload_record->file_id);
+    if (rec->file_id != 0)
+        ftl0_upload_table_reserved -= (rec->length - rec->offset);
+    *rec = *file_upload_record;
+    if (rec->file_id != 0)
+        ftl0_upload_table_reserved += (rec->length - rec->offset);
+    if (index_changed)
+        ftl0_rebuild_upload_index();
+    ftl0_unlock_upload_table();
+    return TRUE;
+}
+
+/**
+ * ftl0_init()
+ *
+ * Create the upload table lock and load the table.  Called from main before the tasks
+ * that use the table are started.
+ */
+void ftl0_init() {
+    ftl0_upload_table_mutex = xSemaphoreCreateRecursiveMutex();
+    if (ftl0_upload_table_mutex == NULL)
+        ReportError(SemaphoreFail, TRUE, CharString, (int)"ftl0_upload_table_mutex");
+    ftl0_lock_upload_table();
+    if (!ftl0_upload_table_ready())
+        ReportError(MRAMread, FALSE, CharString, (int)"FTL0: Could not load the upload table");
+    ftl0_unlock_upload_table();
+}
+
+/*
+ * The table may be cleared when MRAM is initialized at boot, before ftl0_init() has
+ * created the lock.  Only one task is using it then, so it is not locked.
+ */
+static void ftl0_lock_upload_table() {
+    if (ftl0_upload_table_mutex != NULL)
+        xSemaphoreTakeRecursive(ftl0_upload_table_mutex, portMAX_DELAY);
+}
+
+static void ftl0_unlock_upload_table() {
+    if (ftl0_upload_table_mutex != NULL)
+        xSemaphoreGiveRecursive(ftl0_upload_table_mutex);
+}
+
+/* Load the table if this is the first use.  Called with the table locked. */
+static bool ftl0_upload_table_ready() {
+    return ftl0_upload_table_loaded || ftl0_load_upload_table();
+}
+
+/**
+ * ftl0_load_upload_table()
+ *
+ * Read the File Upload Table from MRAM into RAM and calculate the index and the
+ * space reserved.  This is done once at boot, or on first use if another task
+ * needs the table before the Uplink Task has started.  Called with the table locked.
+ */
+bool ftl0_load_upload_table() {
+    int i;
+    bool rc = readNV(ftl0_upload_table, sizeof(ftl0_upload_table), NVConfigData, (int)&(LocalFlash->FileUploadsTable[0]));
+    if (!rc) {
+        debug_print("MRAM File Upload table read - FAILED\n");
+        return FALSE;
+    }
+    ftl0_upload_table_reserved = 0;
+    for (i=0; i < MAX_IN_PROCESS_FILE_UPLOADS; i++) {
+        if (ftl0_upload_table[i].file_id != 0)
+            ftl0_upload_table_reserved += (ftl0_upload_table[i].length - ftl0_upload_table[i].offset);
+    }
+    ftl0_rebuild_upload_index();
+    ftl0_upload_table_loaded = TRUE;
     return TRUE;
 }
 
+/**
+ * ftl0_rebuild_upload_index()
+ *
+ * Rebuild the file id to slot index.  The table is small, so it is quicker and simpler
+ * to rebuild it when a slot changes file id than to delete entries from the hash table.
+ * Called with the table locked, as the index is empty part way through.
+ */
+void ftl0_rebuild_upload_index() {
+    int i;
+    for (i=0; i < FTL0_UPLOAD_INDEX_LEN; i++)
+        ftl0_upload_index[i] = -1;
+    for (i=0; i < MAX_IN_PROCESS_FILE_UPLOADS; i++) {
+        uint32_t id = ftl0_upload_table[i].file_id;
+        if (id != 0) {
+            uint32_t h = id & (FTL0_UPLOAD_INDEX_LEN - 1);
+            while (ftl0_upload_index[h] != -1)
+                h = (h + 1) & (FTL0_UPLOAD_INDEX_LEN - 1);
+            ftl0_upload_index[h] = i;
+        }
+    }
+}
+
+/**
+ * ftl0_find_upload_slot()
+ *
+ * Return the slot that holds the record for this file id or -1 if there is none.
+ * Called with the table locked.
+ */
+int ftl0_find_upload_slot(uint32_t file_id) {
+    uint32_t h = file_id & (FTL0_UPLOAD_INDEX_LEN - 1);
+    while (ftl0_upload_index[h] != -1) {
+        if (ftl0_upload_table[ftl0_upload_index[h]].file_id == file_id)
+            return ftl0_upload_index[h];
+        h = (h + 1) & (FTL0_UPLOAD_INDEX_LEN - 1);
+    }
+    return -1;
+}
+
 /**
  * ftl0_remove_file_upload_record()
  * Remove the record from the upload table based on the file id
@@ -1296,25 +2218,25 @@ bool ftl0_mram_set_file_upload_record(uint32_t id, InProcessFileUpload_t * file_
  */
 bool ftl0_remove_file_upload_record(uint32_t id) {
     InProcessFileUpload_t tmp_file_upload_record;
-    InProcessFileUpload_t tmp_file_upload_record2;
     tmp_file_upload_record.file_id = 0;
     tmp_file_upload_record.length = 0;
     tmp_file_upload_record.request_time = 0;
     tmp_file_upload_record.callsign[0] = 0;
+    tmp_file_upload_record.preallocated = 0;
     tmp_file_upload_record.offset = 0;
 
-    int i;
-    for (i=0; i < MAX_IN_PROCESS_FILE_UPLOADS; i++) {
-        bool rc = ftl0_mram_get_file_upload_record(i, &tmp_file_upload_record2);
-        if (rc == FALSE) return FALSE;
-        if (tmp_file_upload_record2.file_id == id) {
-            if (!ftl0_mram_set_file_upload_record(i, &tmp_file_upload_record)) {
-                return FALSE;
-            }
-            return TRUE;
-        }
+    if (id == 0) return TRUE;
+    bool rc = FALSE;
+    ftl0_lock_upload_table();
+    if (ftl0_upload_table_ready()) {
+        int slot = ftl0_find_upload_slot(id);
+        if (slot == -1)
+            rc = TRUE;
+        else
+            rc = ftl0_mram_set_file_upload_record(slot, &tmp_file_upload_record);
     }
-    return TRUE;
+    ftl0_unlock_upload_table();
+    return rc;
 }
 
 /**
@@ -1324,36 +2246,28 @@ bool ftl0_remove_file_upload_record(uint32_t id) {
  *
  */
 int ftl0_get_space_reserved_by_upload_table() {
-    int i;
-    uint32_t space_reserved = 0;
-    InProcessFileUpload_t rec;
-
-    for (i=0; i < MAX_IN_PROCESS_FILE_UPLOADS; i++) {
-        if (!ftl0_mram_get_file_upload_record(i, &rec)) {
-            return 0; // we could not read from MRAM
-        }
-        if (rec.file_id != 0) {
-            //debug_print("Queued File: %x Length: %d Off: %d Remain: %d\n", rec.file_id, rec.length, rec.offset, rec.length-rec.offset);
-            space_reserved += (rec.length - rec.offset); /* We exclude the offset because that will be included in the space consumed on the disk */
-        }
-    }
-    //debug_print("Queue reserved: %d\n",space_reserved);
-    return space_reserved;
+    int reserved = 0; // if we could not read from MRAM
+    ftl0_lock_upload_table();
+    if (ftl0_upload_table_ready())
+        reserved = ftl0_upload_table_reserved;
+    ftl0_unlock_upload_table();
+    //debug_print("Queue reserved: %d\n",reserved);
+    return reserved;
 }
 
 int ftl0_get_num_of_files_in_upload_table() {
     int i;
     int num = 0;
-    InProcessFileUpload_t rec;
 
-    for (i=0; i < MAX_IN_PROCESS_FILE_UPLOADS; i++) {
-        if (!ftl0_mram_get_file_upload_record(i, &rec)) {
-            return FALSE;
-        }
-        if (rec.file_id != 0) {
-            num += 1;
+    ftl0_lock_upload_table();
+    if (ftl0_upload_table_ready()) {
+        for (i=0; i < MAX_IN_PROCESS_FILE_UPLOADS; i++) {
+            if (ftl0_upload_table[i].file_id != 0) {
+                num += 1;
+            }
         }
     }
+    ftl0_unlock_upload_table();
     return num;
 }
 
@@ -1364,14 +2278,38 @@ bool ftl0_clear_upload_table() {
     tmp_file_upload_record.length = 0;
     tmp_file_upload_record.request_time = 0;
     tmp_file_upload_record.callsign[0] = 0;
+    tmp_file_upload_record.preallocated = 0;
     tmp_file_upload_record.offset = 0;
 
+    bool rc = TRUE;
+    ftl0_lock_upload_table();
     for (i=0; i < MAX_IN_PROCESS_FILE_UPLOADS; i++) {
         if (!ftl0_mram_set_file_upload_record(i, &tmp_file_upload_record)) {
-            return FALSE;
+            rc = FALSE;
+            break;
         }
     }
-    return TRUE;
+    ftl0_unlock_upload_table();
+    return rc;
+}
+
+/**
+ * ftl0_upload_in_use()
+ *
+ * Return TRUE if the file is being uploaded on one of the channels or is waiting in the
+ * finalize queue.  Called with the table locked, which also holds the finalize queue still.
+ */
+bool ftl0_upload_in_use(uint32_t file_id) {
+    int i;
+    for (i=0; i < AX25_MAX_SESSIONS; i++) {
+        if (ftl0_state_machine[i].ul_state != UL_UNINIT && ftl0_state_machine[i].file_id == file_id)
+            return TRUE;
+    }
+    for (i=0; i < ftl0_finalize_count; i++) {
+        if (ftl0_finalize_queue[(ftl0_finalize_head + i) % UPLINK_FINALIZE_QUEUE_LEN].file_id == file_id)
+            return TRUE;
+    }
+    return FALSE;
 }
 
 /**
@@ -1391,14 +2329,20 @@ void ftl0_maintenance() {
     blank_file_upload_record.length = 0;
     blank_file_upload_record.request_time = 0;
     blank_file_upload_record.callsign[0] = 0;
+    blank_file_upload_record.preallocated = 0;
     blank_file_upload_record.offset = 0;
 
     for (i=0; i < MAX_IN_PROCESS_FILE_UPLOADS; i++) {
+        /* Hold the table while the record is checked and removed, so the Uplink task does not
+         * update it in between.  It is released while we wait, below. */
+        ftl0_lock_upload_table();
         if (!ftl0_mram_get_file_upload_record(i, &rec)) {
             // skip and keep going in case this is temporary;
+            rec.file_id = 0;
         }
-        // TODO - do not remove file if this is currently in the upload FTL0 state machine
-        if (rec.file_id != 0) {
+        /* Files that are being uploaded or finalized right now are left alone.  They release
+         * their space when they are closed and their record when they are finalized. */
+        if (rec.file_id != 0 && !ftl0_upload_in_use(rec.file_id)) {
             uint32_t now = getUnixTime();
             int32_t age = now-rec.request_time;
             if (age > ReadMRAMFTL0MaxFileAgeInDays()*24*60*60) {
@@ -1414,8 +2358,20 @@ void ftl0_maintenance() {
                 } else {
                     debug_print(" FTL0 Maintenance - Could not remove upload record %d\n",i);
                 }
+            } else {
+                /* Release any preallocated space left behind, e.g. by a reset during the upload */
+                if (rec.preallocated && ReadMRAMBoolState(StateFTL0Preallocate)) {
+                    char file_name_with_path[MAX_FILENAME_WITH_PATH_LEN];
+                    dir_get_upload_file_path_from_file_id(rec.file_id, file_name_with_path, MAX_FILENAME_WITH_PATH_LEN);
+                    if (ftl0_release_upload_space(file_name_with_path, rec.offset) != -1) {
+                        rec.preallocated = 0;
+                        if (!ftl0_mram_set_file_upload_record(i, &rec))
+                            debug_print(" FTL0 Maintenance - Could not update upload record %d\n",i);
+                    }
+                }
             }
         }
+        ftl0_unlock_upload_table();
         vTaskDelay(CENTISECONDS(10)); // yield some time so that other things can do work
     }
 
@@ -1488,6 +2444,17 @@ bool ftl0_debug_list_upload_table() {
     }
     uint32_t space = ftl0_get_space_reserved_by_upload_table();
     debug_print("Remaining Space Allocated: %d\n",space);
+    debug_print("Uploaded bytes: %d Written: %d in %d writes. MRAM bytes written: %d",ftl0_upload_bytes_received,
+                ftl0_upload_bytes_written, ftl0_upload_writes, ftl0_upload_mram_bytes);
+    if (ftl0_upload_bytes_received != 0)
+        debug_print(" (%d per 1000 uploaded)",
+                    (int)((uint64_t)ftl0_upload_mram_bytes * 1000 / ftl0_upload_bytes_received));
+    debug_print("\n");
+    debug_print("Preallocated bytes: %d Released: %d\n",ftl0_upload_bytes_preallocated, ftl0_upload_bytes_released);
+    debug_print("Flow control engaged: %d times for %d ms. Max events waiting: %d\n",ftl0_flow_off_count,
+                ftl0_flow_off_ticks * portTICK_PERIOD_MS, ftl0_flow_max_backlog);
+    debug_print("Files finalized in background: %d, %d failed, %d waiting now, max waiting %d\n",ftl0_finalize_queued,
+                ftl0_finalize_failed, ftl0_finalize_count, ftl0_finalize_max_depth);
     return TRUE;
 }
 
@@ -1609,6 +2576,15 @@ int test_ftl0_upload_table() {
     int reserved = 123 * 24 + 1000;
     if (ftl0_get_space_reserved_by_upload_table() != reserved) { debug_print("Wrong space reserved: %d  - FAILED\n",reserved); return FALSE; }
 
+    /* The RAM copy should match MRAM after a reload */
+    ftl0_lock_upload_table();
+    bool reloaded = ftl0_load_upload_table();
+    ftl0_unlock_upload_table();
+    if (!reloaded) { debug_print("Could not reload upload table - FAILED\n"); return FALSE;}
+    if (ftl0_get_space_reserved_by_upload_table() != reserved) { debug_print("Wrong space reserved after reload - FAILED\n"); return FALSE; }
+    if (!ftl0_get_file_upload_record(9990, &record7))  {  debug_print("ERROR: Could not find 9990 after reload - FAILED\n"); return FALSE; }
+    if (record7.offset != 122999)  {  debug_print("Wrong offset for 9990 after reload - FAILED\n"); return FALSE; }
+
     /* And reset everything */
     if (!ftl0_clear_upload_table()) { debug_print("Could not clear upload table - FAILED\n"); return FALSE;}
 
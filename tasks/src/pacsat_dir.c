@@ -531,11 +531,7 @@ int dir_validate_file(HEADER *pfh, char *file_name_with_path, WdReporters_t repo
             return ER_NO_SUCH_FILE_NUMBER;
         }
 
-        int j;
-        for (j=0; j<num_of_bytes_read;j++){
-            body_checksum += data_buffer[j] & 0xff;
-            body_size++;
-        }
+        dir_validate_body_chunk(data_buffer, num_of_bytes_read, &body_checksum, &body_size);
         if (num_of_bytes_read < MAX_DATA_LEN)
             finished = true;
         offset += num_of_bytes_read;
@@ -544,6 +540,31 @@ int dir_validate_file(HEADER *pfh, char *file_name_with_path, WdReporters_t repo
     }
 
     //debug_print("File check loop done\n");
+    return dir_validate_body(pfh, body_checksum, body_size, file_name_with_path);
+}
+
+/**
+ * dir_validate_body_chunk()
+ * Add the next part of a file body to the running checksum and size.  This lets a caller
+ * read the body a piece at a time and then check it with dir_validate_body().
+ *
+ */
+void dir_validate_body_chunk(uint8_t *data, int32_t len, uint16_t *body_checksum, uint32_t *body_size) {
+    int j;
+    for (j=0; j<len;j++){
+        *body_checksum += data[j] & 0xff;
+    }
+    *body_size += len;
+}
+
+/**
+ * dir_validate_body()
+ * Check the checksum and size of the whole body against its Header.
+ *
+ * Returns ERR_NONE if everything is good.  Otherwise it returns an FTL0 error number.
+ *
+ */
+int dir_validate_body(HEADER *pfh, uint16_t body_checksum, uint32_t body_size, char *file_name_with_path) {
     if (pfh->bodyCRC != body_checksum) {
         debug_print("** Body check failed for %s\n",file_name_with_path);
         return ER_BODY_CHECK;
@@ -33,6 +33,33 @@
 #define BITS_S_REJECT 0b1001
 #define BITS_S_SELECTIVE_REJECT 0b1101
 
+// XID information field.  See section 4.3.3.7 of the v2.2 specification
+#define XID_FORMAT_INDICATOR 0x82
+#define XID_GROUP_IDENTIFIER 0x80
+#define XID_PI_CLASSES_OF_PROCEDURES 2
+#define XID_PI_HDLC_OPTIONAL_FUNCTIONS 3
+#define XID_PI_I_FIELD_LENGTH_RX 6 // In bits
+#define XID_PI_WINDOW_SIZE_RX 8
+#define XID_PI_ACK_TIMER 9 // In ms
+#define XID_PI_RETRIES 10
+// HDLC optional functions are 3 bytes, sent most significant byte first
+#define XID_HDLC_REJ             0x020000
+#define XID_HDLC_SREJ            0x040000
+#define XID_HDLC_EXTENDED_ADDRESS 0x800000
+#define XID_HDLC_MODULO_8        0x000400
+#define XID_HDLC_MODULO_128      0x000800
+#define XID_HDLC_16_BIT_FCS      0x000080
+#define XID_HDLC_SYNCHRONOUS_TX  0x000002
+#define XID_MAX_LEN 20 // The length of the information field that ax25_encode_xid() writes
+
+#define AX25_FLAG 0x7e
+
+// FX.25 correlation tag and Reed-Solomon code word.  See fx25_encode()
+#define FX25_TAG_LEN 8
+#define FX25_RS_BLOCK_LEN 255
+#define FX25_MAX_DATA_LEN 239 // RS(255,239) has the most room for the stuffed frame
+#define FX25_MAX_LEN (FX25_TAG_LEN + FX25_RS_BLOCK_LEN)
+
 typedef enum ax25_frame_type_e {
 
     TYPE_I = 0,   // Information
@@ -59,7 +86,8 @@ typedef struct {
     char via_callsign[MAX_CALLSIGN_LEN];
     uint8_t via_h;
     int command;
-    uint8_t control;
+    uint16_t control; /* For a modulo 128 I or S frame the second control byte is in the upper 8 bits */
+    bool extended; /* Modulo 128 (AX25 v2.2), so I and S frames have a 2 byte control field */
     uint8_t NR;
     uint8_t NS;
     int PF;
@@ -69,18 +97,37 @@ typedef struct {
     uint8_t data_len; // Set this to 0 if there are no data bytes
 } AX25_PACKET;
 
+/*
+ * The XID parameters we negotiate.  A value of zero means the parameter
+ * was not in the XID frame, so the default is used.
+ */
+typedef struct {
+    uint32_t hdlc_functions; // XID_HDLC_ bits, valid if hdlc_present is set
+    bool hdlc_present;
+    uint16_t n1_rx; // Max bytes in the I field the station can receive
+    uint8_t k_rx; // The window size the station can receive
+    uint16_t t1_ms; // Acknowledge timer T1
+} AX25_XID;
+
 
 int decode_call_and_command(uint8_t *c, char *call, int *final_call,
                             int *command);
 int decode_call(uint8_t *c, char *call);
 int encode_call(char *name, uint8_t *buf, int final_call, int command);
+bool ax25_address_matches(uint8_t *address, uint8_t *encoded);
 uint8_t ax25_decode_packet(uint8_t *packet, int len,
-                           AX25_PACKET *decoded_packet);
+                           AX25_PACKET *decoded_packet, bool extended);
+int ax25_decode_xid(uint8_t *info, int len, AX25_XID *xid);
+int ax25_encode_xid(AX25_XID *xid, uint8_t *info, int max_len);
 void ax25_copy_packet(AX25_PACKET *packet, AX25_PACKET *to_packet);
+uint16_t ax25_fcs(uint8_t *bytes, int len);
+int fx25_encode(uint8_t *bytes, int len, uint8_t *out);
+int fx25_encoded_len(int len);
 int print_packet(char *label, uint8_t *packet, int len);
 int print_decoded_packet(char *label, AX25_PACKET *decoded);
 
 int test_ax25_util_print_packet();
 int test_ax25_util_decode_packet();
+int test_ax25_util_fx25();
 
 #endif /* UTILITIES_INC_AX25_UTIL_H_ */
@@ -13,4 +13,10 @@ void update_rs(
    unsigned char c          // Current data byte to update
 );
 
+void update_rs_fx25(
+   unsigned char *parity,  // nroots byte encoder state; zero before each frame
+   unsigned int nroots,    // Number of parity bytes, 16 or 32
+   unsigned char c         // Current data byte to update
+);
+
 #endif /* REEDSOLOMON_H_ */
@@ -29,10 +29,12 @@
  *
  */
 #include "ctype.h"
+#include <string.h>
 
 #include "pacsat.h"
 #include "config.h"
 #include "ax25_util.h"
+#include "reed_solomon.h"
 
 /**
  * Decode a callsign from AX25 format.
@@ -148,16 +150,42 @@ int encode_call(char *name, uint8_t *buf, int final_call, int command)
     return true;
 }
 
+/**
+ * ax25_address_matches()
+ *
+ * Compare a 7 byte address field in a received frame with a callsign
+ * that was encoded with encode_call().  Only the callsign characters and
+ * the SSID are compared, not the command, H or final bits.  This lets us
+ * see who a frame is for without decoding it.  Like strcasecmp() on the
+ * decoded callsign, lower case letters match.
+ */
+bool ax25_address_matches(uint8_t *address, uint8_t *encoded)
+{
+    int i;
+
+    for (i = 0; i < 6; i++) {
+        if (toupper(address[i] >> 1) != (encoded[i] >> 1))
+            return false;
+    }
+    return (address[6] & 0x1E) == (encoded[6] & 0x1E);
+}
+
 /**
  * Given a packet and its length, decode it.  The caller must
  * allocate the structure
  *
+ * The frame does not say if it uses modulo 8 or modulo 128 sequence
+ * numbers.  That was agreed with SABM or SABME when the connection was
+ * made, so the caller sets extended for a modulo 128 connection.  Then
+ * I and S frames have a 2 byte control field.  U frames are the same in
+ * both.
+ *
  * If the packet is too short or there is any other error, then
  * 0 is returned.
  *
  */
 uint8_t ax25_decode_packet(uint8_t *packet, int len,
-                           AX25_PACKET *decoded_packet)
+                           AX25_PACKET *decoded_packet, bool extended)
 {
     if (len < 15)
         return 0;
@@ -174,6 +202,8 @@ uint8_t ax25_decode_packet(uint8_t *packet, int len,
     decoded_packet->NS = 0; // initialize to zero and set if the packet has NS
     decoded_packet->PF = 0; // initialize to zero and set if the packet has PF
     decoded_packet->via_callsign[0] = 0;
+    decoded_packet->extended = false; // set if this is a modulo 128 I or S frame
+    decoded_packet->data_len = 0; // set if the frame has an information field
 
     decode_call_and_command(&packet[0], decoded_packet->to_callsign,
                             &final_call, &destBit);
@@ -203,7 +233,56 @@ uint8_t ax25_decode_packet(uint8_t *packet, int len,
         offset = 21;
     }
     decoded_packet->control = packet[offset];
-    if ((decoded_packet->control & 0b1) == 0) {
+    if (extended && (decoded_packet->control & 0b11) != 0b11) {
+        // A modulo 128 I or S frame.  The second control byte holds NR and PF
+        if (len < offset + 2) {
+            debug_print("ERR: ax25_decode_packet() Not enough bytes for an extended control field\n");
+            return FALSE;
+        }
+        decoded_packet->control |= packet[offset+1] << 8;
+        decoded_packet->extended = true;
+        decoded_packet->NR = (packet[offset+1] >> 1) & 0x7F;
+        decoded_packet->PF = packet[offset+1] & 0b1;
+        if ((decoded_packet->control & 0b1) == 0) {
+            if (len < offset + 3) {
+                debug_print("ERR: ax25_decode_packet() Not enough bytes for an I-frame\n");
+                return FALSE;
+            }
+            if ((len - offset - 3) > AX25_MAX_INFO_BYTES_LEN) {
+                debug_print("ERR: ax25_decode_packet() Too many bytes for an I-frame.  Data would overflow.\n");
+                return FALSE;
+            }
+            decoded_packet->frame_type = TYPE_I;
+            decoded_packet->NS = (packet[offset] >> 1) & 0x7F;
+            decoded_packet->pid = packet[offset+2];
+            decoded_packet->data_len = len-offset-3;
+            for (i=0; i<(decoded_packet->data_len); i++) {
+                decoded_packet->data[i] = packet[offset+3+i];
+            }
+        } else {
+            switch (packet[offset] & S_CONTROL_MASK) {
+                case BITS_S_RECEIVE_READY:
+                    decoded_packet->frame_type = TYPE_S_RR;
+                    break;
+
+                case BITS_S_RECEIVE_NOT_READY:
+                    decoded_packet->frame_type = TYPE_S_RNR;
+                    break;
+
+                case BITS_S_REJECT:
+                    decoded_packet->frame_type = TYPE_S_REJ;
+                    break;
+
+                case BITS_S_SELECTIVE_REJECT:
+                    decoded_packet->frame_type = TYPE_S_SREJ;
+                    break;
+
+                default:
+                    debug_print("ERR: ax25_decode_packet() Invalid S frame type\n");
+                    return FALSE;
+            }
+        }
+    } else if ((decoded_packet->control & 0b1) == 0) {
         // bit 0 = 0 then it is an I-frame
         if (len < offset + 2) {
             debug_print("ERR: ax25_decode_packet() Not enough bytes for an I-frame\n");
@@ -262,7 +341,16 @@ uint8_t ax25_decode_packet(uint8_t *packet, int len,
                 break;
 
             case BITS_U_EXCH_ID:
+                // The parameters follow the control byte.  There is no pid
+                if ((len - offset - 1) > AX25_MAX_INFO_BYTES_LEN) {
+                    debug_print("ERR: ax25_decode_packet() Too many bytes for an XID frame.  Data would overflow.\n");
+                    return FALSE;
+                }
                 decoded_packet->frame_type = TYPE_U_XID;
+                decoded_packet->data_len = len-offset-1;
+                for (i=0; i<(decoded_packet->data_len); i++) {
+                    decoded_packet->data[i] = packet[offset+1+i];
+                }
                 break;
 
             case BITS_U_TEST:
@@ -320,6 +408,7 @@ void ax25_copy_packet(AX25_PACKET *packet, AX25_PACKET *to_packet)
         to_packet->via_callsign[i] = packet->to_callsign[i];
     to_packet->command = packet->command;
     to_packet->control = packet->control;
+    to_packet->extended = packet->extended;
     to_packet->NR = packet->NR;
     to_packet->NS = packet->NS;
     to_packet->PF = packet->PF;
@@ -331,6 +420,113 @@ void ax25_copy_packet(AX25_PACKET *packet, AX25_PACKET *to_packet)
     }
 }
 
+/**
+ * ax25_decode_xid()
+ *
+ * Decode the parameters in the information field of an XID frame.  Each
+ * parameter is an identifier, a length and a value sent most significant
+ * byte first.  Parameters we do not negotiate are skipped.  Values that
+ * are not present are returned as zero.
+ *
+ * Returns FALSE if the field is not a valid XID group.
+ */
+int ax25_decode_xid(uint8_t *info, int len, AX25_XID *xid)
+{
+    int group_len, pos, end, pl, i;
+    uint32_t pv;
+
+    xid->hdlc_functions = 0;
+    xid->hdlc_present = false;
+    xid->n1_rx = 0;
+    xid->k_rx = 0;
+    xid->t1_ms = 0;
+
+    if (len < 4 || info[0] != XID_FORMAT_INDICATOR || info[1] != XID_GROUP_IDENTIFIER)
+        return FALSE;
+    group_len = (info[2] << 8) | info[3];
+    end = 4 + group_len;
+    if (end > len)
+        return FALSE;
+
+    pos = 4;
+    while (pos + 2 <= end) {
+        int pi = info[pos];
+        pl = info[pos+1];
+        pos += 2;
+        if (pos + pl > end)
+            return FALSE;
+        pv = 0;
+        for (i = 0; i < pl && i < 4; i++)
+            pv = (pv << 8) | info[pos+i];
+        pos += pl;
+
+        switch (pi) {
+            case XID_PI_HDLC_OPTIONAL_FUNCTIONS:
+                xid->hdlc_functions = pv;
+                xid->hdlc_present = true;
+                break;
+            case XID_PI_I_FIELD_LENGTH_RX:
+                pv = pv / 8; // bits to bytes
+                xid->n1_rx = (pv > 0xFFFF) ? 0xFFFF : pv;
+                break;
+            case XID_PI_WINDOW_SIZE_RX:
+                xid->k_rx = (pv > 0xFF) ? 0xFF : pv;
+                break;
+            case XID_PI_ACK_TIMER:
+                xid->t1_ms = (pv > 0xFFFF) ? 0xFFFF : pv;
+                break;
+            default:
+                break;
+        }
+    }
+    return TRUE;
+}
+
+/**
+ * ax25_encode_xid()
+ *
+ * Write the parameters in xid into an XID information field.  Parameters
+ * that are zero are left out.  Returns the length or 0 if the buffer of
+ * max_len is too small.
+ */
+int ax25_encode_xid(AX25_XID *xid, uint8_t *info, int max_len)
+{
+    int pos = 4;
+
+    if (max_len < XID_MAX_LEN)
+        return 0;
+    info[0] = XID_FORMAT_INDICATOR;
+    info[1] = XID_GROUP_IDENTIFIER;
+    if (xid->hdlc_present) {
+        info[pos++] = XID_PI_HDLC_OPTIONAL_FUNCTIONS;
+        info[pos++] = 3;
+        info[pos++] = (xid->hdlc_functions >> 16) & 0xff;
+        info[pos++] = (xid->hdlc_functions >> 8) & 0xff;
+        info[pos++] = xid->hdlc_functions & 0xff;
+    }
+    if (xid->n1_rx != 0) {
+        uint16_t bits = xid->n1_rx * 8;
+        info[pos++] = XID_PI_I_FIELD_LENGTH_RX;
+        info[pos++] = 2;
+        info[pos++] = bits >> 8;
+        info[pos++] = bits & 0xff;
+    }
+    if (xid->k_rx != 0) {
+        info[pos++] = XID_PI_WINDOW_SIZE_RX;
+        info[pos++] = 1;
+        info[pos++] = xid->k_rx;
+    }
+    if (xid->t1_ms != 0) {
+        info[pos++] = XID_PI_ACK_TIMER;
+        info[pos++] = 2;
+        info[pos++] = xid->t1_ms >> 8;
+        info[pos++] = xid->t1_ms & 0xff;
+    }
+    info[2] = (pos - 4) >> 8;
+    info[3] = (pos - 4) & 0xff;
+    return pos;
+}
+
 ///**
 // * Given a packet, encode it into the encoded_packet buffer which has max_len
 // * Return the length of the encoded packet
@@ -348,6 +544,170 @@ void ax25_copy_packet(AX25_PACKET *packet, AX25_PACKET *to_packet)
 //    return FALSE;
 //}
 
+/*
+ * FX.25 framing.  The AX.25 frame is bit stuffed with its FCS and flags,
+ * as it would go out on the air, and becomes the data of a Reed-Solomon
+ * code word.  A correlation tag in front of it tells the receiver which
+ * code was used.  Receivers without FX.25 still see an ordinary AX.25
+ * frame between the flags, and ignore the tag and parity as noise.
+ *
+ * The tags are sent LSB first.  They are tried smallest first and the
+ * first code with room for the stuffed frame is used, as Dire Wolf does.
+ */
+typedef struct {
+    uint32_t tag_hi;
+    uint32_t tag_lo;
+    uint8_t data_len; /* Data bytes sent.  The rest of the 255 - nroots are zero */
+    uint8_t nroots;
+} FX25_CODE;
+
+static const FX25_CODE fx25_codes[] = {
+    {0x8F056EB4, 0x369660EE, 32, 16},  /* Tag 04, RS(48,32) */
+    {0xC7DC0508, 0xF3D9B09E, 64, 16},  /* Tag 03, RS(80,64) */
+    {0xFF94DC63, 0x4F1CFF4E, 128, 32}, /* Tag 06, RS(160,128) */
+    {0x6E260B1A, 0xC5835FAE, 223, 32}, /* Tag 05, RS(255,223) */
+    {0xB74DB7DF, 0x8A532F3E, 239, 16}, /* Tag 01, RS(255,239) */
+};
+#define FX25_NUM_CODES (sizeof(fx25_codes) / sizeof(fx25_codes[0]))
+
+/* Return the smallest code with room for stuffed_len data bytes, or NULL if there is none */
+static const FX25_CODE *fx25_find_code(unsigned int stuffed_len)
+{
+    unsigned int i;
+
+    for (i = 0; i < FX25_NUM_CODES; i++)
+        if (stuffed_len <= fx25_codes[i].data_len)
+            return &fx25_codes[i];
+    return NULL;
+}
+
+/*
+ * The AX.25 frame check sequence, CRC-16/X.25.  It is sent low byte
+ * first.  This is not the same CRC as crc16(), which is for PACSAT files.
+ */
+uint16_t ax25_fcs(uint8_t *bytes, int len)
+{
+    uint16_t crc = 0xffff;
+    int i, b;
+
+    for (i = 0; i < len; i++) {
+        crc ^= bytes[i];
+        for (b = 0; b < 8; b++) {
+            if (crc & 1)
+                crc = (crc >> 1) ^ 0x8408;
+            else
+                crc = crc >> 1;
+        }
+    }
+    return crc ^ 0xffff;
+}
+
+/* Add a bit to the FX.25 data, LSB first.  Returns false if it is full */
+static bool fx25_put_bit(uint8_t *data, unsigned int *bitpos, int bit)
+{
+    if (*bitpos >= FX25_MAX_DATA_LEN * 8)
+        return false;
+    if (bit)
+        data[*bitpos >> 3] |= 1 << (*bitpos & 7);
+    (*bitpos)++;
+    return true;
+}
+
+static bool fx25_put_byte(uint8_t *data, unsigned int *bitpos, uint8_t byte,
+                          int *ones, bool stuff)
+{
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        int bit = (byte >> i) & 1;
+
+        if (!fx25_put_bit(data, bitpos, bit))
+            return false;
+        if (!stuff)
+            continue;
+        if (!bit) {
+            *ones = 0;
+        } else if (++(*ones) == 5) {
+            if (!fx25_put_bit(data, bitpos, 0))
+                return false;
+            *ones = 0;
+        }
+    }
+    return true;
+}
+
+/**
+ * fx25_encode()
+ * Wrap the AX.25 frame in bytes, without its FCS, in an FX.25 code word.
+ * out must hold FX25_MAX_LEN bytes.  It gets the correlation tag, then the
+ * flag, the stuffed frame and FCS and flags to fill the data, then the
+ * parity.  These are sent raw, without the HDLC framing of the radio.
+ *
+ * Returns the number of bytes in out, or 0 if the frame is too long for
+ * FX.25 and should be sent as plain AX.25.
+ */
+int fx25_encode(uint8_t *bytes, int len, uint8_t *out)
+{
+    uint8_t *data = out + FX25_TAG_LEN;
+    uint8_t *parity;
+    const FX25_CODE *code;
+    unsigned int bitpos = 0, stuffed_len, i;
+    uint16_t fcs = ax25_fcs(bytes, len);
+    int ones = 0;
+
+    memset(data, 0, FX25_MAX_DATA_LEN);
+    if (!fx25_put_byte(data, &bitpos, AX25_FLAG, &ones, false))
+        return 0;
+    for (i = 0; i < (unsigned int)len; i++)
+        if (!fx25_put_byte(data, &bitpos, bytes[i], &ones, true))
+            return 0;
+    if (!fx25_put_byte(data, &bitpos, fcs & 0xff, &ones, true)
+            || !fx25_put_byte(data, &bitpos, fcs >> 8, &ones, true)
+            || !fx25_put_byte(data, &bitpos, AX25_FLAG, &ones, false))
+        return 0;
+    stuffed_len = (bitpos + 7) / 8;
+
+    code = fx25_find_code(stuffed_len);
+    if (code == NULL)
+        return 0;
+
+    /* Carry on with flags, bit by bit, to the end of the data */
+    for (i = 0; bitpos < code->data_len * 8; i = (i + 1) & 7)
+        fx25_put_bit(data, &bitpos, (AX25_FLAG >> i) & 1);
+
+    for (i = 0; i < 4; i++) {
+        out[i] = code->tag_lo >> (i * 8);
+        out[i + 4] = code->tag_hi >> (i * 8);
+    }
+
+    parity = data + code->data_len;
+    memset(parity, 0, code->nroots);
+    for (i = 0; i < code->data_len; i++)
+        update_rs_fx25(parity, code->nroots, data[i]);
+    for (; i < (unsigned int)(FX25_RS_BLOCK_LEN - code->nroots); i++)
+        update_rs_fx25(parity, code->nroots, 0);
+
+    return FX25_TAG_LEN + code->data_len + code->nroots;
+}
+
+/**
+ * fx25_encoded_len()
+ * Return the number of bytes fx25_encode() would send for an AX.25 frame
+ * of len bytes, without its FCS, allowing for the most bit stuffing the
+ * frame could need.  This is for working out airtime without encoding the
+ * frame.  Returns 0 if the frame may be too long for FX.25.
+ */
+int fx25_encoded_len(int len)
+{
+    /* The flags are not stuffed.  At most one bit is added for every five */
+    unsigned int bits = 16 + (len + 2) * 8 * 6 / 5;
+    const FX25_CODE *code = fx25_find_code((bits + 7) / 8);
+
+    if (code == NULL)
+        return 0;
+    return FX25_TAG_LEN + code->data_len + code->nroots;
+}
+
 char *frame_type_strings[] = {"I","RR","RNR","REJ","SREJ", "SABME", "SABM",
                               "DISC", "DM", "UA","FRMR","UI", "XID", "TEST" };
 
@@ -355,7 +715,7 @@ int print_packet(char *label, uint8_t *packet, int len)
 {
     AX25_PACKET decoded;
 
-    if (ax25_decode_packet(packet, len, &decoded)) {
+    if (ax25_decode_packet(packet, len, &decoded, false)) {
         print_decoded_packet(label, &decoded);
         return true;
     }
@@ -425,7 +785,7 @@ int test_ax25_util_decode_packet()
                      0x96, 0x98, 0x82, 0x40, 0xe1, 0x11, 0xe1 };
 
     printf("##### TEST AX25 UTIL DECODE\n");
-    rc = ax25_decode_packet(&by[0], sizeof(by), &packet);
+    rc = ax25_decode_packet(&by[0], sizeof(by), &packet, false);
     print_decoded_packet("TEST:", &packet);
 
     if (packet.PF != 1) {
@@ -441,6 +801,73 @@ int test_ax25_util_decode_packet()
         return FALSE;
     }
 
+    /* The raw address matches the encoded callsign without a decode */
+    uint8_t call[7];
+    encode_call("VE2TCP-12", call, false, 0);
+    if (!ax25_address_matches(&by[0], call)) {
+        printf("** Encoded address VE2TCP-12 did not match\n");
+        return FALSE;
+    }
+    encode_call("VE2TCP-11", call, false, 0);
+    if (ax25_address_matches(&by[0], call)) {
+        printf("** Encoded address VE2TCP-11 should not match\n");
+        return FALSE;
+    }
+
+    /* The same stations with a modulo 128 I frame command NS=100 NR=77 P=1 and 2 data bytes */
+    uint8_t by_ext[] = { 0xac, 0x8a, 0x64, 0xa8, 0x86, 0xa0, 0xf8, 0x8e, 0x60,
+                         0x96, 0x98, 0x82, 0x40, 0x61, 0xc8, 0x9b, 0xf0, 0x41, 0x42 };
+    rc = ax25_decode_packet(&by_ext[0], sizeof(by_ext), &packet, true);
+    print_decoded_packet("TEST:", &packet);
+    if (packet.frame_type != TYPE_I || !packet.extended || packet.command != 1) {
+        printf("** Mismatched type != extended I command\n");
+        return FALSE;
+    }
+    if (packet.NS != 100 || packet.NR != 77 || packet.PF != 1) {
+        printf("** Mismatched NS/NR/PF != 100/77/1\n");
+        return FALSE;
+    }
+    if (packet.pid != 0xf0 || packet.data_len != 2 || packet.data[0] != 0x41) {
+        printf("** Mismatched pid or data\n");
+        return FALSE;
+    }
+
+    /* An XID command with the parameters DireWolf sends: REJ/SREJ, modulo 128,
+     * N1 of 256 bytes, window 32, T1 of 3000ms and 10 retries */
+    uint8_t by_xid[] = { 0xac, 0x8a, 0x64, 0xa8, 0x86, 0xa0, 0xf8, 0x8e, 0x60,
+                         0x96, 0x98, 0x82, 0x40, 0x61, 0xbf,
+                         0x82, 0x80, 0x00, 0x17, 0x02, 0x02, 0x00, 0x21, 0x03, 0x03,
+                         0x86, 0xa8, 0x02, 0x06, 0x02, 0x08, 0x00, 0x08, 0x01, 0x20,
+                         0x09, 0x02, 0x0b, 0xb8, 0x0a, 0x01, 0x0a };
+    AX25_XID xid;
+    uint8_t info[XID_MAX_LEN];
+    rc = ax25_decode_packet(&by_xid[0], sizeof(by_xid), &packet, true);
+    print_decoded_packet("TEST:", &packet);
+    if (packet.frame_type != TYPE_U_XID || packet.PF != 1 || packet.data_len != 27) {
+        printf("** Mismatched type != XID with 27 bytes\n");
+        return FALSE;
+    }
+    if (!ax25_decode_xid(packet.data, packet.data_len, &xid)) {
+        printf("** Could not decode XID parameters\n");
+        return FALSE;
+    }
+    if (!xid.hdlc_present || !(xid.hdlc_functions & XID_HDLC_SREJ)
+            || !(xid.hdlc_functions & XID_HDLC_MODULO_128)
+            || xid.n1_rx != 256 || xid.k_rx != 32 || xid.t1_ms != 3000) {
+        printf("** Mismatched XID parameters\n");
+        return FALSE;
+    }
+    /* Our response should decode to the same values */
+    xid.n1_rx = AX25_MAX_INFO_BYTES_LEN;
+    xid.k_rx = 16;
+    int info_len = ax25_encode_xid(&xid, info, sizeof(info));
+    if (info_len == 0 || !ax25_decode_xid(info, info_len, &xid)
+            || xid.n1_rx != AX25_MAX_INFO_BYTES_LEN || xid.k_rx != 16 || xid.t1_ms != 3000
+            || !(xid.hdlc_functions & XID_HDLC_SREJ)) {
+        printf("** Mismatched XID after encode and decode\n");
+        return FALSE;
+    }
+
     if (rc == TRUE)
           printf("##### TEST AX25 UTIL DECODE: success\n");
       else
@@ -448,3 +875,76 @@ int test_ax25_util_decode_packet()
 
       return rc;
 }
+
+/*
+ * The expected FX.25 output was made with a separate encoder, written from
+ * the FX.25 spec, and checked by computing the syndromes of each code word,
+ * as an FX.25 decoder does.
+ */
+int test_ax25_util_fx25()
+{
+    static uint8_t out[FX25_MAX_LEN];
+    int rc = TRUE;
+    int i, len;
+
+    /* UI frame QST>PACSAT-11 "Hello" */
+    uint8_t by[] = { 0xa2, 0xa6, 0xa8, 0x40, 0x40, 0x40, 0xe0, 0xa0, 0x82,
+                     0x86, 0xa6, 0x82, 0xa8, 0x77, 0x03, 0xf0, 0x48, 0x65,
+                     0x6c, 0x6c, 0x6f };
+    /* Tag 04, the flag, frame and FCS 0x226a, flags, 16 parity bytes */
+    const uint8_t by_fx25[] = {
+        0xee, 0x60, 0x96, 0x36, 0xb4, 0x6e, 0x05, 0x8f, 0x7e, 0xa2, 0xa6, 0xa8,
+        0x40, 0x40, 0x40, 0xe0, 0xa0, 0x82, 0x86, 0xa6, 0x82, 0xa8, 0x77, 0x03,
+        0xf0, 0x48, 0x65, 0x6c, 0x6c, 0x6f, 0x6a, 0x22, 0x7e, 0x7e, 0x7e, 0x7e,
+        0x7e, 0x7e, 0x7e, 0x7e, 0x5b, 0x6d, 0xc7, 0x8f, 0xad, 0x6f, 0xde, 0x4f,
+        0x4c, 0xdc, 0x20, 0x85, 0x22, 0x57, 0x33, 0xaa };
+    /* Parity of a 100 byte frame of (i * 7 + 3), which goes in tag 06 */
+    const uint8_t parity_100[] = {
+        0xb2, 0x1c, 0x73, 0x7e, 0x57, 0x8a, 0x28, 0x97, 0xc3, 0xd3, 0x8f, 0xfc,
+        0x46, 0xf1, 0xf6, 0x92, 0x95, 0x90, 0xbb, 0x63, 0x6a, 0xb2, 0x41, 0x07,
+        0x47, 0x41, 0x17, 0xf0, 0xf3, 0xe4, 0xda, 0xeb };
+    static uint8_t frame[217];
+
+    printf("##### TEST AX25 UTIL FX25\n");
+    if (ax25_fcs((uint8_t *)"123456789", 9) != 0x906e) {
+        printf("** FCS of the check string %04x != 906e\n", ax25_fcs((uint8_t *)"123456789", 9));
+        rc = FALSE;
+    }
+
+    len = fx25_encode(by, sizeof(by), out);
+    if (len != sizeof(by_fx25) || memcmp(out, by_fx25, len) != 0) {
+        printf("** Mismatched RS(48,32) code word, len %d\n", len);
+        rc = FALSE;
+    }
+
+    for (i = 0; i < 100; i++)
+        frame[i] = i * 7 + 3;
+    len = fx25_encode(frame, 100, out);
+    if (len != FX25_TAG_LEN + 160 || out[0] != 0x4e
+            || memcmp(out + len - sizeof(parity_100), parity_100, sizeof(parity_100)) != 0) {
+        printf("** Mismatched RS(160,128) code word, len %d\n", len);
+        rc = FALSE;
+    }
+
+    /* A full PB frame fits in tag 01, unless stuffing makes it too long */
+    for (i = 0; i < (int)sizeof(frame); i++)
+        frame[i] = i * 13;
+    len = fx25_encode(frame, sizeof(frame), out);
+    if (len != FX25_MAX_LEN || out[0] != 0x3e) {
+        printf("** 217 byte frame not in RS(255,239), len %d\n", len);
+        rc = FALSE;
+    }
+    memset(frame, 0xff, sizeof(frame));
+    len = fx25_encode(frame, sizeof(frame), out);
+    if (len != 0) {
+        printf("** 217 bytes of ones should be too long for FX.25, len %d\n", len);
+        rc = FALSE;
+    }
+
+    if (rc == TRUE)
+        printf("##### TEST AX25 UTIL FX25: success\n");
+    else
+        printf("##### TEST AX25 UTIL FX25: fail\n");
+
+    return rc;
+}
@@ -15,6 +15,8 @@
 #include "downlink.h"
 #include "serialDriver.h"
 #include "nonvolManagement.h"
+#include "Ax25Task.h"
+#include "TxTask.h"
 #include "nonvol.h"
 #include "ADS7828.h"
 #include "errors.h"
@@ -348,6 +350,9 @@ char *modulation_to_str(enum radio_modulation mod)
     case MODULATION_AFSK_1200_FEC:
         return "1200fec";
 
+    case MODULATION_AFSK_1200_FX25:
+        return "1200fx25";
+
     case MODULATION_MSK_2400_FEC:
         return "2400fec";
 
@@ -360,6 +365,9 @@ char *modulation_to_str(enum radio_modulation mod)
     case MODULATION_GMSK_9600_FEC:
         return "9600fec";
 
+    case MODULATION_GMSK_9600_FX25:
+        return "9600fx25";
+
     case MODULATION_MSK_19200_FEC:
         return "19200fec";
 
@@ -377,6 +385,47 @@ char *modulation_to_str(enum radio_modulation mod)
     }
 }
 
+/*
+ * Return the rate in bits per second at which frame bytes are sent with
+ * this modulation.  The convolutional code sends two bits for every data
+ * bit, so FEC halves the rate.
+ */
+uint32_t modulation_to_bit_rate(enum radio_modulation mod)
+{
+    uint32_t rate;
+
+    switch (MODULATION_TO_BASE_MODULATION(mod)) {
+    case MODULATION_MSK_2400:
+        rate = 2400;
+        break;
+    case MODULATION_MSK_4800:
+        rate = 4800;
+        break;
+    case MODULATION_GMSK_9600:
+        rate = 9600;
+        break;
+    case MODULATION_MSK_19200:
+        rate = 19200;
+        break;
+    case MODULATION_MSK_25K:
+        rate = 25000;
+        break;
+    case MODULATION_MSK_50K:
+        rate = 50000;
+        break;
+    case MODULATION_MSK_100K:
+        rate = 100000;
+        break;
+    case MODULATION_AFSK_1200:
+    default:
+        rate = 1200;
+        break;
+    }
+    if (MODULATION_TO_FEC(mod) & FEC_CONV)
+        rate = rate / 2;
+    return rate;
+}
+
 #ifdef DEBUG
 static const char *getTaskName(unsigned int task)
 {
@@ -403,7 +452,8 @@ void DisplayTelemetry(uint32_t typeRequested)
                 "  TX Inhibit=%d\n\r"
                 "  CommandedSafeMode=%d,Autosafe=%d\n\r"
                 "  CommandRcvd=%d,AllowAutoSafe=%d\n\r"
-                "  Enabled: PB=%d,FTL0=%d,Digi=%d,Telem=%d,Time=%d,WOD=%d,Err WOD=%d\n\r",
+                "  Enabled: PB=%d,FTL0=%d,Digi=%d,Telem=%d,Time=%d,WOD=%d,Err WOD=%d\n\r"
+                "  FTL0 Preallocate=%d\n\r",
                ReadMRAMBoolState(StateTransmitInhibit),
                ReadMRAMBoolState(StateCommandedSafeMode),
                ReadMRAMBoolState(StateAutoSafe),
@@ -415,15 +465,18 @@ void DisplayTelemetry(uint32_t typeRequested)
                ReadMRAMBoolState(StateTelemBroadcastEnabled),
                ReadMRAMBoolState(StateTimeBroadcastEnabled),
                ReadMRAMBoolState(StateWodEnabled),
-               ReadMRAMBoolState(StateErrWodEnabled));
+               ReadMRAMBoolState(StateErrWodEnabled),
+               ReadMRAMBoolState(StateFTL0Preallocate));
 
         printf("MRAM Telem Values:\n\r"
-                "  PB Status Period(s)=%d, PB Timeout(s)=%d, Uplink Status Period(s)=%d\n\r"
+                "  PB Status Period(s)=%d-%d, PB Timeout(s)=%d, Uplink Status Period(s)=%d-%d\n\r"
                 "  Period(s): Time=%d, Telem=%d, WOD=%d, Err WOD=%d\n\r"
                 "  Max FileSize(bytes) WOD=%d, Err WOD=%d, Exp=%d\n\r",
                 ReadMRAMPBStatusFreq(),
+                ReadMRAMPBStatusMaxFreq(),
                 ReadMRAMPBClientTimeout(),
                 ReadMRAMFTL0StatusFreq(),
+                ReadMRAMFTL0StatusMaxFreq(),
                 ReadMRAMTimeFreq(),
                 ReadMRAMTelemFreq(),
                 ReadMRAMWODFreq(),
@@ -435,6 +488,40 @@ void DisplayTelemetry(uint32_t typeRequested)
         printf("  RX Modes:");
         for (i = 0; i < NUM_RX_CHANNELS; i++)
             printf(" [%d] %s", i, modulation_to_str(ReadMRAMModulation(i)));
+        AX25_digi_counters_t digi;
+        ax25_digi_counters(&digi);
+        printf("\n  Digi: Airtime(%%)=%d, Forwarded=%d, Dropped: Duplicate=%d, Over budget=%d, TX queue full=%d",
+               ReadMRAMDigiAirtimePercent(), digi.forwarded, digi.duplicates,
+               digi.over_budget, digi.queue_full);
+        AX25_timer_counters_t timers;
+        ax25_timer_counters(&timers);
+        printf("\n  AX25 timers: Started or stopped=%d, Expired=%d, Frames=%d, Per 10 frames=%d",
+               timers.operations, timers.expired, timers.frames,
+               timers.frames ? (int)(timers.operations * 10 / timers.frames) : 0);
+        TX_fifo_counters_t fifo;
+        tx_fifo_counters(&fifo);
+        printf("\n  TX FIFO: Frames=%d, Back to back=%d, Refills=%d, Underruns=%d, Average load time(us)=%d",
+               fifo.frames, fifo.burst_frames, fifo.refills, fifo.underruns,
+               fifo.frames ? (int)((uint64_t)fifo.load_ticks * portTICK_RATE_MS * 1000 / fifo.frames) : 0);
+        printf("\n  TX FX25: Frames=%d, Too long=%d", fifo.fx25_frames, fifo.fx25_too_long);
+        static const char *tx_class_names[TX_NUM_CLASSES] = {"Control", "Connected", "PB", "Telem"};
+        TX_queue_counters_t txq;
+        tx_queue_counters(&txq);
+        printf("\n  TX queue wait(ms) avg/max:");
+        for (i = 0; i < TX_NUM_CLASSES; i++)
+            printf(" %s=%d/%d", tx_class_names[i],
+                   txq.frames[i] ? (int)(txq.wait_ticks[i] / txq.frames[i] * portTICK_RATE_MS) : 0,
+                   (int)(txq.max_wait_ticks[i] * portTICK_RATE_MS));
+        printf("\n  TX queue full:");
+        for (i = 0; i < TX_NUM_CLASSES; i++)
+            printf(" %s=%d", tx_class_names[i], txq.dropped[i]);
+        TX_governor_status_t gov;
+        tx_governor_status(&gov);
+        printf("\n  TX governor: Duty cycle(%%)=%d of %d, PA temp(C)=%d of %d, Throttle=%d,"
+               " Time(s) PB held=%d, Control only=%d",
+               gov.duty_percent, ReadMRAMTxMaxDutyPercent(), gov.pa_temp, ReadMRAMTxMaxPATemp(),
+               gov.throttle, gov.throttled_ticks[TX_THROTTLE_PB] / SECONDS(1),
+               gov.throttled_ticks[TX_THROTTLE_CONTROL_ONLY] / SECONDS(1));
         printf("\n  Uncommanded Seconds in Orbit=%d\n\r",
                 (unsigned int) ReadMRAMSecondsOnOrbit());
                 bool onOrbit = ReadMRAMBoolState(StateInOrbit);